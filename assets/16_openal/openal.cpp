@@ -20,20 +20,11 @@
 // clang-format on
 
 #include "utility/camera.hpp"
+#include "utility/lights.hpp"
 #include "utility/model.hpp"
 #include "utility/openal_utils.hpp"
 #include "utility/opengl_utils.hpp"
 
-struct PointLight {
-    glm::vec3 position;
-    glm::vec3 ambient;
-    glm::vec3 diffuse;
-    glm::vec3 specular;
-    float Kc;
-    float Kl;
-    float Kq;
-};
-
 void process_input(GLFWwindow* window,
                    const float& delta_time,
                    utility::camera::Camera& camera,
@@ -48,6 +39,9 @@ static constexpr int SCREEN_HEIGHT = 600;
 static constexpr float NEAR_PLANE = 0.1f;
 static constexpr float FAR_PLANE  = 1000.0f;
 
+// Uniform buffer binding point for the lights in the scene
+static constexpr unsigned int LIGHTS_BINDING = 0;
+
 int main() {
     // create our camera objects
     // -------------------------
@@ -59,6 +53,7 @@ int main() {
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, utility::debug_context);
 
     // glfw window creation
     // --------------------
@@ -107,8 +102,16 @@ int main() {
         return -1;
     }
 
+    // load any OpenGL functionality newer than the version glad was generated for
+    // ---------------------------------------------------------------------------
+    utility::gl::load_extensions((GLADloadproc) glfwGetProcAddress);
+
     render(window, camera);
 
+    // the objects that render created have been released, delete them while the context still exists
+    // ------------------------------------------------------------------------------------------------
+    utility::gl::get_deletion_queue().flush();
+
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
     glfwTerminate();
@@ -150,32 +153,97 @@ void process_input(GLFWwindow* window,
 }
 
 void render(GLFWwindow* window, utility::camera::Camera& camera) {
-    // positions of the point lights
-    std::array<PointLight, 4> point_lights = {
-        PointLight{
+    // all of the lights in the scene
+    // ------------------------------
+    utility::lights::LightBlock<4> scene_lights;
+    scene_lights.sun = utility::lights::DirectionalLight{
+        glm::vec3(-0.2f, -1.0f, -0.3f), glm::vec3(0.2f), glm::vec3(0.5f), glm::vec3(1.0f)};
+    scene_lights.lights = {
+        utility::lights::PointLight{
             glm::vec3(0.7f, 0.2f, 2.0f), glm::vec3(0.05f), glm::vec3(0.8f), glm::vec3(1.0f), 1.0f, 0.09f, 0.032f},
-        PointLight{
+        utility::lights::PointLight{
             glm::vec3(2.3f, -3.3f, -4.0f), glm::vec3(0.05f), glm::vec3(0.8f), glm::vec3(1.0f), 1.0f, 0.09f, 0.032f},
-        PointLight{
+        utility::lights::PointLight{
             glm::vec3(-4.0f, 2.0f, -12.0f), glm::vec3(0.05f), glm::vec3(0.8f), glm::vec3(1.0f), 1.0f, 0.09f, 0.032f},
-        PointLight{
+        utility::lights::PointLight{
             glm::vec3(0.0f, 0.0f, -3.0f), glm::vec3(0.05f), glm::vec3(0.8f), glm::vec3(1.0f), 1.0f, 0.09f, 0.032f}};
+    scene_lights.lamp = utility::lights::SpotLight{camera.get_position(),
+                                                   camera.get_view_direction(),
+                                                   glm::vec3(0.0f),
+                                                   glm::vec3(1.0f),
+                                                   glm::vec3(1.0f),
+                                                   1.000f,
+                                                   0.090f,
+                                                   0.032f,
+                                                   std::cos(glm::radians(12.5f)),
+                                                   std::cos(glm::radians(15.0f)),
+                                                   true};
+
+    // every model's vertices and indices are sub-allocated out of a few large buffers
+    // --------------------------------------------------------------------------------
+    utility::gl::buffer_pool geometry;
+
+    // compress the model's textures to BC1/BC3 as they are loaded, the compressed images are kept next to the model so
+    // later runs load them straight from disk. Drivers without BC1/BC3 get mip chains that are filtered on the CPU and
+    // cached the same way instead
+    // ----------------------------------------------------------------------------------------------------------------
+    utility::gl::get_texture_cache().use_compression("models/openal");
+    utility::gl::get_texture_cache().use_mipmaps("models/openal");
+
+    // load nanosuit model, with compressed vertices to halve the vertex memory and bandwidth,
+    // all of its meshes in shared buffers so that it is drawn with as few draw calls as possible,
+    // and its maps in texture arrays so that the textures are only bound once per frame
+    // its textures keep decoding in the background until finish_loading
+    // ----------------------------------------------------------------------------------------------
+    utility::model::Model nanosuit("models/openal/nanosuit.obj", true, true, &geometry, true);
+
+    // specialise the shaders for this scene
+    // the number of lights, the spotlight fade, and the model's materials never change, so the compiler can unroll the
+    // lighting loops and drop the paths that we don't use
+    // the program compiles in the background while the rest of the scene loads, and finishes linking when it is first
+    // used
+    // -----------------------------------------------------------------------------------------------------------------
+    utility::gl::shader_variants programs;
+    programs.use_binary_cache("shaders/openal");
+    programs.add_shader("shaders/openal/openal.vert", GL_VERTEX_SHADER);
+    programs.add_shader("shaders/openal/openal.frag", GL_FRAGMENT_SHADER);
+
+    utility::gl::shader_defines defines = nanosuit.material_defines();
+    defines["NR_POINT_LIGHTS"]          = std::to_string(scene_lights.lights.size());
+    defines["SPOT_FADE"]                = std::to_string(scene_lights.lamp.fade);
+
+    utility::gl::shader_program& program = programs.get(defines);
+
+    // upload the model's textures while the driver compiles the program
+    // -----------------------------------------------------------------
+    nanosuit.finish_loading();
+
+    // stream the lights through a ring of uniform buffer space, each frame writes a fresh copy of the lights so the
+    // GPU can keep reading the copies from earlier frames while we write the next one
+    // (the extra 256 bytes per frame leaves room for the uniform buffer offset alignment)
+    // -------------------------------------------------------------------------------------------------------------
+    utility::gl::stream_buffer lights_buffer(GL_UNIFORM_BUFFER, 4 * (sizeof(scene_lights) + 256));
+
+    // load up sound file
+    // ------------------
+    const glm::vec3 sound_position(0.0f, 1.75f, -2.0f);
+    utility::al::OpenAL sound_bite(sound_position);
+    sound_bite.load_audio("audio/openal/bugs_02.wav");
 
-    // load, compile, and link the vertex and fragment shaders
-    // -------------------------------------------------------
-    utility::gl::shader_program program;
-    program.add_shader("shaders/openal/openal.vert", GL_VERTEX_SHADER);
-    program.add_shader("shaders/openal/openal.frag", GL_FRAGMENT_SHADER);
-    program.link();
+    // resolve uniform handles once so the render loop doesn't need to look them up by name, this is the first use of
+    // the program so it waits here for the link to finish
+    // ---------------------------------------------------------------------------------------------------------------
+    auto Hvw_uniform                = program.get_uniform<glm::mat4>("Hvw");
+    auto Hcv_uniform                = program.get_uniform<glm::mat4>("Hcv");
+    auto Hwm_uniform                = program.get_uniform<glm::mat4>("Hwm");
+    auto material_shininess_uniform = program.get_uniform<float>("material.shininess");
+    auto view_position_uniform      = program.get_uniform<glm::vec3>("viewPosition");
+    program.bind_uniform_block<utility::lights::LightBlock<4>>("Lights", LIGHTS_BINDING);
 
     // make sure OpenGL will perform depth testing
     // -------------------------------------------
     glEnable(GL_DEPTH_TEST);
 
-    // load nanosuit model
-    // -------------------
-    program.use();
-    utility::model::Model nanosuit("models/openal/nanosuit.obj");
     glm::vec3 nanosuit_position(0.0f, -1.75f, -2.0f);
 
     // keep track of frame rendering times
@@ -183,12 +251,6 @@ void render(GLFWwindow* window, utility::camera::Camera& camera) {
     float delta_time = 0.0f;
     float last_frame = glfwGetTime();
 
-    // load up sound file
-    // ------------------
-    const glm::vec3 sound_position(0.0f, 1.75f, -2.0f);
-    utility::al::OpenAL sound_bite(sound_position);
-    sound_bite.load_audio("audio/openal/bugs_02.wav");
-
     // track camera velocity
     // ---------------------
     glm::vec3 camera_velocity(glm::vec3(0.0f));
@@ -225,48 +287,33 @@ void render(GLFWwindow* window, utility::camera::Camera& camera) {
 
         // update the uniforms
         // -------------------
-        program.set_uniform("Hvw", camera.get_view_transform());
-        program.set_uniform("Hcv", camera.get_clip_transform());
+        program.set_uniform(Hvw_uniform, camera.get_view_transform());
+        program.set_uniform(Hcv_uniform, camera.get_clip_transform());
         glm::mat4 Hwm = glm::translate(glm::mat4(1.0f), nanosuit_position);
         Hwm           = glm::scale(Hwm, glm::vec3(0.2f, 0.2f, 0.2f));
         Hwm           = glm::rotate(Hwm, glm::radians(current_frame * 50.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-        program.set_uniform("Hwm", Hwm);
-
-        program.set_uniform("material.shininess", 32.0f);
-        program.set_uniform("viewPosition", camera.get_position());
-
-        program.set_uniform("sun.direction", glm::vec3(-0.2f, -1.0f, -0.3f));
-        program.set_uniform("sun.ambient", glm::vec3(0.2f, 0.2f, 0.2f));
-        program.set_uniform("sun.diffuse", glm::vec3(0.5f, 0.5f, 0.5f));
-        program.set_uniform("sun.specular", glm::vec3(1.0f, 1.0f, 1.0f));
-
-        for (size_t i = 0; i < 4; ++i) {
-            program.set_uniform(fmt::format("lights[{}].position", i), point_lights[i].position);
-            program.set_uniform(fmt::format("lights[{}].ambient", i), point_lights[i].ambient);
-            program.set_uniform(fmt::format("lights[{}].diffuse", i), point_lights[i].diffuse);
-            program.set_uniform(fmt::format("lights[{}].specular", i), point_lights[i].specular);
-            program.set_uniform(fmt::format("lights[{}].Kc", i), point_lights[i].Kc);
-            program.set_uniform(fmt::format("lights[{}].Kl", i), point_lights[i].Kl);
-            program.set_uniform(fmt::format("lights[{}].Kq", i), point_lights[i].Kq);
-        }
-
-        program.set_uniform("lamp.position", camera.get_position());
-        program.set_uniform("lamp.direction", camera.get_view_direction());
-        program.set_uniform("lamp.ambient", glm::vec3(0.0f));
-        program.set_uniform("lamp.diffuse", glm::vec3(1.0f));
-        program.set_uniform("lamp.specular", glm::vec3(1.0f));
-        program.set_uniform("lamp.phi", std::cos(glm::radians(12.5f)));
-        program.set_uniform("lamp.gamma", std::cos(glm::radians(15.0f)));
-        program.set_uniform("lamp.Kc", 1.000f);
-        program.set_uniform("lamp.Kl", 0.090f);
-        program.set_uniform("lamp.Kq", 0.032f);
+        program.set_uniform(Hwm_uniform, Hwm);
+
+        program.set_uniform(material_shininess_uniform, 32.0f);
+        program.set_uniform(view_position_uniform, camera.get_position());
+
+        // the lamp follows the camera, so it is the only light that changes each frame
+        scene_lights.lamp.position  = camera.get_position();
+        scene_lights.lamp.direction = camera.get_view_direction();
+        lights_buffer.bind_range(LIGHTS_BINDING, lights_buffer.write(scene_lights), sizeof(scene_lights));
 
         // Render the nanosuit
         nanosuit.render(program);
 
+        // this frame's copy of the lights can be reused once the GPU gets past this point
+        lights_buffer.fence();
+
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
         // -------------------------------------------------------------------------------
         glfwSwapBuffers(window);
         glfwPollEvents();
+
+        // delete the OpenGL objects that were released this frame, all at once at the frame boundary
+        utility::gl::get_deletion_queue().flush();
     }
 }
@@ -3,17 +3,62 @@
 // *****************
 // *** CONSTANTS ***
 // *****************
+// Any of these can be overridden by the program (see shader_program::set_defines) to make a specialised variant
+#ifndef NR_POINT_LIGHTS
 #define NR_POINT_LIGHTS 4
+#endif
+#ifndef NR_DIFFUSE_MAPS
 #define NR_DIFFUSE_MAPS 5
+#endif
+#ifndef NR_SPECULAR_MAPS
 #define NR_SPECULAR_MAPS 5
+#endif
+
+// If every mesh has exactly NR_DIFFUSE_MAPS and NR_SPECULAR_MAPS maps the loops over the maps have a constant trip
+// count that the compiler can unroll, otherwise we loop over the number of maps that each mesh actually has
+#ifdef EXACT_MAP_COUNTS
+#define DIFFUSE_COUNT NR_DIFFUSE_MAPS
+#define SPECULAR_COUNT NR_SPECULAR_MAPS
+#else
+#define DIFFUSE_COUNT material.diffuse_count
+#define SPECULAR_COUNT material.specular_count
+#endif
+
+// With TEXTURE_ARRAYS the maps are layers of the model's texture arrays (see utility::model::Model), each map is
+// the index of its array and its layer in that array. Otherwise each map is its own texture
+// GLSL 3.30 only indexes sampler arrays with constant expressions, so sampleTextureArray picks the array with a
+// branch for each of the (at most 16) arrays
+#ifdef TEXTURE_ARRAYS
+#ifndef NR_TEXTURE_ARRAYS
+#define NR_TEXTURE_ARRAYS 1
+#endif
+#define DIFFUSE_MAP(i) sampleTextureArray(material.diffuse[i])
+#define SPECULAR_MAP(i) sampleTextureArray(material.specular[i])
+#define MAP_TYPE ivec2
+#else
+#define DIFFUSE_MAP(i) texture(material.diffuse[i], textureCoords)
+#define SPECULAR_MAP(i) texture(material.specular[i], textureCoords)
+#define MAP_TYPE sampler2D
+#endif
+
+// Whether the spotlight fades out at its edges. Without SPOT_FADE this is decided at runtime by the light
+#ifdef SPOT_FADE
+#define FADE_SPOTLIGHT(light) bool(SPOT_FADE)
+#else
+#define FADE_SPOTLIGHT(light) light.fade
+#endif
 
 // *****************
 // ***   TYPES   ***
 // *****************
 
 struct Material {
-    sampler2D diffuse[NR_DIFFUSE_MAPS];
-    sampler2D specular[NR_SPECULAR_MAPS];
+#if NR_DIFFUSE_MAPS > 0
+    MAP_TYPE diffuse[NR_DIFFUSE_MAPS];
+#endif
+#if NR_SPECULAR_MAPS > 0
+    MAP_TYPE specular[NR_SPECULAR_MAPS];
+#endif
     float shininess;
     int diffuse_count;
     int specular_count;
@@ -59,6 +104,9 @@ struct SpotLight {
     // Radius of the inner and outer light cones
     float phi;
     float gamma;
+
+    // Whether or not we should fade the spotlight out
+    bool fade;
 };
 
 // *****************
@@ -91,14 +139,23 @@ uniform vec3 viewPosition;
 // Material properties
 uniform Material material;
 
-// Directional light for the sun
-uniform DirectionalLight sun;
+#ifdef TEXTURE_ARRAYS
+// Every material map of the model, stacked by size and format
+uniform sampler2DArray textureArrays[NR_TEXTURE_ARRAYS];
+#endif
+
+// All of the lights in the scene
+// This block uses the std140 layout so that it can be shared between programs through a uniform buffer
+layout(std140) uniform Lights {
+    // Directional light for the sun
+    DirectionalLight sun;
 
-// Point light
-uniform PointLight lights[NR_POINT_LIGHTS];
+    // Point lights
+    PointLight lights[NR_POINT_LIGHTS];
 
-// Lamp light
-uniform SpotLight lamp;
+    // Lamp light
+    SpotLight lamp;
+};
 
 // *****************
 // *** FUNCTIONS ***
@@ -111,6 +168,9 @@ vec3 calculateSpecularLight(vec3 direction, vec3 specular, vec3 colour, vec3 nor
 vec3 calculateDirectionalLight(DirectionalLight light, vec3 normal, vec3 viewDirection);
 vec3 calculatePointLight(PointLight light, vec3 normal, vec3 viewDirection);
 vec3 calculateSpotLight(SpotLight light, vec3 normal, vec3 viewDirection);
+#ifdef TEXTURE_ARRAYS
+vec4 sampleTextureArray(ivec2 map);
+#endif
 
 
 void main() {
@@ -168,25 +228,29 @@ vec3 calculateDirectionalLight(DirectionalLight light, vec3 normal, vec3 viewDir
     vec3 diffuse        = vec3(0.0f);
     vec3 specular       = vec3(0.0f);
 
-    for (int i = 0; i < material.diffuse_count; ++i) {
+#if NR_DIFFUSE_MAPS > 0
+    for (int i = 0; i < DIFFUSE_COUNT; ++i) {
         // Ambient lighting
-        ambient += calculateAmbientLight(light.ambient, vec3(texture(material.diffuse[i], textureCoords)));
+        ambient += calculateAmbientLight(light.ambient, vec3(DIFFUSE_MAP(i)));
 
         // Diffuse lighting
         diffuse += calculateDiffuseLight(lightDirection,
                                          light.diffuse,
-                                         vec3(texture(material.diffuse[i], textureCoords)),
+                                         vec3(DIFFUSE_MAP(i)),
                                          normalize(fragmentNormal));
     }
+#endif
 
-    for (int i = 0; i < material.specular_count; ++i) {
+#if NR_SPECULAR_MAPS > 0
+    for (int i = 0; i < SPECULAR_COUNT; ++i) {
         // Specular lighting
         specular += calculateSpecularLight(viewDirection,
                                            light.specular,
-                                           vec3(texture(material.specular[i], textureCoords)),
+                                           vec3(SPECULAR_MAP(i)),
                                            normalize(fragmentNormal),
                                            material.shininess);
     }
+#endif
 
     return ambient + diffuse + specular;
 }
@@ -196,25 +260,29 @@ vec3 calculatePointLight(PointLight light, vec3 normal, vec3 viewDirection) {
     vec3 diffuse        = vec3(0.0f);
     vec3 specular       = vec3(0.0f);
 
-    for (int i = 0; i < material.diffuse_count; ++i) {
+#if NR_DIFFUSE_MAPS > 0
+    for (int i = 0; i < DIFFUSE_COUNT; ++i) {
         // Ambient lighting
-        ambient += calculateAmbientLight(light.ambient, vec3(texture(material.diffuse[i], textureCoords)));
+        ambient += calculateAmbientLight(light.ambient, vec3(DIFFUSE_MAP(i)));
 
         // Diffuse lighting
         diffuse += calculateDiffuseLight(lightDirection,
                                          light.diffuse,
-                                         vec3(texture(material.diffuse[i], textureCoords)),
+                                         vec3(DIFFUSE_MAP(i)),
                                          normalize(fragmentNormal));
     }
+#endif
 
-    for (int i = 0; i < material.specular_count; ++i) {
+#if NR_SPECULAR_MAPS > 0
+    for (int i = 0; i < SPECULAR_COUNT; ++i) {
         // Specular lighting
         specular += calculateSpecularLight(viewDirection,
                                            light.specular,
-                                           vec3(texture(material.specular[i], textureCoords)),
+                                           vec3(SPECULAR_MAP(i)),
                                            normalize(fragmentNormal),
                                            material.shininess);
     }
+#endif
 
     // Calculate attentuation
     float distance     = length(light.position - fragmentPosition);
@@ -231,29 +299,39 @@ vec3 calculateSpotLight(SpotLight light, vec3 normal, vec3 viewDirection) {
     vec3 diffuse        = vec3(0.0f);
     vec3 specular       = vec3(0.0f);
 
-    for (int i = 0; i < material.diffuse_count; ++i) {
+#if NR_DIFFUSE_MAPS > 0
+    for (int i = 0; i < DIFFUSE_COUNT; ++i) {
         // Ambient lighting
-        ambient += calculateAmbientLight(light.ambient, vec3(texture(material.diffuse[i], textureCoords)));
+        ambient += calculateAmbientLight(light.ambient, vec3(DIFFUSE_MAP(i)));
 
         // Diffuse lighting
         diffuse += calculateDiffuseLight(lightDirection,
                                          light.diffuse,
-                                         vec3(texture(material.diffuse[i], textureCoords)),
+                                         vec3(DIFFUSE_MAP(i)),
                                          normalize(fragmentNormal));
     }
+#endif
 
-    for (int i = 0; i < material.specular_count; ++i) {
+#if NR_SPECULAR_MAPS > 0
+    for (int i = 0; i < SPECULAR_COUNT; ++i) {
         // Specular lighting
         specular += calculateSpecularLight(viewDirection,
                                            light.specular,
-                                           vec3(texture(material.specular[i], textureCoords)),
+                                           vec3(SPECULAR_MAP(i)),
                                            normalize(fragmentNormal),
                                            material.shininess);
     }
+#endif
 
     // Calculate and apply intensity drop-off
     float theta     = dot(normalize(light.position - fragmentPosition), normalize(-light.direction));
-    float intensity = clamp((theta - light.gamma) / (light.phi - light.gamma), 0.0f, 1.0f);
+    float intensity = 0.0f;
+    if (FADE_SPOTLIGHT(light)) {
+        intensity = clamp((theta - light.gamma) / (light.phi - light.gamma), 0.0f, 1.0f);
+    }
+    else {
+        intensity = theta > light.phi ? 1.0f : 0.0f;
+    }
     diffuse *= intensity;
     specular *= intensity;
 
@@ -266,3 +344,56 @@ vec3 calculateSpotLight(SpotLight light, vec3 normal, vec3 viewDirection) {
 
     return ambient + diffuse + specular;
 }
+#ifdef TEXTURE_ARRAYS
+vec4 sampleTextureArray(ivec2 map) {
+    vec3 coords = vec3(textureCoords, map.y);
+    // Every fragment of a draw reads the same map uniform, so the branches don't break the texture derivatives
+#define SAMPLE_ARRAY(n) if (map.x == n) return texture(textureArrays[n], coords);
+#if NR_TEXTURE_ARRAYS > 1
+    SAMPLE_ARRAY(1)
+#endif
+#if NR_TEXTURE_ARRAYS > 2
+    SAMPLE_ARRAY(2)
+#endif
+#if NR_TEXTURE_ARRAYS > 3
+    SAMPLE_ARRAY(3)
+#endif
+#if NR_TEXTURE_ARRAYS > 4
+    SAMPLE_ARRAY(4)
+#endif
+#if NR_TEXTURE_ARRAYS > 5
+    SAMPLE_ARRAY(5)
+#endif
+#if NR_TEXTURE_ARRAYS > 6
+    SAMPLE_ARRAY(6)
+#endif
+#if NR_TEXTURE_ARRAYS > 7
+    SAMPLE_ARRAY(7)
+#endif
+#if NR_TEXTURE_ARRAYS > 8
+    SAMPLE_ARRAY(8)
+#endif
+#if NR_TEXTURE_ARRAYS > 9
+    SAMPLE_ARRAY(9)
+#endif
+#if NR_TEXTURE_ARRAYS > 10
+    SAMPLE_ARRAY(10)
+#endif
+#if NR_TEXTURE_ARRAYS > 11
+    SAMPLE_ARRAY(11)
+#endif
+#if NR_TEXTURE_ARRAYS > 12
+    SAMPLE_ARRAY(12)
+#endif
+#if NR_TEXTURE_ARRAYS > 13
+    SAMPLE_ARRAY(13)
+#endif
+#if NR_TEXTURE_ARRAYS > 14
+    SAMPLE_ARRAY(14)
+#endif
+#if NR_TEXTURE_ARRAYS > 15
+    SAMPLE_ARRAY(15)
+#endif
+    return texture(textureArrays[0], coords);
+}
+#endif
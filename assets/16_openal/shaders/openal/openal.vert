@@ -1,10 +1,42 @@
 #version 330 core
 
 // Input vertex attributes
+#ifdef COMPRESSED_VERTICES
+// Position as a fraction of the mesh bounding box, normal in octahedral encoding (see utility::mesh::CompressedVertex)
+layout(location = 0) in vec3 aPosition;
+layout(location = 1) in vec2 aNormal;
+layout(location = 2) in vec2 aTexCoords;
+
+// Transform from the bounding box back to model space
+uniform vec3 positionScale;
+uniform vec3 positionOffset;
+
+vec3 decodePosition() {
+    return positionOffset + positionScale * aPosition;
+}
+
+vec3 decodeNormal() {
+    // Unfold the lower half of the octahedron
+    vec3 normal = vec3(aNormal, 1.0f - abs(aNormal.x) - abs(aNormal.y));
+    float fold  = max(-normal.z, 0.0f);
+    normal.x += normal.x >= 0.0f ? -fold : fold;
+    normal.y += normal.y >= 0.0f ? -fold : fold;
+    return normalize(normal);
+}
+#else
 layout(location = 0) in vec3 aPosition;
 layout(location = 1) in vec3 aNormal;
 layout(location = 2) in vec2 aTexCoords;
 
+vec3 decodePosition() {
+    return aPosition;
+}
+
+vec3 decodeNormal() {
+    return aNormal;
+}
+#endif
+
 // Output fragment normal to the fragment shader
 out vec3 fragmentNormal;
 
@@ -25,11 +57,12 @@ void main() {
 
     // Set fragment normal
     // Inverse transpose to ensure that non-uniform scaling does not affect normal direction
-    fragmentNormal = transpose(inverse(mat3(Hwm))) * aNormal;
+    fragmentNormal = transpose(inverse(mat3(Hwm))) * decodeNormal();
 
     // Set world space fragment position
-    fragmentPosition = (Hwm * vec4(aPosition, 1.0f)).xyz;
+    vec4 position    = vec4(decodePosition(), 1.0f);
+    fragmentPosition = (Hwm * position).xyz;
 
     // Set vertex position
-    gl_Position = Hcv * Hvw * Hwm * vec4(aPosition, 1.0f);
+    gl_Position = Hcv * Hvw * Hwm * position;
 }
@@ -28,6 +28,7 @@ int main() {
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, utility::debug_context);
 
     // glfw window creation
     // --------------------
@@ -49,8 +50,16 @@ int main() {
         return -1;
     }
 
+    // load any OpenGL functionality newer than the version glad was generated for
+    // ---------------------------------------------------------------------------
+    utility::gl::load_extensions((GLADloadproc) glfwGetProcAddress);
+
     render(window);
 
+    // the objects that render created have been released, delete them while the context still exists
+    // ------------------------------------------------------------------------------------------------
+    utility::gl::get_deletion_queue().flush();
+
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
     glfwTerminate();
@@ -127,7 +136,8 @@ void render(GLFWwindow* window) {
 
     // define vertex attributes
     // ------------------------
-    VAO.add_vertex_attrib<float>(0, 3, 3, GL_FLOAT, false, 0);
+    // each vertex is just aPos
+    VAO.add_layout<utility::gl::vertex_format::packed_layout<glm::vec3>>();
 
     // note that this is allowed, the call to glVertexAttribPointer registered VBO as the vertex attribute's bound
     // vertex buffer object so afterwards we can safely unbind
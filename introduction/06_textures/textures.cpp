@@ -28,6 +28,7 @@ int main() {
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, utility::debug_context);
 
     // glfw window creation
     // --------------------
@@ -49,8 +50,16 @@ int main() {
         return -1;
     }
 
+    // load any OpenGL functionality newer than the version glad was generated for
+    // ---------------------------------------------------------------------------
+    utility::gl::load_extensions((GLADloadproc) glfwGetProcAddress);
+
     render(window);
 
+    // the objects that render created have been released, delete them while the context still exists
+    // ------------------------------------------------------------------------------------------------
+    utility::gl::get_deletion_queue().flush();
+
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
     glfwTerminate();
@@ -147,9 +156,8 @@ void render(GLFWwindow* window) {
 
     // define vertex attributes
     // ------------------------
-    VAO.add_vertex_attrib<float>(0, 3, 8, GL_FLOAT, false, 0);
-    VAO.add_vertex_attrib<float>(1, 3, 8, GL_FLOAT, false, 3);
-    VAO.add_vertex_attrib<float>(2, 2, 8, GL_FLOAT, false, 6);
+    // each vertex is aPosition, aColour and aTexCoord, packed one after the other
+    VAO.add_layout<utility::gl::vertex_format::packed_layout<glm::vec3, glm::vec3, glm::vec2>>();
 
     // note that this is allowed, the call to glVertexAttribPointer registered VBO as the vertex attribute's bound
     // vertex buffer object so afterwards we can safely unbind
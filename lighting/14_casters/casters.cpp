@@ -18,18 +18,9 @@
 // clang-format on
 
 #include "utility/camera.hpp"
+#include "utility/lights.hpp"
 #include "utility/opengl_utils.hpp"
 
-struct PointLight {
-    glm::vec3 position;
-    glm::vec3 ambient;
-    glm::vec3 diffuse;
-    glm::vec3 specular;
-    float Kc;
-    float Kl;
-    float Kq;
-};
-
 void process_input(GLFWwindow* window, const float& delta_time, utility::camera::Camera& camera);
 void render(GLFWwindow* window, utility::camera::Camera& camera);
 
@@ -41,6 +32,9 @@ static constexpr int SCREEN_HEIGHT = 600;
 static constexpr float NEAR_PLANE = 0.1f;
 static constexpr float FAR_PLANE  = 1000.0f;
 
+// Uniform buffer binding point for the lights in the scene
+static constexpr unsigned int LIGHTS_BINDING = 0;
+
 int main() {
     // create our camera objects
     // -------------------------
@@ -52,6 +46,7 @@ int main() {
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, utility::debug_context);
 
     // glfw window creation
     // --------------------
@@ -100,8 +95,16 @@ int main() {
         return -1;
     }
 
+    // load any OpenGL functionality newer than the version glad was generated for
+    // ---------------------------------------------------------------------------
+    utility::gl::load_extensions((GLADloadproc) glfwGetProcAddress);
+
     render(window, camera);
 
+    // the objects that render created have been released, delete them while the context still exists
+    // ------------------------------------------------------------------------------------------------
+    utility::gl::get_deletion_queue().flush();
+
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
     glfwTerminate();
@@ -236,24 +239,55 @@ void render(GLFWwindow* window, utility::camera::Camera& camera) {
     };
     // clang-format on
 
-    // positions of the point lights
-    std::array<PointLight, 4> point_lights = {
-        PointLight{
+    // all of the lights in the scene
+    // ------------------------------
+    utility::lights::LightBlock<4> scene_lights;
+    scene_lights.sun = utility::lights::DirectionalLight{
+        glm::vec3(-0.2f, -1.0f, -0.3f), glm::vec3(0.2f), glm::vec3(0.5f), glm::vec3(1.0f)};
+    scene_lights.lights = {
+        utility::lights::PointLight{
             glm::vec3(0.7f, 0.2f, 2.0f), glm::vec3(0.05f), glm::vec3(0.8f), glm::vec3(1.0f), 1.0f, 0.09f, 0.032f},
-        PointLight{
+        utility::lights::PointLight{
             glm::vec3(2.3f, -3.3f, -4.0f), glm::vec3(0.05f), glm::vec3(0.8f), glm::vec3(1.0f), 1.0f, 0.09f, 0.032f},
-        PointLight{
+        utility::lights::PointLight{
             glm::vec3(-4.0f, 2.0f, -12.0f), glm::vec3(0.05f), glm::vec3(0.8f), glm::vec3(1.0f), 1.0f, 0.09f, 0.032f},
-        PointLight{
+        utility::lights::PointLight{
             glm::vec3(0.0f, 0.0f, -3.0f), glm::vec3(0.05f), glm::vec3(0.8f), glm::vec3(1.0f), 1.0f, 0.09f, 0.032f}};
+    scene_lights.lamp = utility::lights::SpotLight{camera.get_position(),
+                                                   camera.get_view_direction(),
+                                                   glm::vec3(0.0f),
+                                                   glm::vec3(1.0f),
+                                                   glm::vec3(1.0f),
+                                                   1.000f,
+                                                   0.090f,
+                                                   0.032f,
+                                                   std::cos(glm::radians(12.5f)),
+                                                   std::cos(glm::radians(15.0f)),
+                                                   false};
 
     // load, compile, and link the vertex and fragment shaders
     // -------------------------------------------------------
     utility::gl::shader_program program;
+    program.use_binary_cache("shaders/casters");
     program.add_shader("shaders/casters/casters.vert", GL_VERTEX_SHADER);
     program.add_shader("shaders/casters/casters.frag", GL_FRAGMENT_SHADER);
     program.link();
 
+    // resolve uniform handles once so the render loop doesn't need to look them up by name
+    // -------------------------------------------------------------------------------------
+    auto Hvw_uniform                = program.get_uniform<glm::mat4>("Hvw");
+    auto Hcv_uniform                = program.get_uniform<glm::mat4>("Hcv");
+    auto Hwm_uniform                = program.get_uniform<glm::mat4>("Hwm");
+    auto material_shininess_uniform = program.get_uniform<float>("material.shininess");
+    auto view_position_uniform      = program.get_uniform<glm::vec3>("viewPosition");
+
+    // upload all of the lights to a uniform buffer that any program can bind to
+    // --------------------------------------------------------------------------
+    utility::gl::uniform_buffer lights_buffer;
+    lights_buffer.copy_data(scene_lights, GL_DYNAMIC_DRAW);
+    lights_buffer.bind_base(LIGHTS_BINDING);
+    program.bind_uniform_block<utility::lights::LightBlock<4>>("Lights", LIGHTS_BINDING);
+
     // create a vertex buffer object
     // -----------------------------
     utility::gl::vertex_buffer VBO;
@@ -266,16 +300,22 @@ void render(GLFWwindow* window, utility::camera::Camera& camera) {
     // -------------------------------
     utility::gl::element_buffer EBO;
 
-    // load textures
-    // -------------
-    utility::gl::texture diffuse_texture("textures/casters/container_diffuse.png", GL_TEXTURE_2D);
+    // load textures, with mip chains that are filtered on the CPU and cached next to the images
+    // -----------------------------------------------------------------------------------------
+    int max_texture_size = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+    utility::gl::texture diffuse_texture(GL_TEXTURE_2D, utility::gl::TextureStyle::TEXTURE_DIFFUSE);
+    diffuse_texture.load_data(utility::gl::decode_with_mipmaps(
+        "textures/casters/container_diffuse.png", true, "textures/casters", max_texture_size));
     diffuse_texture.bind(GL_TEXTURE0);
     diffuse_texture.generate(0);
     diffuse_texture.generate_mipmap();
     diffuse_texture.texture_wrap(GL_REPEAT, GL_REPEAT);
     diffuse_texture.texture_filter(GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR);
 
-    utility::gl::texture specular_texture("textures/casters/container_specular.png", GL_TEXTURE_2D);
+    utility::gl::texture specular_texture(GL_TEXTURE_2D, utility::gl::TextureStyle::TEXTURE_SPECULAR);
+    specular_texture.load_data(utility::gl::decode_with_mipmaps(
+        "textures/casters/container_specular.png", false, "textures/casters", max_texture_size));
     specular_texture.bind(GL_TEXTURE1);
     specular_texture.generate(0);
     specular_texture.generate_mipmap();
@@ -296,10 +336,8 @@ void render(GLFWwindow* window, utility::camera::Camera& camera) {
 
     // define vertex attributes
     // ------------------------
-    VAO.add_vertex_attrib<float>(0, 3, 11, GL_FLOAT, false, 0);
-    VAO.add_vertex_attrib<float>(1, 3, 11, GL_FLOAT, false, 3);
-    VAO.add_vertex_attrib<float>(2, 3, 11, GL_FLOAT, false, 6);
-    VAO.add_vertex_attrib<float>(3, 2, 11, GL_FLOAT, false, 9);
+    // each vertex is aPosition, aColour, aNormal and aTextureCoords, packed one after the other
+    VAO.add_layout<utility::gl::vertex_format::packed_layout<glm::vec3, glm::vec3, glm::vec3, glm::vec2>>();
 
     // note that this is allowed, the call to glVertexAttribPointer registered VBO as the vertex attribute's bound
     // vertex buffer object so afterwards we can safely unbind
@@ -355,38 +393,17 @@ void render(GLFWwindow* window, utility::camera::Camera& camera) {
 
         // update the uniforms
         // -------------------
-        program.set_uniform("Hvw", camera.get_view_transform());
-        program.set_uniform("Hcv", camera.get_clip_transform());
-
-        program.set_uniform("material.shininess", 32.0f);
-        program.set_uniform("viewPosition", camera.get_position());
-
-        program.set_uniform("sun.direction", glm::vec3(-0.2f, -1.0f, -0.3f));
-        program.set_uniform("sun.ambient", glm::vec3(0.2f, 0.2f, 0.2f));
-        program.set_uniform("sun.diffuse", glm::vec3(0.5f, 0.5f, 0.5f));
-        program.set_uniform("sun.specular", glm::vec3(1.0f, 1.0f, 1.0f));
-
-        for (size_t i = 0; i < 4; ++i) {
-            program.set_uniform(fmt::format("lights[{}].position", i), point_lights[i].position);
-            program.set_uniform(fmt::format("lights[{}].ambient", i), point_lights[i].ambient);
-            program.set_uniform(fmt::format("lights[{}].diffuse", i), point_lights[i].diffuse);
-            program.set_uniform(fmt::format("lights[{}].specular", i), point_lights[i].specular);
-            program.set_uniform(fmt::format("lights[{}].Kc", i), point_lights[i].Kc);
-            program.set_uniform(fmt::format("lights[{}].Kl", i), point_lights[i].Kl);
-            program.set_uniform(fmt::format("lights[{}].Kq", i), point_lights[i].Kq);
-        }
+        program.set_uniform(Hvw_uniform, camera.get_view_transform());
+        program.set_uniform(Hcv_uniform, camera.get_clip_transform());
+
+        program.set_uniform(material_shininess_uniform, 32.0f);
+        program.set_uniform(view_position_uniform, camera.get_position());
 
-        program.set_uniform("lamp.position", camera.get_position());
-        program.set_uniform("lamp.direction", camera.get_view_direction());
-        program.set_uniform("lamp.ambient", glm::vec3(0.0f));
-        program.set_uniform("lamp.diffuse", glm::vec3(1.0f));
-        program.set_uniform("lamp.specular", glm::vec3(1.0f));
-        program.set_uniform("lamp.phi", std::cos(glm::radians(12.5f)));
-        program.set_uniform("lamp.gamma", std::cos(glm::radians(15.0f)));
-        program.set_uniform("lamp.fade", spotlight_fade);
-        program.set_uniform("lamp.Kc", 1.000f);
-        program.set_uniform("lamp.Kl", 0.090f);
-        program.set_uniform("lamp.Kq", 0.032f);
+        // the lamp follows the camera, so it is the only light that changes each frame
+        scene_lights.lamp.position  = camera.get_position();
+        scene_lights.lamp.direction = camera.get_view_direction();
+        scene_lights.lamp.fade      = spotlight_fade;
+        lights_buffer.update(scene_lights.lamp, scene_lights.lamp_offset());
 
         VAO.bind();
 
@@ -395,7 +412,7 @@ void render(GLFWwindow* window, utility::camera::Camera& camera) {
             // create the model to world transform
             glm::mat4 Hwm = glm::translate(glm::mat4(1.0f), cube_positions[i]);
             Hwm = glm::rotate(Hwm, glm::radians(current_frame * 50.0f + i * 20.0f), glm::vec3(1.0f, 0.3f, 0.5f));
-            program.set_uniform("Hwm", Hwm);
+            program.set_uniform(Hwm_uniform, Hwm);
 
             glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
         }
@@ -58,7 +58,17 @@ struct SpotLight {
 // *****************
 // *** CONSTANTS ***
 // *****************
+// Any of these can be overridden by the program (see shader_program::set_defines) to make a specialised variant
+#ifndef NR_POINT_LIGHTS
 #define NR_POINT_LIGHTS 4
+#endif
+
+// Whether the spotlight fades out at its edges. Without SPOT_FADE this is decided at runtime by the light
+#ifdef SPOT_FADE
+#define FADE_SPOTLIGHT(light) bool(SPOT_FADE)
+#else
+#define FADE_SPOTLIGHT(light) light.fade
+#endif
 
 // *****************
 // ***  OUTPUTS  ***
@@ -93,14 +103,18 @@ uniform vec3 viewPosition;
 // Material properties
 uniform Material material;
 
-// Directional light for the sun
-uniform DirectionalLight sun;
+// All of the lights in the scene
+// This block uses the std140 layout so that it can be shared between programs through a uniform buffer
+layout(std140) uniform Lights {
+    // Directional light for the sun
+    DirectionalLight sun;
 
-// Point light
-uniform PointLight lights[NR_POINT_LIGHTS];
+    // Point lights
+    PointLight lights[NR_POINT_LIGHTS];
 
-// Lamp light
-uniform SpotLight lamp;
+    // Lamp light
+    SpotLight lamp;
+};
 
 // *****************
 // *** FUNCTIONS ***
@@ -226,7 +240,7 @@ vec3 calculateSpotLight(SpotLight light, vec3 normal, vec3 viewDirection) {
     // Calculate and apply intensity drop-off
     float theta     = dot(normalize(light.position - fragmentPosition), normalize(-light.direction));
     float intensity = 0.0f;
-    if (light.fade) {
+    if (FADE_SPOTLIGHT(light)) {
         intensity = clamp((theta - light.gamma) / (light.phi - light.gamma), 0.0f, 1.0f);
     }
     else {
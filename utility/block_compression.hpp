@@ -0,0 +1,312 @@
+#ifndef UTILITY_BLOCK_COMPRESSION_HPP
+#define UTILITY_BLOCK_COMPRESSION_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// The encoder uses SSE2 when the compiler targets it (always the case for x86-64), and plain C++ otherwise
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define UTILITY_BLOCK_COMPRESSION_SSE2 1
+#include <emmintrin.h>
+#else
+#define UTILITY_BLOCK_COMPRESSION_SSE2 0
+#endif
+
+// clang-format off
+#include "glad/glad.h"
+// clang-format on
+
+#include "utility/compressed_image.hpp"
+
+namespace utility {
+namespace gl {
+    // Fast BC1 and BC3 encoders for images that are decoded at load time
+    // The endpoints are the corners of the block's colour bounding box, inset slightly to reduce the error of the
+    // extreme colours, and each pixel picks the closest colour on the line between them (see "Real-Time DXT
+    // Compression", J.M.P. van Waveren). This is nowhere near as good as an offline encoder, but it is fast enough
+    // to run on every load and it gives the same memory savings
+    namespace detail {
+        // Pack an 8 bit colour into 5:6:5, and expand it back out the way that the GPU does
+        inline uint16_t pack_565(const unsigned char* rgb) {
+            return static_cast<uint16_t>(((rgb[0] >> 3) << 11) | ((rgb[1] >> 2) << 5) | (rgb[2] >> 3));
+        }
+        inline void unpack_565(const uint16_t& colour, int* rgb) {
+            const int r = (colour >> 11) & 0x1F;
+            const int g = (colour >> 5) & 0x3F;
+            const int b = colour & 0x1F;
+            rgb[0]      = (r << 3) | (r >> 2);
+            rgb[1]      = (g << 2) | (g >> 4);
+            rgb[2]      = (b << 3) | (b >> 2);
+        }
+
+        // Per channel minimum and maximum of the 16 RGBA pixels in a block
+        inline void block_bounds(const unsigned char* block, unsigned char* min, unsigned char* max) {
+#if UTILITY_BLOCK_COMPRESSION_SSE2
+            const __m128i* rows = reinterpret_cast<const __m128i*>(block);
+            const __m128i row0  = _mm_loadu_si128(rows + 0);
+            const __m128i row1  = _mm_loadu_si128(rows + 1);
+            const __m128i row2  = _mm_loadu_si128(rows + 2);
+            const __m128i row3  = _mm_loadu_si128(rows + 3);
+            __m128i low         = _mm_min_epu8(_mm_min_epu8(row0, row1), _mm_min_epu8(row2, row3));
+            __m128i high        = _mm_max_epu8(_mm_max_epu8(row0, row1), _mm_max_epu8(row2, row3));
+            // Fold the four pixels in each register down to one
+            low  = _mm_min_epu8(low, _mm_shuffle_epi32(low, _MM_SHUFFLE(1, 0, 3, 2)));
+            low  = _mm_min_epu8(low, _mm_shuffle_epi32(low, _MM_SHUFFLE(2, 3, 0, 1)));
+            high = _mm_max_epu8(high, _mm_shuffle_epi32(high, _MM_SHUFFLE(1, 0, 3, 2)));
+            high = _mm_max_epu8(high, _mm_shuffle_epi32(high, _MM_SHUFFLE(2, 3, 0, 1)));
+            const int packed_low  = _mm_cvtsi128_si32(low);
+            const int packed_high = _mm_cvtsi128_si32(high);
+            std::memcpy(min, &packed_low, 4);
+            std::memcpy(max, &packed_high, 4);
+#else
+            std::memcpy(min, block, 4);
+            std::memcpy(max, block, 4);
+            for (int pixel = 1; pixel < 16; ++pixel) {
+                for (int channel = 0; channel < 4; ++channel) {
+                    min[channel] = std::min(min[channel], block[pixel * 4 + channel]);
+                    max[channel] = std::max(max[channel], block[pixel * 4 + channel]);
+                }
+            }
+#endif
+        }
+
+        // Index of the closest palette colour for each of the 16 pixels, packed 2 bits per pixel
+        inline uint32_t closest_colours(const unsigned char* block, const int palette[4][3]) {
+            uint32_t indices = 0;
+#if UTILITY_BLOCK_COMPRESSION_SSE2
+            const __m128i zero        = _mm_setzero_si128();
+            const __m128i colour_bits = _mm_set1_epi32(0x00FFFFFF);
+            __m128i colours[4];
+            for (int i = 0; i < 4; ++i) {
+                colours[i] = _mm_setr_epi16(static_cast<short>(palette[i][0]),
+                                            static_cast<short>(palette[i][1]),
+                                            static_cast<short>(palette[i][2]),
+                                            0,
+                                            static_cast<short>(palette[i][0]),
+                                            static_cast<short>(palette[i][1]),
+                                            static_cast<short>(palette[i][2]),
+                                            0);
+            }
+            for (int row = 0; row < 4; ++row) {
+                // Widen four pixels to 16 bits, dropping their alpha
+                const __m128i pixels =
+                    _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block) + row), colour_bits);
+                const __m128i low  = _mm_unpacklo_epi8(pixels, zero);
+                const __m128i high = _mm_unpackhi_epi8(pixels, zero);
+
+                __m128i best       = _mm_set1_epi32(0x7FFFFFFF);
+                __m128i best_index = zero;
+                for (int i = 0; i < 4; ++i) {
+                    // madd gives r^2 + g^2 and b^2 for each pixel, the shuffles add the two halves together
+                    const __m128i low_diff  = _mm_sub_epi16(low, colours[i]);
+                    const __m128i high_diff = _mm_sub_epi16(high, colours[i]);
+                    const __m128 low_sums   = _mm_castsi128_ps(_mm_madd_epi16(low_diff, low_diff));
+                    const __m128 high_sums  = _mm_castsi128_ps(_mm_madd_epi16(high_diff, high_diff));
+                    const __m128i distance  = _mm_add_epi32(
+                        _mm_castps_si128(_mm_shuffle_ps(low_sums, high_sums, _MM_SHUFFLE(2, 0, 2, 0))),
+                        _mm_castps_si128(_mm_shuffle_ps(low_sums, high_sums, _MM_SHUFFLE(3, 1, 3, 1))));
+                    const __m128i closer = _mm_cmplt_epi32(distance, best);
+                    // Keep the distance and index of the pixels that are closer to this colour than the best so far
+                    best       = _mm_or_si128(_mm_and_si128(closer, distance), _mm_andnot_si128(closer, best));
+                    best_index = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(i)),
+                                              _mm_andnot_si128(closer, best_index));
+                }
+
+                alignas(16) int32_t row_indices[4];
+                _mm_store_si128(reinterpret_cast<__m128i*>(row_indices), best_index);
+                for (int column = 0; column < 4; ++column) {
+                    indices |= static_cast<uint32_t>(row_indices[column]) << (2 * (row * 4 + column));
+                }
+            }
+#else
+            for (int pixel = 0; pixel < 16; ++pixel) {
+                const unsigned char* colour = block + pixel * 4;
+                int best                    = 0x7FFFFFFF;
+                uint32_t best_index         = 0;
+                for (int i = 0; i < 4; ++i) {
+                    const int r        = colour[0] - palette[i][0];
+                    const int g        = colour[1] - palette[i][1];
+                    const int b        = colour[2] - palette[i][2];
+                    const int distance = r * r + g * g + b * b;
+                    if (distance < best) {
+                        best       = distance;
+                        best_index = i;
+                    }
+                }
+                indices |= best_index << (2 * pixel);
+            }
+#endif
+            return indices;
+        }
+
+        // Copy a 4x4 block out of an RGBA image, repeating the last row and column for blocks that hang off the edge
+        inline void fetch_block(const unsigned char* rgba,
+                                const int& width,
+                                const int& height,
+                                const int& x,
+                                const int& y,
+                                unsigned char* block) {
+            for (int row = 0; row < 4; ++row) {
+                const int source_y = std::min(y + row, height - 1);
+                for (int column = 0; column < 4; ++column) {
+                    const int source_x = std::min(x + column, width - 1);
+                    std::memcpy(block + (row * 4 + column) * 4, rgba + (source_y * width + source_x) * 4, 4);
+                }
+            }
+        }
+
+        // Halve an RGBA image with a box filter, odd rows and columns are folded into the last output pixel
+        inline std::vector<unsigned char> downsample(const std::vector<unsigned char>& rgba,
+                                                     const int& width,
+                                                     const int& height) {
+            const int half_width  = std::max(1, width / 2);
+            const int half_height = std::max(1, height / 2);
+            std::vector<unsigned char> half(static_cast<size_t>(half_width) * half_height * 4);
+            for (int y = 0; y < half_height; ++y) {
+                const int y0 = std::min(2 * y, height - 1);
+                const int y1 = std::min(2 * y + 1, height - 1);
+                for (int x = 0; x < half_width; ++x) {
+                    const int x0 = std::min(2 * x, width - 1);
+                    const int x1 = std::min(2 * x + 1, width - 1);
+                    for (int channel = 0; channel < 4; ++channel) {
+                        const int sum = rgba[(y0 * width + x0) * 4 + channel] + rgba[(y0 * width + x1) * 4 + channel]
+                                        + rgba[(y1 * width + x0) * 4 + channel]
+                                        + rgba[(y1 * width + x1) * 4 + channel];
+                        half[(y * half_width + x) * 4 + channel] = static_cast<unsigned char>((sum + 2) / 4);
+                    }
+                }
+            }
+            return half;
+        }
+    }  // namespace detail
+
+    // Encode one block of 16 RGBA pixels (row major) to BC1, alpha is ignored
+    // -----------------------------------------------------------------------
+    inline void encode_bc1_block(const unsigned char* block, unsigned char* output) {
+        unsigned char min[4], max[4];
+        detail::block_bounds(block, min, max);
+        // Move the endpoints in by 1/16th of the range, the extremes are usually outliers
+        for (int channel = 0; channel < 3; ++channel) {
+            const int inset = (max[channel] - min[channel]) >> 4;
+            min[channel]    = static_cast<unsigned char>(min[channel] + inset);
+            max[channel]    = static_cast<unsigned char>(max[channel] - inset);
+        }
+
+        // Every channel of max is at least min, so colour0 >= colour1 and the block is in 4 colour mode
+        const uint16_t colour0 = detail::pack_565(max);
+        const uint16_t colour1 = detail::pack_565(min);
+        uint32_t indices       = 0;
+        if (colour0 != colour1) {
+            int palette[4][3];
+            detail::unpack_565(colour0, palette[0]);
+            detail::unpack_565(colour1, palette[1]);
+            for (int channel = 0; channel < 3; ++channel) {
+                palette[2][channel] = (2 * palette[0][channel] + palette[1][channel]) / 3;
+                palette[3][channel] = (palette[0][channel] + 2 * palette[1][channel]) / 3;
+            }
+            indices = detail::closest_colours(block, palette);
+        }
+
+        output[0] = static_cast<unsigned char>(colour0 & 0xFF);
+        output[1] = static_cast<unsigned char>(colour0 >> 8);
+        output[2] = static_cast<unsigned char>(colour1 & 0xFF);
+        output[3] = static_cast<unsigned char>(colour1 >> 8);
+        for (int i = 0; i < 4; ++i) {
+            output[4 + i] = static_cast<unsigned char>(indices >> (8 * i));
+        }
+    }
+
+    // Encode one block of 16 RGBA pixels (row major) to BC3
+    // -----------------------------------------------------
+    inline void encode_bc3_block(const unsigned char* block, unsigned char* output) {
+        unsigned char min = block[3], max = block[3];
+        for (int pixel = 1; pixel < 16; ++pixel) {
+            min = std::min(min, block[pixel * 4 + 3]);
+            max = std::max(max, block[pixel * 4 + 3]);
+        }
+
+        // With alpha0 > alpha1 the palette is alpha0, alpha1, and 6 steps in between, from alpha0 to alpha1
+        uint64_t indices = 0;
+        if (max != min) {
+            const int range = max - min;
+            for (int pixel = 0; pixel < 16; ++pixel) {
+                const int step       = ((block[pixel * 4 + 3] - min) * 7 + range / 2) / range;
+                const uint64_t index = (step == 7) ? 0 : (step == 0) ? 1 : static_cast<uint64_t>(8 - step);
+                indices |= index << (3 * pixel);
+            }
+        }
+        output[0] = max;
+        output[1] = min;
+        for (int i = 0; i < 6; ++i) {
+            output[2 + i] = static_cast<unsigned char>(indices >> (8 * i));
+        }
+        encode_bc1_block(block, output + 8);
+    }
+
+    // Compress a decoded image and its full mip chain to BC1 (images without alpha, or where it is always opaque)
+    // or BC3. Only 3 and 4 channel images can be compressed, the format is GL_NONE for anything else
+    // -----------------------------------------------------------------------------------------------------------
+    // pixels: The image, tightly packed rows of channels bytes per pixel
+    // width: Width of the image
+    // height: Height of the image
+    // channels: Number of channels in the image
+    // -----------------------------------------------------------------------------------------------------------
+    inline compressed_image compress_image(const unsigned char* pixels,
+                                           const int& width,
+                                           const int& height,
+                                           const int& channels) {
+        compressed_image image;
+        if ((channels != 3 && channels != 4) || width <= 0 || height <= 0) {
+            return image;
+        }
+
+        // Expand to RGBA so that every block is four 16 byte rows
+        const size_t count = static_cast<size_t>(width) * height;
+        std::vector<unsigned char> rgba(count * 4, 255);
+        bool opaque = true;
+        for (size_t pixel = 0; pixel < count; ++pixel) {
+            std::memcpy(&rgba[pixel * 4], pixels + pixel * channels, channels);
+            opaque = opaque && rgba[pixel * 4 + 3] == 255;
+        }
+
+        image.format = opaque ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        image.width  = width;
+        image.height = height;
+        const size_t block_size = compressed_block_size(image.format);
+
+        int level_width  = width;
+        int level_height = height;
+        while (true) {
+            std::vector<unsigned char> blocks(compressed_level_size(image.format, level_width, level_height));
+            unsigned char block[64];
+            unsigned char* output = blocks.data();
+            for (int y = 0; y < level_height; y += 4) {
+                for (int x = 0; x < level_width; x += 4) {
+                    detail::fetch_block(rgba.data(), level_width, level_height, x, y, block);
+                    if (opaque) {
+                        encode_bc1_block(block, output);
+                    }
+                    else {
+                        encode_bc3_block(block, output);
+                    }
+                    output += block_size;
+                }
+            }
+            image.levels.push_back(std::move(blocks));
+
+            if (level_width == 1 && level_height == 1) {
+                break;
+            }
+            rgba         = detail::downsample(rgba, level_width, level_height);
+            level_width  = std::max(1, level_width / 2);
+            level_height = std::max(1, level_height / 2);
+        }
+        return image;
+    }
+}  // namespace gl
+}  // namespace utility
+
+
+#endif  // UTILITY_BLOCK_COMPRESSION_HPP
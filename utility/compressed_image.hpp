@@ -0,0 +1,312 @@
+#ifndef UTILITY_COMPRESSED_IMAGE_HPP
+#define UTILITY_COMPRESSED_IMAGE_HPP
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <system_error>
+#include <vector>
+
+// For python style string formatting
+#include "fmt/format.h"
+
+// clang-format off
+#include "glad/glad.h"
+// clang-format on
+
+#include "utility/opengl_extensions.hpp"
+
+namespace utility {
+namespace gl {
+    // A block compressed image with all of the mip levels that were stored in its file
+    // Level i is (width >> i) x (height >> i) pixels (at least 1x1), and is uploaded as is with glCompressedTexImage2D
+    // ---------------------------------------------------------------------------------------------------------------
+    struct compressed_image {
+        unsigned int format = GL_NONE;
+        int width           = 0;
+        int height          = 0;
+        std::vector<std::vector<unsigned char>> levels;
+    };
+
+    // Bytes in one 4x4 block of a compressed format, 0 if the format isn't one that we can load
+    // -----------------------------------------------------------------------------------------
+    inline size_t compressed_block_size(const unsigned int& format) {
+        switch (format) {
+            case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+            case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+            case GL_COMPRESSED_RED_RGTC1: return 8;
+            case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+            case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+            case GL_COMPRESSED_RG_RGTC2: return 16;
+            default: return 0;
+        }
+    }
+
+    // Bytes in one mip level of a compressed image
+    // --------------------------------------------
+    inline size_t compressed_level_size(const unsigned int& format, const int& width, const int& height) {
+        const size_t blocks_x = std::max(1, (width + 3) / 4);
+        const size_t blocks_y = std::max(1, (height + 3) / 4);
+        return blocks_x * blocks_y * compressed_block_size(format);
+    }
+
+    // The usual name of a compressed format, for reporting which format a texture ended up with
+    // -----------------------------------------------------------------------------------------
+    inline const char* compressed_format_name(const unsigned int& format) {
+        switch (format) {
+            case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: return "BC1 (RGB)";
+            case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT: return "BC1 (RGBA)";
+            case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT: return "BC2";
+            case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: return "BC3";
+            case GL_COMPRESSED_RED_RGTC1: return "BC4";
+            case GL_COMPRESSED_RG_RGTC2: return "BC5";
+            default: return "uncompressed";
+        }
+    }
+
+    // Check if the driver can sample a compressed format, the S3TC formats (BC1-3) are an extension while RGTC (BC4
+    // and BC5) is core in 3.0
+    // -------------------------------------------------------------------------------------------------------------
+    inline bool compressed_format_supported(const unsigned int& format) {
+        switch (format) {
+            case GL_COMPRESSED_RED_RGTC1:
+            case GL_COMPRESSED_RG_RGTC2: return true;
+            case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+            case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+            case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+            case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: return get_extensions().EXT_texture_compression_s3tc;
+            default: return false;
+        }
+    }
+
+    namespace detail {
+        inline uint32_t read_u32(const std::vector<unsigned char>& file, const size_t& offset) {
+            uint32_t value = 0;
+            std::memcpy(&value, file.data() + offset, sizeof(value));
+            return value;
+        }
+
+        inline std::vector<unsigned char> read_file(const std::string& path) {
+            std::ifstream stream(path, std::ios::in | std::ios::binary);
+            if (!stream.good()) {
+                throw std::system_error(std::error_code(ENOENT, std::system_category()),
+                                        fmt::format("Failed to open image file '{}'", path));
+            }
+            return std::vector<unsigned char>((std::istreambuf_iterator<char>(stream)),
+                                              std::istreambuf_iterator<char>());
+        }
+
+        [[noreturn]] inline void invalid_image(const std::string& path, const std::string& reason) {
+            throw std::system_error(std::error_code(EINVAL, std::system_category()),
+                                    fmt::format("Can't load compressed image '{}': {}", path, reason));
+        }
+
+        // Lower case extension of a path, without the dot
+        inline std::string extension(const std::string& path) {
+            const size_t dot = path.find_last_of('.');
+            if (dot == std::string::npos) {
+                return "";
+            }
+            std::string lower = path.substr(dot + 1);
+            std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) {
+                return static_cast<char>(std::tolower(c));
+            });
+            return lower;
+        }
+
+        // Copy count mip levels out of the file, starting at offset
+        // DDS levels are packed back to back, KTX levels start with their size and are padded to 4 bytes
+        // Levels past 1x1 can't be uploaded, so a count from the header that goes beyond it is clamped
+        inline void read_levels(compressed_image& image,
+                                const std::vector<unsigned char>& file,
+                                size_t offset,
+                                const size_t& count,
+                                const bool& sized_levels,
+                                const std::string& path) {
+            // The header sizes are unsigned, anything that doesn't fit in an int comes out negative
+            if (image.width <= 0 || image.height <= 0) {
+                invalid_image(path, fmt::format("invalid size {}x{}", image.width, image.height));
+            }
+            size_t full_chain = 1;
+            for (int size = std::max(image.width, image.height); size > 1; size /= 2) {
+                ++full_chain;
+            }
+
+            for (size_t level = 0; level < std::min(count, full_chain); ++level) {
+                const int width   = std::max(1, image.width >> level);
+                const int height  = std::max(1, image.height >> level);
+                const size_t size = compressed_level_size(image.format, width, height);
+                if (sized_levels) {
+                    offset += sizeof(uint32_t);
+                }
+                if (offset + size > file.size()) {
+                    invalid_image(path, fmt::format("mip level {} is truncated", level));
+                }
+                image.levels.emplace_back(file.begin() + offset, file.begin() + offset + size);
+                offset += sized_levels ? (size + 3) / 4 * 4 : size;
+            }
+        }
+    }  // namespace detail
+
+    // Load a DirectDraw Surface file with BC1, BC2, BC3, BC4, or BC5 data, including the DX10 extended header
+    // See: https://learn.microsoft.com/en-us/windows/win32/direct3ddds/dx-graphics-dds-pguide
+    // -------------------------------------------------------------------------------------------------------
+    inline compressed_image load_dds(const std::string& path) {
+        const std::vector<unsigned char> file = detail::read_file(path);
+        if (file.size() < 128 || std::memcmp(file.data(), "DDS ", 4) != 0) {
+            detail::invalid_image(path, "not a DDS file");
+        }
+
+        // The header starts after the magic number, and the pixel format is 72 bytes into the header
+        compressed_image image;
+        image.height        = static_cast<int>(detail::read_u32(file, 4 + 8));
+        image.width         = static_cast<int>(detail::read_u32(file, 4 + 12));
+        const size_t levels = std::max<uint32_t>(detail::read_u32(file, 4 + 24), 1);
+        char four_cc[5]     = {0};
+        std::memcpy(four_cc, file.data() + 4 + 80, 4);
+        size_t offset = 128;
+
+        const std::string code = four_cc;
+        if (code == "DXT1") {
+            image.format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+        }
+        else if (code == "DXT3") {
+            image.format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;
+        }
+        else if (code == "DXT5") {
+            image.format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        }
+        else if (code == "ATI1" || code == "BC4U") {
+            image.format = GL_COMPRESSED_RED_RGTC1;
+        }
+        else if (code == "ATI2" || code == "BC5U") {
+            image.format = GL_COMPRESSED_RG_RGTC2;
+        }
+        else if (code == "DX10") {
+            if (file.size() < 148) {
+                detail::invalid_image(path, "truncated DX10 header");
+            }
+            // DXGI_FORMAT values
+            switch (detail::read_u32(file, 128)) {
+                case 71: image.format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; break;
+                case 74: image.format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT; break;
+                case 77: image.format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; break;
+                case 80: image.format = GL_COMPRESSED_RED_RGTC1; break;
+                case 83: image.format = GL_COMPRESSED_RG_RGTC2; break;
+                default: detail::invalid_image(path, "unsupported DXGI format");
+            }
+            offset = 148;
+        }
+        else {
+            detail::invalid_image(path, fmt::format("unsupported pixel format '{}'", code));
+        }
+
+        detail::read_levels(image, file, offset, levels, false, path);
+        return image;
+    }
+
+    // Load a KTX (version 1) file with a single 2D block compressed image
+    // See: https://registry.khronos.org/KTX/specs/1.0/ktxspec.v1.html
+    // -------------------------------------------------------------------
+    inline compressed_image load_ktx(const std::string& path) {
+        static const unsigned char identifier[12] = {
+            0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n'};
+
+        const std::vector<unsigned char> file = detail::read_file(path);
+        if (file.size() < 64 || std::memcmp(file.data(), identifier, sizeof(identifier)) != 0) {
+            detail::invalid_image(path, "not a KTX file");
+        }
+        if (detail::read_u32(file, 12) != 0x04030201) {
+            detail::invalid_image(path, "big endian files are not supported");
+        }
+        // glType is 0 for compressed data
+        if (detail::read_u32(file, 16) != 0) {
+            detail::invalid_image(path, "the image is not compressed");
+        }
+        if (detail::read_u32(file, 48) > 1 || detail::read_u32(file, 52) > 1 || detail::read_u32(file, 44) > 0) {
+            detail::invalid_image(path, "only 2D images with a single face are supported");
+        }
+
+        compressed_image image;
+        image.format        = detail::read_u32(file, 28);
+        image.width         = static_cast<int>(detail::read_u32(file, 36));
+        image.height        = static_cast<int>(std::max<uint32_t>(detail::read_u32(file, 40), 1));
+        const size_t levels = std::max<uint32_t>(detail::read_u32(file, 56), 1);
+        if (compressed_block_size(image.format) == 0) {
+            detail::invalid_image(path, fmt::format("unsupported internal format 0x{:04X}", image.format));
+        }
+
+        // Skip the key/value data
+        detail::read_levels(image, file, 64 + detail::read_u32(file, 60), levels, true, path);
+        return image;
+    }
+
+    // Save a compressed image as a DirectDraw Surface file that load_dds can read back
+    // Returns false if the file couldn't be written
+    // --------------------------------------------------------------------------------
+    inline bool save_dds(const std::string& path, const compressed_image& image) {
+        const char* four_cc = nullptr;
+        switch (image.format) {
+            case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+            case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT: four_cc = "DXT1"; break;
+            case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT: four_cc = "DXT3"; break;
+            case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: four_cc = "DXT5"; break;
+            case GL_COMPRESSED_RED_RGTC1: four_cc = "ATI1"; break;
+            case GL_COMPRESSED_RG_RGTC2: four_cc = "ATI2"; break;
+            default: return false;
+        }
+
+        // Magic number, then the header with the caps, height, width, linear size, and mip map count flags set
+        std::vector<unsigned char> header(128, 0);
+        auto write_u32 = [&header](const size_t& offset, const uint32_t& value) {
+            std::memcpy(header.data() + offset, &value, sizeof(value));
+        };
+        std::memcpy(header.data(), "DDS ", 4);
+        write_u32(4 + 0, 124);
+        write_u32(4 + 4, 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000);
+        write_u32(4 + 8, static_cast<uint32_t>(image.height));
+        write_u32(4 + 12, static_cast<uint32_t>(image.width));
+        write_u32(4 + 16, static_cast<uint32_t>(image.levels.empty() ? 0 : image.levels.front().size()));
+        write_u32(4 + 24, static_cast<uint32_t>(image.levels.size()));
+        // Pixel format, with only the four character code set
+        write_u32(4 + 72, 32);
+        write_u32(4 + 76, 0x4);
+        std::memcpy(header.data() + 4 + 80, four_cc, 4);
+        // Texture, mip map, and complex caps
+        write_u32(4 + 104, 0x1000 | 0x400000 | 0x8);
+
+        std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file.good()) {
+            return false;
+        }
+        file.write(reinterpret_cast<const char*>(header.data()), header.size());
+        for (const std::vector<unsigned char>& level : image.levels) {
+            file.write(reinterpret_cast<const char*>(level.data()), level.size());
+        }
+        return file.good();
+    }
+
+    // Check if a file is a compressed texture container, from its extension
+    // ---------------------------------------------------------------------
+    inline bool is_compressed_container(const std::string& path) {
+        const std::string extension = detail::extension(path);
+        return extension == "dds" || extension == "ktx";
+    }
+
+    // Load a DDS or KTX file, depending on its extension
+    // --------------------------------------------------
+    inline compressed_image load_compressed_image(const std::string& path) {
+        if (detail::extension(path) == "ktx") {
+            return load_ktx(path);
+        }
+        return load_dds(path);
+    }
+}  // namespace gl
+}  // namespace utility
+
+
+#endif  // UTILITY_COMPRESSED_IMAGE_HPP
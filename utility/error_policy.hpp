@@ -0,0 +1,55 @@
+#ifndef UTILITY_ERROR_POLICY_HPP
+#define UTILITY_ERROR_POLICY_HPP
+
+// How the OpenGL and OpenAL wrappers check for errors
+// Pick one at build time by defining UTILITY_ERROR_POLICY (see ERROR_POLICY in the top level CMakeLists.txt)
+//
+// UTILITY_ERROR_CHECK_ALWAYS:   Call glGetError/alGetError after every wrapped call, even in release builds
+// UTILITY_ERROR_CHECK_DEBUG:    Only check for errors in debug builds (the default)
+// UTILITY_ERROR_CHECK_CALLBACK: Never call glGetError, OpenGL errors are reported asynchronously through the
+//                               KHR_debug message callback (see load_extensions). OpenAL has no equivalent, so it
+//                               falls back to checking in debug builds
+//
+// Error messages are only formatted once an error has actually been found, so when checking is disabled the wrappers
+// make no error checking calls and do no formatting
+// -------------------------------------------------------------------------------------------------------------------
+#define UTILITY_ERROR_CHECK_ALWAYS 0
+#define UTILITY_ERROR_CHECK_DEBUG 1
+#define UTILITY_ERROR_CHECK_CALLBACK 2
+
+#ifndef UTILITY_ERROR_POLICY
+#define UTILITY_ERROR_POLICY UTILITY_ERROR_CHECK_DEBUG
+#endif
+
+#if UTILITY_ERROR_POLICY == UTILITY_ERROR_CHECK_ALWAYS
+#define UTILITY_GL_CHECK_ERRORS 1
+#define UTILITY_AL_CHECK_ERRORS 1
+#elif UTILITY_ERROR_POLICY == UTILITY_ERROR_CHECK_CALLBACK
+#define UTILITY_GL_CHECK_ERRORS 0
+#ifdef NDEBUG
+#define UTILITY_AL_CHECK_ERRORS 0
+#else
+#define UTILITY_AL_CHECK_ERRORS 1
+#endif
+#elif UTILITY_ERROR_POLICY == UTILITY_ERROR_CHECK_DEBUG
+#ifdef NDEBUG
+#define UTILITY_GL_CHECK_ERRORS 0
+#define UTILITY_AL_CHECK_ERRORS 0
+#else
+#define UTILITY_GL_CHECK_ERRORS 1
+#define UTILITY_AL_CHECK_ERRORS 1
+#endif
+#else
+#error "Unknown UTILITY_ERROR_POLICY, use one of UTILITY_ERROR_CHECK_ALWAYS, _DEBUG, or _CALLBACK"
+#endif
+
+namespace utility {
+    // Whether the OpenGL context should be created as a debug context
+    // The KHR_debug callback is only guaranteed to report messages in a debug context
+    // Example: glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, utility::debug_context);
+    // ---------------------------------------------------------------------------------
+    constexpr int debug_context = (UTILITY_ERROR_POLICY == UTILITY_ERROR_CHECK_CALLBACK) ? 1 : 0;
+}  // namespace utility
+
+
+#endif  // UTILITY_ERROR_POLICY_HPP
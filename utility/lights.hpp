@@ -0,0 +1,139 @@
+#ifndef UTILITY_LIGHTS_HPP
+#define UTILITY_LIGHTS_HPP
+
+#include <array>
+#include <cstddef>  // for offsetof
+
+// For matrix and vector arithmetic
+#include "glm/glm.hpp"
+
+#include "utility/opengl_utils.hpp"
+
+namespace utility {
+namespace lights {
+    // These structs mirror the light structs in the shaders and follow the std140 layout rules so that they can be
+    // copied straight into a uniform buffer
+    // vec3s have a base alignment of 16 in std140, but a float can be packed into the 4 bytes after a vec3
+    // -------------------------------------------------------------------------------------------------------------
+
+    // A light that is infinitely far away, like the sun
+    // -------------------------------------------------
+    struct DirectionalLight {
+        // World space direction
+        alignas(16) glm::vec3 direction;
+
+        alignas(16) glm::vec3 ambient;
+        alignas(16) glm::vec3 diffuse;
+        alignas(16) glm::vec3 specular;
+
+        using std140_layout = utility::gl::std140::layout<glm::vec3, glm::vec3, glm::vec3, glm::vec3>;
+    };
+    static_assert(offsetof(DirectionalLight, direction) == DirectionalLight::std140_layout::offset(0), "Bad std140");
+    static_assert(offsetof(DirectionalLight, ambient) == DirectionalLight::std140_layout::offset(1), "Bad std140");
+    static_assert(offsetof(DirectionalLight, diffuse) == DirectionalLight::std140_layout::offset(2), "Bad std140");
+    static_assert(offsetof(DirectionalLight, specular) == DirectionalLight::std140_layout::offset(3), "Bad std140");
+    static_assert(sizeof(DirectionalLight) == DirectionalLight::std140_layout::size(), "Bad std140");
+
+    // A light that shines in all directions from a point
+    // --------------------------------------------------
+    struct PointLight {
+        // World space position
+        alignas(16) glm::vec3 position;
+
+        alignas(16) glm::vec3 ambient;
+        alignas(16) glm::vec3 diffuse;
+        alignas(16) glm::vec3 specular;
+
+        // Constant, linear, and quadratic terms for attenuation
+        float Kc;
+        float Kl;
+        float Kq;
+
+        using std140_layout =
+            utility::gl::std140::layout<glm::vec3, glm::vec3, glm::vec3, glm::vec3, float, float, float>;
+    };
+    static_assert(offsetof(PointLight, position) == PointLight::std140_layout::offset(0), "Bad std140");
+    static_assert(offsetof(PointLight, ambient) == PointLight::std140_layout::offset(1), "Bad std140");
+    static_assert(offsetof(PointLight, diffuse) == PointLight::std140_layout::offset(2), "Bad std140");
+    static_assert(offsetof(PointLight, specular) == PointLight::std140_layout::offset(3), "Bad std140");
+    static_assert(offsetof(PointLight, Kc) == PointLight::std140_layout::offset(4), "Bad std140");
+    static_assert(offsetof(PointLight, Kl) == PointLight::std140_layout::offset(5), "Bad std140");
+    static_assert(offsetof(PointLight, Kq) == PointLight::std140_layout::offset(6), "Bad std140");
+    static_assert(sizeof(PointLight) == PointLight::std140_layout::size(), "Bad std140");
+
+    // A light that shines in a cone from a point, like a torch
+    // --------------------------------------------------------
+    struct SpotLight {
+        // World space position and direction
+        alignas(16) glm::vec3 position;
+        alignas(16) glm::vec3 direction;
+
+        alignas(16) glm::vec3 ambient;
+        alignas(16) glm::vec3 diffuse;
+        alignas(16) glm::vec3 specular;
+
+        // Constant, linear, and quadratic terms for attenuation
+        float Kc;
+        float Kl;
+        float Kq;
+
+        // Radius of the inner and outer light cones
+        float phi;
+        float gamma;
+
+        // Whether or not we should fade the spotlight out
+        // bools are 4 bytes in std140
+        int fade;
+
+        using std140_layout = utility::gl::std140::
+            layout<glm::vec3, glm::vec3, glm::vec3, glm::vec3, glm::vec3, float, float, float, float, float, int>;
+    };
+    static_assert(offsetof(SpotLight, position) == SpotLight::std140_layout::offset(0), "Bad std140");
+    static_assert(offsetof(SpotLight, direction) == SpotLight::std140_layout::offset(1), "Bad std140");
+    static_assert(offsetof(SpotLight, ambient) == SpotLight::std140_layout::offset(2), "Bad std140");
+    static_assert(offsetof(SpotLight, diffuse) == SpotLight::std140_layout::offset(3), "Bad std140");
+    static_assert(offsetof(SpotLight, specular) == SpotLight::std140_layout::offset(4), "Bad std140");
+    static_assert(offsetof(SpotLight, Kc) == SpotLight::std140_layout::offset(5), "Bad std140");
+    static_assert(offsetof(SpotLight, Kl) == SpotLight::std140_layout::offset(6), "Bad std140");
+    static_assert(offsetof(SpotLight, Kq) == SpotLight::std140_layout::offset(7), "Bad std140");
+    static_assert(offsetof(SpotLight, phi) == SpotLight::std140_layout::offset(8), "Bad std140");
+    static_assert(offsetof(SpotLight, gamma) == SpotLight::std140_layout::offset(9), "Bad std140");
+    static_assert(offsetof(SpotLight, fade) == SpotLight::std140_layout::offset(10), "Bad std140");
+    static_assert(sizeof(SpotLight) == SpotLight::std140_layout::size(), "Bad std140");
+
+    // All of the lights in a scene
+    // Matches the "Lights" uniform block in the shaders
+    // layout(std140) uniform Lights {
+    //     DirectionalLight sun;
+    //     PointLight lights[NR_POINT_LIGHTS];
+    //     SpotLight lamp;
+    // };
+    // -------------------------------------------------
+    template <size_t NR_POINT_LIGHTS>
+    struct LightBlock {
+        DirectionalLight sun;
+        std::array<PointLight, NR_POINT_LIGHTS> lights;
+        SpotLight lamp;
+
+        using std140_layout =
+            utility::gl::std140::layout<DirectionalLight, std::array<PointLight, NR_POINT_LIGHTS>, SpotLight>;
+
+        // Byte offsets of each member in the uniform buffer, for partial updates
+        static constexpr size_t sun_offset() {
+            return std140_layout::offset(0);
+        }
+        static constexpr size_t lights_offset() {
+            return std140_layout::offset(1);
+        }
+        static constexpr size_t lamp_offset() {
+            return std140_layout::offset(2);
+        }
+    };
+    static_assert(offsetof(LightBlock<4>, lights) == LightBlock<4>::lights_offset(), "Bad std140");
+    static_assert(offsetof(LightBlock<4>, lamp) == LightBlock<4>::lamp_offset(), "Bad std140");
+    static_assert(sizeof(LightBlock<4>) == LightBlock<4>::std140_layout::size(), "Bad std140");
+}  // namespace lights
+}  // namespace utility
+
+
+#endif  // UTILITY_LIGHTS_HPP
@@ -1,8 +1,14 @@
 #ifndef UTILITY_MESH_HPP
 #define UTILITY_MESH_HPP
 
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include <cstddef>  // for offsetof
+#include <cstdint>
 #include <iostream>
+#include <limits>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -50,13 +56,120 @@ namespace mesh {
     };
     static_assert(sizeof(Vertex) == 32, "The compiler is adding padding to this struct, Bad compiler!");
 #pragma pack(pop)
+
+    // Where each member of Vertex goes in the shader
+    using VertexLayout = utility::gl::vertex_format::layout<
+        Vertex,
+        utility::gl::vertex_format::attribute<0, glm::vec3, offsetof(Vertex, position)>,
+        utility::gl::vertex_format::attribute<1, glm::vec3, offsetof(Vertex, normal)>,
+        utility::gl::vertex_format::attribute<2, glm::vec2, offsetof(Vertex, tex)>>;
+
+#pragma pack(push, 1)
+    // A vertex that takes half the space of a Vertex (see Mesh::compress)
+    // Positions are 16-bit fractions of the mesh bounding box, normals are octahedral encoded into two 16-bit
+    // components, and texture coordinates are half floats. Shaders decode them when COMPRESSED_VERTICES is defined
+    // ------------------------------------------------------------------------------------------------------------
+    struct CompressedVertex {
+        // The fourth component is padding so that the normal starts on a 4-byte boundary
+        std::array<utility::gl::vertex_format::normalised<uint16_t>, 4> position;
+        std::array<utility::gl::vertex_format::normalised<int16_t>, 2> normal;
+        std::array<utility::gl::vertex_format::half, 2> tex;
+    };
+    static_assert(sizeof(CompressedVertex) == 16, "The compiler is adding padding to this struct, Bad compiler!");
+#pragma pack(pop)
+
+    using CompressedVertexLayout = utility::gl::vertex_format::layout<
+        CompressedVertex,
+        utility::gl::vertex_format::attribute<0,
+                                              std::array<utility::gl::vertex_format::normalised<uint16_t>, 4>,
+                                              offsetof(CompressedVertex, position)>,
+        utility::gl::vertex_format::attribute<1,
+                                              std::array<utility::gl::vertex_format::normalised<int16_t>, 2>,
+                                              offsetof(CompressedVertex, normal)>,
+        utility::gl::vertex_format::attribute<2,
+                                              std::array<utility::gl::vertex_format::half, 2>,
+                                              offsetof(CompressedVertex, tex)>>;
+
+    // Map a unit vector onto the [-1, 1] square by projecting it onto an octahedron and unfolding the lower half
+    // See "A Survey of Efficient Representations for Independent Unit Vectors" (Cigolle et al. 2014)
+    // ----------------------------------------------------------------------------------------------------------
+    inline glm::vec2 encode_octahedral(const glm::vec3& normal) {
+        const float length = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+        if (length == 0.0f) {
+            return glm::vec2(0.0f);
+        }
+        const glm::vec2 folded(normal.x / length, normal.y / length);
+        if (normal.z >= 0.0f) {
+            return folded;
+        }
+        return glm::vec2((1.0f - std::abs(folded.y)) * (folded.x >= 0.0f ? 1.0f : -1.0f),
+                         (1.0f - std::abs(folded.x)) * (folded.y >= 0.0f ? 1.0f : -1.0f));
+    }
+
+    // A run of indices that is drawn with one draw call
+    // Indices in the run are relative to base_vertex, so meshes with more vertices than a 16-bit index can address
+    // are drawn as several runs that each address at most 65536 vertices
+    // ------------------------------------------------------------------------------------------------------------
+    struct DrawRange {
+        // Position of the first index of the run in the element buffer, and the number of indices
+        size_t first    = 0;
+        size_t count    = 0;
+        int base_vertex = 0;
+    };
+
+    // Split a triangle list into runs of triangles that each use at most max_vertices vertices
+    // Vertices that are shared by triangles in different runs are duplicated, so afterwards the vertices of each run
+    // are contiguous and its indices are relative to the first vertex of the run
+    // Returns the draw ranges, one per run
+    // --------------------------------------------------------------------------------------------------------------
+    template <typename V>
+    std::vector<DrawRange> split_triangles(std::vector<V>& vertices,
+                                           std::vector<unsigned int>& indices,
+                                           const size_t& max_vertices) {
+        std::vector<DrawRange> ranges;
+        std::vector<V> split_vertices;
+        split_vertices.reserve(vertices.size());
+        // Position of each original vertex in the current run, or -1 if the run doesn't use it yet
+        std::vector<int> remap(vertices.size(), -1);
+        std::vector<unsigned int> run_vertices;
+
+        DrawRange range;
+        for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+            // Start a new run if this triangle might not fit in the current one
+            if (split_vertices.size() - static_cast<size_t>(range.base_vertex) + 3 > max_vertices) {
+                ranges.push_back(range);
+                range.first       = i;
+                range.count       = 0;
+                range.base_vertex = static_cast<int>(split_vertices.size());
+                for (const unsigned int& vertex : run_vertices) {
+                    remap[vertex] = -1;
+                }
+                run_vertices.clear();
+            }
+            for (size_t j = i; j < i + 3; ++j) {
+                const unsigned int vertex = indices[j];
+                if (remap[vertex] < 0) {
+                    remap[vertex] = static_cast<int>(split_vertices.size()) - range.base_vertex;
+                    split_vertices.push_back(vertices[vertex]);
+                    run_vertices.push_back(vertex);
+                }
+                indices[j] = static_cast<unsigned int>(remap[vertex]);
+            }
+            range.count += 3;
+        }
+        ranges.push_back(range);
+
+        vertices = std::move(split_vertices);
+        return ranges;
+    }
+
     struct Mesh {
         Mesh() {
             initialised = false;
         }
         Mesh(std::vector<Vertex>&& vertices,
              std::vector<unsigned int>&& indices,
-             std::vector<utility::gl::texture>&& textures)
+             std::vector<std::shared_ptr<utility::gl::texture>>&& textures)
             : vertices(std::move(vertices)), indices(std::move(indices)), textures(std::move(textures)) {
             setup_mesh();
         }
@@ -71,97 +184,395 @@ namespace mesh {
         Mesh& operator=(const Mesh& mesh) = delete;
         Mesh(Mesh&& mesh) noexcept
             : vertices(std::move(mesh.vertices))
+            , compressed_vertices(std::move(mesh.compressed_vertices))
+            , position_scale(mesh.position_scale)
+            , position_offset(mesh.position_offset)
+            , compressed(std::exchange(mesh.compressed, false))
             , indices(std::move(mesh.indices))
             , textures(std::move(mesh.textures))
-            , VAO(std::move(mesh.VAO))
-            , VBO(std::move(mesh.VBO))
-            , EBO(std::move(mesh.EBO))
-            , initialised(std::exchange(mesh.initialised, false)) {}
+            , geometry_residency(mesh.geometry_residency)
+            , buffers(std::move(mesh.buffers))
+            , draws(std::move(mesh.draws))
+            , initialised(std::exchange(mesh.initialised, false))
+            , uniform_program(std::exchange(mesh.uniform_program, 0))
+            , diffuse_uniform(mesh.diffuse_uniform)
+            , specular_uniform(mesh.specular_uniform)
+            , diffuse_units(std::move(mesh.diffuse_units))
+            , specular_units(std::move(mesh.specular_units))
+            , diffuse_layers(std::move(mesh.diffuse_layers))
+            , specular_layers(std::move(mesh.specular_layers))
+            , layered(std::exchange(mesh.layered, false))
+            , diffuse_layer_uniform(mesh.diffuse_layer_uniform)
+            , specular_layer_uniform(mesh.specular_layer_uniform)
+            , position_scale_uniform(mesh.position_scale_uniform)
+            , position_offset_uniform(mesh.position_offset_uniform)
+            , diffuse_count_uniform(mesh.diffuse_count_uniform)
+            , specular_count_uniform(mesh.specular_count_uniform)
+            , diffuse_count(mesh.diffuse_count)
+            , specular_count(mesh.specular_count) {}
         Mesh& operator=(Mesh&& mesh) {
-            vertices    = std::move(mesh.vertices);
-            indices     = std::move(mesh.indices);
-            textures    = std::move(mesh.textures);
-            VAO         = std::move(mesh.VAO);
-            VBO         = std::move(mesh.VBO);
-            EBO         = std::move(mesh.EBO);
-            initialised = std::exchange(mesh.initialised, false);
+            vertices                = std::move(mesh.vertices);
+            compressed_vertices     = std::move(mesh.compressed_vertices);
+            position_scale          = mesh.position_scale;
+            position_offset         = mesh.position_offset;
+            compressed              = std::exchange(mesh.compressed, false);
+            indices                 = std::move(mesh.indices);
+            textures                = std::move(mesh.textures);
+            geometry_residency      = mesh.geometry_residency;
+            buffers                 = std::move(mesh.buffers);
+            draws                   = std::move(mesh.draws);
+            initialised             = std::exchange(mesh.initialised, false);
+            uniform_program         = std::exchange(mesh.uniform_program, 0);
+            diffuse_uniform         = mesh.diffuse_uniform;
+            specular_uniform        = mesh.specular_uniform;
+            diffuse_units           = std::move(mesh.diffuse_units);
+            specular_units          = std::move(mesh.specular_units);
+            diffuse_layers          = std::move(mesh.diffuse_layers);
+            specular_layers         = std::move(mesh.specular_layers);
+            layered                 = std::exchange(mesh.layered, false);
+            diffuse_layer_uniform   = mesh.diffuse_layer_uniform;
+            specular_layer_uniform  = mesh.specular_layer_uniform;
+            position_scale_uniform  = mesh.position_scale_uniform;
+            position_offset_uniform = mesh.position_offset_uniform;
+            diffuse_count_uniform   = mesh.diffuse_count_uniform;
+            specular_count_uniform  = mesh.specular_count_uniform;
+            diffuse_count           = mesh.diffuse_count;
+            specular_count          = mesh.specular_count;
             return *this;
         }
 
         void render(utility::gl::shader_program& program) {
-            int diffuse_count  = 0;
-            int specular_count = 0;
+            bind_material(program);
+
+            // Render the mesh, using the index type that setup_mesh picked
+            // Meshes that were never set up have nothing to draw
+            if (!buffers) {
+                return;
+            }
+            buffers->VAO.bind();
+            const unsigned int index_type = buffers->EBO.type();
+            const size_t index_size       = utility::gl::index_size(index_type);
+            for (const DrawRange& range : draws) {
+                const void* offset = reinterpret_cast<const void*>(range.first * index_size);
+                if (range.base_vertex == 0) {
+                    glDrawElements(GL_TRIANGLES, range.count, index_type, offset);
+                }
+                else {
+                    glDrawElementsBaseVertex(GL_TRIANGLES, range.count, index_type, offset, range.base_vertex);
+                }
+            }
+            buffers->VAO.unbind();
+
+            // Always good practice to set everything back to defaults once configured
+            utility::gl::get_state().active_texture(GL_TEXTURE0);
+        }
+
+        // Bind the textures and set the material uniforms of this mesh, without drawing anything
+        // Used by render, and by models that draw the vertices of many meshes from shared buffers
+        // ---------------------------------------------------------------------------------------
+        void bind_material(utility::gl::shader_program& program) {
+            // Resolve the sampler uniforms the first time we are rendered with a program
+            if (uniform_program != static_cast<unsigned int>(program)) {
+                resolve_uniforms(program);
+            }
+
+            if (layered) {
+                // The texture arrays are bound once for the whole model, each map is just an array and a layer
+                program.set_uniform(diffuse_layer_uniform, diffuse_layers);
+                program.set_uniform(specular_layer_uniform, specular_layers);
+            }
+            else {
+                // Point each sampler array at the units its textures are bound to, one upload per array
+                program.set_uniform(diffuse_uniform, diffuse_units);
+                program.set_uniform(specular_uniform, specular_units);
 
+                for (int i = 0; i < textures.size(); ++i) {
+                    textures[i]->bind(GL_TEXTURE0 + i);
+                }
+            }
+
+            // Undo the position quantisation of compressed vertices, which may have been freed since (see
+            // release_geometry)
+            if (compressed) {
+                program.set_uniform(position_scale_uniform, position_scale);
+                program.set_uniform(position_offset_uniform, position_offset);
+            }
+
+            // Set the actual number of diffuse and specular maps that we loaded
+            program.set_uniform(diffuse_count_uniform, diffuse_count);
+            program.set_uniform(specular_count_uniform, specular_count);
+        }
+
+        // Check if two meshes can be drawn without changing any material state in between
+        // -------------------------------------------------------------------------------
+        bool same_material(const Mesh& mesh) const {
+            if (textures.size() != mesh.textures.size() || position_scale != mesh.position_scale
+                || position_offset != mesh.position_offset) {
+                return false;
+            }
+            if (layered || mesh.layered) {
+                return layered == mesh.layered && diffuse_layers == mesh.diffuse_layers
+                       && specular_layers == mesh.specular_layers;
+            }
+            // Textures from the texture cache are shared, so the same image is the same texture
+            return std::equal(textures.begin(), textures.end(), mesh.textures.begin());
+        }
+
+        // Count the textures of one style (diffuse, specular) that this mesh has
+        // ---------------------------------------------------------------------
+        size_t texture_count(const utility::gl::TextureStyle::Value& style) const {
+            if (layered) {
+                switch (style) {
+                    case utility::gl::TextureStyle::TEXTURE_DIFFUSE: return diffuse_layers.size();
+                    case utility::gl::TextureStyle::TEXTURE_SPECULAR: return specular_layers.size();
+                    default: return 0;
+                }
+            }
+            return std::count_if(
+                textures.begin(), textures.end(), [&style](const std::shared_ptr<utility::gl::texture>& texture) {
+                    return texture->style() == style;
+                });
+        }
+
+        // Find handles for all of the material uniforms that this mesh needs to set
+        // -------------------------------------------------------------------------
+        void resolve_uniforms(utility::gl::shader_program& program) {
+            if (layered) {
+                // With texture arrays the material maps are ivec2(array, layer) instead of samplers
+                diffuse_count          = static_cast<int>(diffuse_layers.size());
+                specular_count         = static_cast<int>(specular_layers.size());
+                diffuse_layer_uniform  = program.get_uniform<glm::ivec2>("material.diffuse");
+                specular_layer_uniform = program.get_uniform<glm::ivec2>("material.specular");
+                resolve_common_uniforms(program);
+                return;
+            }
+
+            diffuse_units.clear();
+            specular_units.clear();
+
+            // Texture i is bound to unit i, sorted into the sampler array for its style
             for (int i = 0; i < textures.size(); ++i) {
-                std::string texture_uniform;
-                switch (textures[i].style()) {
-                    case utility::gl::TextureStyle::TEXTURE_DIFFUSE:
-                        texture_uniform = fmt::format("material.diffuse[{}]", diffuse_count++);
-                        break;
-                    case utility::gl::TextureStyle::TEXTURE_SPECULAR:
-                        texture_uniform = fmt::format("material.specular[{}]", specular_count++);
-                        break;
+                switch (textures[i]->style()) {
+                    case utility::gl::TextureStyle::TEXTURE_DIFFUSE: diffuse_units.push_back(i); break;
+                    case utility::gl::TextureStyle::TEXTURE_SPECULAR: specular_units.push_back(i); break;
                     default:
                         utility::gl::throw_gl_error(GL_INVALID_ENUM,
-                                                    fmt::format("Invalid texture style '{}'", textures[i].style()));
+                                                    fmt::format("Invalid texture style '{}'", textures[i]->style()));
                 }
+            }
+            diffuse_count  = static_cast<int>(diffuse_units.size());
+            specular_count = static_cast<int>(specular_units.size());
 
-                // Activate the appropriate texture unit before setting the uniform
-                glActiveTexture(GL_TEXTURE0 + i);
+            diffuse_uniform  = program.get_uniform<int>("material.diffuse");
+            specular_uniform = program.get_uniform<int>("material.specular");
+            resolve_common_uniforms(program);
+        }
 
-                // Set the texture uniform
-                program.set_uniform(texture_uniform, i);
+        // Use layers of texture arrays for the material maps instead of the textures, and release the textures
+        // The owner of the arrays binds them (see Model), render then only sets which array and layer each map is in
+        // Render with a program that has TEXTURE_ARRAYS defined
+        // -----------------------------------------------------------------------------------------------------------
+        // diffuse: Array index and layer of each diffuse map
+        // specular: Array index and layer of each specular map
+        // -----------------------------------------------------------------------------------------------------------
+        void use_texture_layers(std::vector<glm::ivec2>&& diffuse, std::vector<glm::ivec2>&& specular) {
+            diffuse_layers  = std::move(diffuse);
+            specular_layers = std::move(specular);
+            layered         = true;
+            textures.clear();
+            // The uniforms have different types now
+            uniform_program = 0;
+        }
+
+        // Find the handles that are the same with and without texture arrays
+        void resolve_common_uniforms(utility::gl::shader_program& program) {
+            position_scale_uniform  = program.get_uniform<glm::vec3>("positionScale");
+            position_offset_uniform = program.get_uniform<glm::vec3>("positionOffset");
+            diffuse_count_uniform   = program.get_uniform<int>("material.diffuse_count");
+            specular_count_uniform  = program.get_uniform<int>("material.specular_count");
+            uniform_program         = program;
+        }
 
-                // Bind the texture
-                textures[i].bind(GL_TEXTURE0 + i);
+        // Replace the vertices with compressed vertices, call this before setup_mesh
+        // Render compressed meshes with a program that has COMPRESSED_VERTICES defined
+        // ---------------------------------------------------------------------------
+        void compress() {
+            if (vertices.empty()) {
+                return;
             }
 
-            // Set the actual number of diffuse and specular maps that we loaded
-            program.set_uniform("material.diffuse_count", diffuse_count);
-            program.set_uniform("material.specular_count", specular_count);
+            // Quantise positions relative to the bounding box of the mesh
+            glm::vec3 low  = vertices.front().position;
+            glm::vec3 high = vertices.front().position;
+            for (const Vertex& vertex : vertices) {
+                low  = glm::min(low, vertex.position);
+                high = glm::max(high, vertex.position);
+            }
+            compress(low, high);
+        }
+        // Same as compress, but quantise positions relative to the given box, which must hold every vertex
+        // Meshes that are compressed against the same box have the same position scale and offset, so they can be
+        // drawn together without changing those uniforms (see same_material)
+        // ----------------------------------------------------------------------------------------------------------
+        // low: The lowest corner of the box
+        // high: The highest corner of the box
+        // ----------------------------------------------------------------------------------------------------------
+        void compress(const glm::vec3& low, const glm::vec3& high) {
+            if (vertices.empty()) {
+                return;
+            }
 
-            // Render the mesh
-            VAO.bind();
-            glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-            VAO.unbind();
+            position_offset = low;
+            position_scale  = high - low;
+            glm::vec3 inverse_scale(0.0f);
+            for (int i = 0; i < 3; ++i) {
+                // A flat mesh has no extent along one of the axes
+                inverse_scale[i] = position_scale[i] > 0.0f ? 1.0f / position_scale[i] : 0.0f;
+            }
 
-            // Always good practice to set everything back to defaults once configured
-            glActiveTexture(GL_TEXTURE0);
+            using utility::gl::vertex_format::half;
+            using utility::gl::vertex_format::normalised;
+            compressed_vertices.clear();
+            compressed_vertices.reserve(vertices.size());
+            for (const Vertex& vertex : vertices) {
+                const glm::vec3 position = (vertex.position - position_offset) * inverse_scale;
+                const glm::vec2 normal   = encode_octahedral(vertex.normal);
+
+                CompressedVertex compressed;
+                compressed.position = {{normalised<uint16_t>(position.x),
+                                        normalised<uint16_t>(position.y),
+                                        normalised<uint16_t>(position.z),
+                                        normalised<uint16_t>(0.0f)}};
+                compressed.normal   = {{normalised<int16_t>(normal.x), normalised<int16_t>(normal.y)}};
+                compressed.tex      = {{half(vertex.tex.x), half(vertex.tex.y)}};
+                compressed_vertices.push_back(compressed);
+            }
+
+            vertices.clear();
+            vertices.shrink_to_fit();
+            compressed = true;
+        }
+
+        // Work out the draw calls for the mesh so that every index fits in 16 bits. If there are too many vertices
+        // for 16-bit indices then the mesh is split into runs that each address at most 65536 vertices
+        // Called by setup_mesh, call it directly when the vertices are going to be uploaded somewhere else
+        // ----------------------------------------------------------------------------------------------------------
+        void prepare_draws() {
+            const size_t max_short_vertices = size_t(std::numeric_limits<uint16_t>::max()) + 1;
+            if (compressed_vertices.empty() && vertices.size() > max_short_vertices) {
+                draws = split_triangles(vertices, indices, max_short_vertices);
+            }
+            else if (compressed_vertices.size() > max_short_vertices) {
+                draws = split_triangles(compressed_vertices, indices, max_short_vertices);
+            }
+            else {
+                draws = {DrawRange{0, indices.size(), 0}};
+            }
+        }
+
+        // The draw calls that render the whole mesh, see prepare_draws
+        // ------------------------------------------------------------
+        const std::vector<DrawRange>& draw_ranges() const {
+            return draws;
         }
 
         void setup_mesh() {
-            // Bind the vertex array
-            VAO.bind();
+            // Use 16-bit indices, which halves the size of the element buffer
+            prepare_draws();
+
+            // Create and bind the vertex array
+            if (!buffers) {
+                buffers.reset(new Buffers());
+            }
+            buffers->VAO.bind();
 
             // Bind the vertex buffer and copy vertices to the device
-            VBO.bind();
-            VBO.copy_data(vertices, GL_STATIC_DRAW);
+            buffers->VBO.bind();
+            if (!compressed) {
+                buffers->VBO.copy_data(vertices, GL_STATIC_DRAW);
+            }
+            else {
+                buffers->VBO.copy_data(compressed_vertices, GL_STATIC_DRAW);
+            }
 
             // Bind the element buffer and copy indices to the device
-            EBO.bind();
-            EBO.copy_data(indices, GL_STATIC_DRAW);
+            buffers->EBO.bind();
+            buffers->EBO.copy_data(std::vector<uint16_t>(indices.begin(), indices.end()), GL_STATIC_DRAW);
 
             // Set up vertex attributes
-            VAO.add_vertex_attrib<float>(0, 3, 8, GL_FLOAT, false, 0);
-            VAO.add_vertex_attrib<float>(1, 3, 8, GL_FLOAT, false, 3);
-            VAO.add_vertex_attrib<float>(2, 2, 8, GL_FLOAT, false, 6);
+            if (!compressed) {
+                buffers->VAO.add_layout<VertexLayout>();
+            }
+            else {
+                buffers->VAO.add_layout<CompressedVertexLayout>();
+            }
 
             // Unbind the vertex array, vertex buffer, and element buffer
-            VAO.unbind();
-            VBO.unbind();
-            EBO.unbind();
+            buffers->VAO.unbind();
+            buffers->VBO.unbind();
+            buffers->EBO.unbind();
             initialised = true;
+
+            if (geometry_residency == utility::gl::residency::release) {
+                release_geometry();
+            }
+        }
+
+        // Free the CPU copies of the vertices and indices, once they are on the GPU they are only needed for picking
+        // or collision. setup_mesh calls this unless geometry_residency is keep
+        // This must not change how the mesh renders, so render state never depends on the CPU copies being there
+        // ----------------------------------------------------------------------------------------------------------
+        void release_geometry() {
+            std::vector<Vertex>().swap(vertices);
+            std::vector<CompressedVertex>().swap(compressed_vertices);
+            std::vector<unsigned int>().swap(indices);
         }
 
         std::vector<Vertex> vertices;
+        // Filled by compress, which also empties vertices
+        std::vector<CompressedVertex> compressed_vertices;
+        // Transform from quantised [0, 1] positions back to model space, position = offset + scale * quantised
+        glm::vec3 position_scale  = glm::vec3(1.0f);
+        glm::vec3 position_offset = glm::vec3(0.0f);
+        // Whether compress has run, which stays true after release_geometry frees compressed_vertices
+        bool compressed = false;
         std::vector<unsigned int> indices;
-        std::vector<utility::gl::texture> textures;
+        // Shared with every other mesh that uses the same image (see utility::gl::texture_cache)
+        std::vector<std::shared_ptr<utility::gl::texture>> textures;
+        // Whether vertices and indices are freed once they have been uploaded (see release_geometry)
+        utility::gl::residency geometry_residency = utility::gl::residency::release;
 
     private:
-        utility::gl::vertex_array VAO;
-        utility::gl::vertex_buffer VBO;
-        utility::gl::element_buffer EBO;
+        // Buffers of a mesh that draws itself, created by setup_mesh. Meshes that a model draws from shared buffers
+        // (see utility::model::Model) never create them
+        struct Buffers {
+            utility::gl::vertex_array VAO;
+            utility::gl::vertex_buffer VBO;
+            utility::gl::element_buffer EBO;
+        };
+        std::unique_ptr<Buffers> buffers;
+        // The draw calls that render the whole mesh, more than one if the mesh was split for 16-bit indices
+        std::vector<DrawRange> draws;
         bool initialised;
+
+        // Uniform handles for the program that we were last rendered with
+        unsigned int uniform_program = 0;
+        utility::gl::uniform<int> diffuse_uniform;
+        utility::gl::uniform<int> specular_uniform;
+        std::vector<int> diffuse_units;
+        std::vector<int> specular_units;
+        // Array and layer of each map when the maps are in texture arrays (see use_texture_layers)
+        std::vector<glm::ivec2> diffuse_layers;
+        std::vector<glm::ivec2> specular_layers;
+        bool layered = false;
+        utility::gl::uniform<glm::ivec2> diffuse_layer_uniform;
+        utility::gl::uniform<glm::ivec2> specular_layer_uniform;
+        utility::gl::uniform<glm::vec3> position_scale_uniform;
+        utility::gl::uniform<glm::vec3> position_offset_uniform;
+        utility::gl::uniform<int> diffuse_count_uniform;
+        utility::gl::uniform<int> specular_count_uniform;
+        int diffuse_count  = 0;
+        int specular_count = 0;
     };
 }  // namespace mesh
 }  // namespace utility
@@ -0,0 +1,225 @@
+#ifndef UTILITY_MIPMAP_HPP
+#define UTILITY_MIPMAP_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// The downsampler uses SSE when the compiler targets it (always the case for x86-64), and plain C++ otherwise
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define UTILITY_MIPMAP_SSE 1
+#include <xmmintrin.h>
+#else
+#define UTILITY_MIPMAP_SSE 0
+#endif
+
+namespace utility {
+namespace gl {
+    namespace detail {
+        // Linear value of every 8 bit sRGB value
+        inline const std::array<float, 256>& srgb_to_linear_table() {
+            static const std::array<float, 256> table = []() {
+                std::array<float, 256> values;
+                for (size_t i = 0; i < values.size(); ++i) {
+                    const float c = static_cast<float>(i) / 255.0f;
+                    values[i]     = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+                }
+                return values;
+            }();
+            return table;
+        }
+
+        // 8 bit sRGB value of linear values from 0 to 1 in steps of 1/4095, which is fine enough that every sRGB value
+        // can be reached
+        inline const std::array<unsigned char, 4096>& linear_to_srgb_table() {
+            static const std::array<unsigned char, 4096> table = []() {
+                std::array<unsigned char, 4096> values;
+                for (size_t i = 0; i < values.size(); ++i) {
+                    const float l = static_cast<float>(i) / 4095.0f;
+                    const float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+                    values[i]     = static_cast<unsigned char>(std::min(255.0f, c * 255.0f + 0.5f));
+                }
+                return values;
+            }();
+            return table;
+        }
+
+        // Halve an image of linear RGBA floats with a 2x2 box filter
+        // When a dimension is odd its last row or column only contributes to the last output pixel through clamping
+        inline std::vector<float> halve(const std::vector<float>& image, const int& width, const int& height) {
+            const int half_width  = std::max(1, width / 2);
+            const int half_height = std::max(1, height / 2);
+            std::vector<float> half(static_cast<size_t>(half_width) * half_height * 4);
+            for (int y = 0; y < half_height; ++y) {
+                const float* row0 = image.data() + static_cast<size_t>(std::min(2 * y, height - 1)) * width * 4;
+                const float* row1 = image.data() + static_cast<size_t>(std::min(2 * y + 1, height - 1)) * width * 4;
+                float* output     = half.data() + static_cast<size_t>(y) * half_width * 4;
+                for (int x = 0; x < half_width; ++x) {
+                    const int x0 = std::min(2 * x, width - 1) * 4;
+                    const int x1 = std::min(2 * x + 1, width - 1) * 4;
+#if UTILITY_MIPMAP_SSE
+                    // One pixel is one register, so all four channels are filtered at once
+                    const __m128 top    = _mm_add_ps(_mm_loadu_ps(row0 + x0), _mm_loadu_ps(row0 + x1));
+                    const __m128 bottom = _mm_add_ps(_mm_loadu_ps(row1 + x0), _mm_loadu_ps(row1 + x1));
+                    _mm_storeu_ps(output + x * 4, _mm_mul_ps(_mm_add_ps(top, bottom), _mm_set1_ps(0.25f)));
+#else
+                    for (int channel = 0; channel < 4; ++channel) {
+                        output[x * 4 + channel] =
+                            0.25f * (row0[x0 + channel] + row0[x1 + channel] + row1[x0 + channel] + row1[x1 + channel]);
+                    }
+#endif
+                }
+            }
+            return half;
+        }
+    }  // namespace detail
+
+    // Number of levels in a full mip chain, down to 1x1
+    // -------------------------------------------------
+    inline int mip_level_count(const int& width, const int& height) {
+        int levels = 1;
+        for (int size = std::max(width, height); size > 1; size /= 2) {
+            ++levels;
+        }
+        return levels;
+    }
+
+    // Generate the mip chain of an image on the CPU, so it can be uploaded instead of calling glGenerateMipmap
+    // Pixels are filtered in linear light. Averaging sRGB values directly darkens every level (a black and white
+    // checkerboard averages to 50% sRGB grey, which is only about 21% of the light), so colour channels are decoded
+    // from sRGB first and encoded again afterwards. Alpha, and every channel of data maps (specular, normals), is
+    // filtered as is
+    // Returns levels 1 and below, each tightly packed with the same number of channels as the image
+    // ------------------------------------------------------------------------------------------------------------
+    // pixels: Level 0, tightly packed rows of channels bytes per pixel
+    // width: Width of the image
+    // height: Height of the image
+    // channels: Number of channels in the image, 1 to 4
+    // srgb: Whether the colour channels are sRGB encoded, true for colour maps
+    // ------------------------------------------------------------------------------------------------------------
+    inline std::vector<std::vector<unsigned char>> generate_mip_chain(const unsigned char* pixels,
+                                                                      const int& width,
+                                                                      const int& height,
+                                                                      const int& channels,
+                                                                      const bool& srgb) {
+        std::vector<std::vector<unsigned char>> levels;
+        if (width <= 0 || height <= 0 || channels < 1 || channels > 4) {
+            return levels;
+        }
+
+        // Grey and grey + alpha images have one colour channel, RGB and RGBA have three
+        const int colour_channels                     = (channels == 2 || channels == 4) ? channels - 1 : channels;
+        const std::array<float, 256>& decode          = detail::srgb_to_linear_table();
+        const std::array<unsigned char, 4096>& encode = detail::linear_to_srgb_table();
+        auto gamma = [&srgb, &colour_channels](const int& channel) { return srgb && channel < colour_channels; };
+
+        // Work in RGBA floats so that every pixel is one SIMD register, and so no precision is lost between levels
+        const size_t count = static_cast<size_t>(width) * height;
+        std::vector<float> linear(count * 4, 0.0f);
+        for (size_t pixel = 0; pixel < count; ++pixel) {
+            for (int channel = 0; channel < channels; ++channel) {
+                const unsigned char value   = pixels[pixel * channels + channel];
+                linear[pixel * 4 + channel] = gamma(channel) ? decode[value] : value / 255.0f;
+            }
+        }
+
+        int level_width  = width;
+        int level_height = height;
+        while (level_width > 1 || level_height > 1) {
+            linear       = detail::halve(linear, level_width, level_height);
+            level_width  = std::max(1, level_width / 2);
+            level_height = std::max(1, level_height / 2);
+
+            const size_t level_count = static_cast<size_t>(level_width) * level_height;
+            std::vector<unsigned char> level(level_count * channels);
+            for (size_t pixel = 0; pixel < level_count; ++pixel) {
+                for (int channel = 0; channel < channels; ++channel) {
+                    const float value = std::min(1.0f, std::max(0.0f, linear[pixel * 4 + channel]));
+
+                    level[pixel * channels + channel] = gamma(channel)
+                                                            ? encode[static_cast<size_t>(value * 4095.0f + 0.5f)]
+                                                            : static_cast<unsigned char>(value * 255.0f + 0.5f);
+                }
+            }
+            levels.push_back(std::move(level));
+        }
+        return levels;
+    }
+
+    // Save an image and its mip chain to a cache file that load_mip_chain can read back
+    // Returns false if the file couldn't be written
+    // ---------------------------------------------------------------------------------
+    inline bool save_mip_chain(const std::string& path,
+                               const int& width,
+                               const int& height,
+                               const int& channels,
+                               const unsigned char* pixels,
+                               const std::vector<std::vector<unsigned char>>& mipmaps) {
+        std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file.good()) {
+            return false;
+        }
+        // Magic number, then the size of the image and the number of levels below level 0
+        const uint32_t header[5] = {0x4350494D,
+                                    static_cast<uint32_t>(width),
+                                    static_cast<uint32_t>(height),
+                                    static_cast<uint32_t>(channels),
+                                    static_cast<uint32_t>(mipmaps.size())};
+        file.write(reinterpret_cast<const char*>(header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(pixels), static_cast<size_t>(width) * height * channels);
+        for (const std::vector<unsigned char>& level : mipmaps) {
+            file.write(reinterpret_cast<const char*>(level.data()), level.size());
+        }
+        return file.good();
+    }
+
+    // Load an image and its mip chain from a cache file written by save_mip_chain
+    // Returns false if the file doesn't exist, isn't a complete mip chain, or has an empty image or one that is
+    // bigger than max_size, so a damaged file is treated as a cache miss instead of allocating its header's size
+    // ------------------------------------------------------------------------------------------------------------
+    inline bool load_mip_chain(const std::string& path,
+                               const int& max_size,
+                               int& width,
+                               int& height,
+                               int& channels,
+                               std::vector<unsigned char>& pixels,
+                               std::vector<std::vector<unsigned char>>& mipmaps) {
+        std::ifstream file(path, std::ios::in | std::ios::binary);
+        uint32_t header[5] = {0};
+        if (!file.read(reinterpret_cast<char*>(header), sizeof(header)) || header[0] != 0x4350494D
+            || header[1] == 0 || header[2] == 0 || header[1] > static_cast<uint32_t>(std::max(0, max_size))
+            || header[2] > static_cast<uint32_t>(std::max(0, max_size)) || header[3] < 1 || header[3] > 4
+            || static_cast<int>(header[4]) != mip_level_count(header[1], header[2]) - 1) {
+            return false;
+        }
+
+        std::vector<unsigned char> base(static_cast<size_t>(header[1]) * header[2] * header[3]);
+        std::vector<std::vector<unsigned char>> levels;
+        file.read(reinterpret_cast<char*>(base.data()), base.size());
+        for (int level = 1; level <= static_cast<int>(header[4]); ++level) {
+            const size_t level_width  = std::max<uint32_t>(1, header[1] >> level);
+            const size_t level_height = std::max<uint32_t>(1, header[2] >> level);
+            levels.emplace_back(level_width * level_height * header[3]);
+            file.read(reinterpret_cast<char*>(levels.back().data()), levels.back().size());
+        }
+        if (!file.good()) {
+            return false;
+        }
+
+        width    = static_cast<int>(header[1]);
+        height   = static_cast<int>(header[2]);
+        channels = static_cast<int>(header[3]);
+        pixels   = std::move(base);
+        mipmaps  = std::move(levels);
+        return true;
+    }
+}  // namespace gl
+}  // namespace utility
+
+
+#endif  // UTILITY_MIPMAP_HPP
@@ -1,8 +1,14 @@
 #ifndef UTILITY_MODEL_HPP
 #define UTILITY_MODEL_HPP
 
+#include <algorithm>
+#include <cstdint>
+#include <future>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <string>
+#include <tuple>
 #include <vector>
 
 // For model loading
@@ -29,14 +35,139 @@
 namespace utility {
 namespace model {
     struct Model {
-        Model(const std::string& model) {
+        // Load a model from a file
+        // The textures are decoded on worker threads and uploaded by finish_loading (or the first render), so other
+        // startup work like compiling the model's shaders (see material_defines) can overlap with them
+        // ------------------------------------------------------------------------------------------------------------
+        // model: Path to the model file
+        // compress_vertices: Store vertices in half the space (see Mesh::compress), the shaders then need the defines
+        //                    from material_defines to decode them
+        // batch_meshes: Put the vertices of every mesh in one set of buffers and draw them from a command list, so
+        //               the model is drawn with one vertex array bind and as few draw calls as the materials allow
+        // pool: Where to put the vertices and indices of a batched model, so that many models share a few buffers
+        //       If this is nullptr the model creates its own buffers. The pool has to outlive the model
+        // use_texture_arrays: Stack material maps with the same size and format into the layers of texture arrays, so
+        //                     the whole model is drawn with one set of texture bindings. The shaders then need the
+        //                     defines from material_defines to sample them
+        // cpu_residency: Whether the meshes and textures free their CPU copies of vertices, indices, and pixels once
+        //                they have been uploaded (the default), or keep them for picking and collision
+        // ------------------------------------------------------------------------------------------------------------
+        Model(const std::string& model,
+              const bool& compress_vertices               = false,
+              const bool& batch_meshes                    = false,
+              utility::gl::buffer_pool* pool              = nullptr,
+              const bool& use_texture_arrays              = false,
+              const utility::gl::residency& cpu_residency = utility::gl::residency::release)
+            : compress_vertices(compress_vertices)
+            , batch_meshes(batch_meshes)
+            , use_texture_arrays(use_texture_arrays)
+            , cpu_residency(cpu_residency)
+            , pooled(pool) {
             load_model(model);
+            if (batch_meshes) {
+                setup_batches();
+            }
+        }
+        Model(const Model& model) = delete;
+        Model& operator=(const Model& model) = delete;
+        // The ranges of a pool move with the model, and are given back to the pool when it is destroyed
+        Model(Model&& model) = default;
+        Model& operator=(Model&& model) = default;
+
+        // Wait for the textures of the model and upload them, render calls this if it hasn't been called yet
+        // -------------------------------------------------------------------------------------------------
+        void finish_loading() {
+            if (textures_uploaded) {
+                return;
+            }
+            // Maps that go into texture arrays were only decoded, so they are uploaded once as layers
+            if (use_texture_arrays) {
+                setup_texture_arrays();
+            }
+            else {
+                utility::gl::get_texture_cache().finish();
+            }
+            textures_uploaded = true;
         }
 
         void render(utility::gl::shader_program& program) {
-            for (auto& mesh : meshes) {
-                mesh.render(program);
+            finish_loading();
+            bind_texture_arrays(program);
+            if (!batch_meshes) {
+                for (auto& mesh : meshes) {
+                    mesh.render(program);
+                }
+                return;
+            }
+
+            // Consecutive meshes with the same material are drawn with a single submission
+            VAO.bind();
+            for (const Batch& batch : batches) {
+                meshes[batch.mesh].bind_material(program);
+                commands.draw(GL_TRIANGLES, GL_UNSIGNED_SHORT, batch.first, batch.count);
+            }
+            VAO.unbind();
+
+            // Always good practice to set everything back to defaults once configured
+            utility::gl::get_state().active_texture(GL_TEXTURE0);
+        }
+
+        // Update the draw commands after the pool that the model was loaded into has been defragmented
+        // ---------------------------------------------------------------------------------------------
+        void relocate(const std::vector<utility::gl::buffer_pool::relocation>& moved) {
+            if (!pooled.allocated) {
+                return;
+            }
+            bool changed = false;
+            for (const auto& move : moved) {
+                for (utility::gl::buffer_pool::allocation* range : {&pooled.vertices, &pooled.indices}) {
+                    if (range->arena == move.from.arena && range->offset == move.from.offset) {
+                        *range  = move.to;
+                        changed = true;
+                    }
+                }
+            }
+            if (changed) {
+                upload_commands();
+            }
+        }
+
+        // Preprocessor defines that specialise the model shaders for the materials and vertex format of this model
+        // The map arrays are sized for the mesh with the most maps, and if every mesh has the same number of maps the
+        // shader can use a constant loop count (EXACT_MAP_COUNTS)
+        // These are available as soon as the model is constructed. Until finish_loading has stacked the maps into
+        // texture arrays the number of arrays is an upper bound (one for every image), which works with any stacking
+        // -----------------------------------------------------------------------------------------------------------
+        utility::gl::shader_defines material_defines() const {
+            size_t diffuse_maps  = 0;
+            size_t specular_maps = 0;
+            bool exact           = true;
+            for (size_t i = 0; i < meshes.size(); ++i) {
+                const size_t diffuse  = map_count(i, utility::gl::TextureStyle::TEXTURE_DIFFUSE);
+                const size_t specular = map_count(i, utility::gl::TextureStyle::TEXTURE_SPECULAR);
+                if (i > 0 && (diffuse != diffuse_maps || specular != specular_maps)) {
+                    exact = false;
+                }
+                diffuse_maps  = std::max(diffuse_maps, diffuse);
+                specular_maps = std::max(specular_maps, specular);
+            }
+
+            utility::gl::shader_defines defines;
+            defines["NR_DIFFUSE_MAPS"]  = std::to_string(diffuse_maps);
+            defines["NR_SPECULAR_MAPS"] = std::to_string(specular_maps);
+            if (exact) {
+                defines["EXACT_MAP_COUNTS"] = "";
+            }
+            if (compress_vertices) {
+                defines["COMPRESSED_VERTICES"] = "";
+            }
+            const size_t arrays =
+                textures_uploaded ? texture_arrays.size() : std::min(pending_maps.size(), max_texture_arrays());
+            if (arrays > 0) {
+                defines["TEXTURE_ARRAYS"]    = "";
+                defines["NR_TEXTURE_ARRAYS"] = std::to_string(arrays);
             }
+            return defines;
         }
 
     private:
@@ -56,6 +187,7 @@ namespace model {
             // Store parent directory of the model
             directory = model.substr(0, model.find_last_of('/'));
 
+            // The textures are decoded in parallel while the meshes are processed, see finish_loading
             process_node(scene->mRootNode, scene);
         }
 
@@ -75,6 +207,9 @@ namespace model {
 
         void process_mesh(aiMesh* mesh, const aiScene* scene) {
             meshes.emplace_back();
+            if (use_texture_arrays) {
+                mesh_maps.emplace_back();
+            }
 
             for (size_t i = 0; i < mesh->mNumVertices; ++i) {
                 // process vertex positions, normals and texture coordinates
@@ -116,28 +251,373 @@ namespace model {
                               meshes.back().textures);
             }
 
-            meshes.back().setup_mesh();
+            meshes.back().geometry_residency = cpu_residency;
+            // Batched meshes are compressed together once the whole model has been loaded (see setup_batches)
+            if (compress_vertices && !batch_meshes) {
+                meshes.back().compress();
+            }
+            // Batched meshes are uploaded together once the whole model has been loaded (see setup_batches)
+            if (batch_meshes) {
+                meshes.back().prepare_draws();
+            }
+            else {
+                meshes.back().setup_mesh();
+            }
+        }
+
+        // Copy the vertices and indices of every mesh into the shared buffers and build the draw commands
+        // Each mesh keeps its own 16-bit indices, the commands offset them to where its vertices ended up
+        // -----------------------------------------------------------------------------------------------
+        void setup_batches() {
+            if (compress_vertices) {
+                compress_meshes();
+            }
+
+            std::vector<utility::mesh::Vertex> vertices;
+            std::vector<utility::mesh::CompressedVertex> compressed_vertices;
+            std::vector<uint16_t> indices;
+
+            for (size_t i = 0; i < meshes.size(); ++i) {
+                utility::mesh::Mesh& mesh = meshes[i];
+                const size_t base_vertex  = compress_vertices ? compressed_vertices.size() : vertices.size();
+                const size_t first_index  = indices.size();
+
+                // Start a new batch unless the previous mesh used the same material
+                if (batches.empty() || !meshes[batches.back().mesh].same_material(mesh)) {
+                    batches.push_back(Batch{i, draw_commands.size(), 0});
+                }
+                for (const utility::mesh::DrawRange& range : mesh.draw_ranges()) {
+                    utility::gl::draw_elements_command command;
+                    command.count       = static_cast<uint32_t>(range.count);
+                    command.first_index = static_cast<uint32_t>(first_index + range.first);
+                    command.base_vertex = static_cast<int32_t>(base_vertex + range.base_vertex);
+                    draw_commands.push_back(command);
+                    ++batches.back().count;
+                }
+
+                vertices.insert(vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+                compressed_vertices.insert(
+                    compressed_vertices.end(), mesh.compressed_vertices.begin(), mesh.compressed_vertices.end());
+                indices.insert(indices.end(), mesh.indices.begin(), mesh.indices.end());
+            }
+
+            utility::gl::state& gl_state = utility::gl::get_state();
+            VAO.bind();
+            if (pooled.pool != nullptr) {
+                // Vertex ranges are aligned to the vertex size so that their offset is a whole number of vertices
+                utility::gl::buffer_pool& pool = *pooled.pool;
+                if (compress_vertices) {
+                    pooled.vertices = pool.allocate(compressed_vertices.size() * vertex_size(), vertex_size());
+                    pool.update(pooled.vertices, compressed_vertices);
+                }
+                else {
+                    pooled.vertices = pool.allocate(vertices.size() * vertex_size(), vertex_size());
+                    pool.update(pooled.vertices, vertices);
+                }
+                pooled.indices   = pool.allocate(indices.size() * sizeof(uint16_t), sizeof(uint16_t));
+                pooled.allocated = true;
+                pool.update(pooled.indices, indices);
+                gl_state.bind_buffer(GL_ARRAY_BUFFER, pool.buffer(pooled.vertices));
+                gl_state.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, pool.buffer(pooled.indices));
+            }
+            else {
+                // Only models that aren't in a pool have buffers of their own
+                VBO.reset(new utility::gl::vertex_buffer());
+                EBO.reset(new utility::gl::element_buffer());
+                VBO->bind();
+                EBO->bind();
+                if (compress_vertices) {
+                    VBO->copy_data(compressed_vertices, GL_STATIC_DRAW);
+                }
+                else {
+                    VBO->copy_data(vertices, GL_STATIC_DRAW);
+                }
+                EBO->copy_data(indices, GL_STATIC_DRAW);
+            }
+            if (compress_vertices) {
+                VAO.add_layout<utility::mesh::CompressedVertexLayout>();
+            }
+            else {
+                VAO.add_layout<utility::mesh::VertexLayout>();
+            }
+            VAO.unbind();
+            gl_state.bind_buffer(GL_ARRAY_BUFFER, 0);
+            gl_state.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+            upload_commands();
+
+            // The meshes were never set up on their own, so they still have their copies of the data
+            if (cpu_residency == utility::gl::residency::release) {
+                for (utility::mesh::Mesh& mesh : meshes) {
+                    mesh.release_geometry();
+                }
+            }
         }
 
+        // Compress every mesh against the bounding box of the whole model, so that every mesh has the same position
+        // scale and offset and meshes with the same maps can still be batched together
+        // ---------------------------------------------------------------------------------------------------------
+        void compress_meshes() {
+            bool empty     = true;
+            glm::vec3 low  = glm::vec3(0.0f);
+            glm::vec3 high = glm::vec3(0.0f);
+            for (const utility::mesh::Mesh& mesh : meshes) {
+                for (const utility::mesh::Vertex& vertex : mesh.vertices) {
+                    low   = empty ? vertex.position : glm::min(low, vertex.position);
+                    high  = empty ? vertex.position : glm::max(high, vertex.position);
+                    empty = false;
+                }
+            }
+            for (utility::mesh::Mesh& mesh : meshes) {
+                mesh.compress(low, high);
+            }
+        }
+
+        // Copy the draw commands to the GPU, offset to where the model's data is in the pool
+        // ----------------------------------------------------------------------------------
+        void upload_commands() {
+            size_t base_vertex = 0;
+            size_t first_index = 0;
+            if (pooled.allocated) {
+                base_vertex = pooled.vertices.offset / vertex_size();
+                first_index = pooled.indices.offset / sizeof(uint16_t);
+            }
+
+            std::vector<utility::gl::draw_elements_command> offset_commands = draw_commands;
+            for (utility::gl::draw_elements_command& command : offset_commands) {
+                command.first_index += static_cast<uint32_t>(first_index);
+                command.base_vertex += static_cast<int32_t>(base_vertex);
+            }
+            commands.copy_data(offset_commands, GL_STATIC_DRAW);
+        }
+
+        // Stack the material maps of every mesh into texture arrays, one array for each size and format of map (more
+        // if there are more maps of one size than an array can have layers), and point the meshes at their layers
+        // The maps were only decoded (see load_textures), so each one is uploaded once, as a layer of its array
+        // ------------------------------------------------------------------------------------------------------------
+        void setup_texture_arrays() {
+            int max_layers = 0;
+            glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+            utility::gl::check_gl_error("Failed to get the maximum number of texture array layers");
+
+            std::vector<utility::gl::image_data> images;
+            images.reserve(pending_maps.size());
+            for (PendingMap& map : pending_maps) {
+                images.push_back(map.decoded.get());
+            }
+
+            // Width, height, compressed format, channels, and stored compressed and precomputed mip levels
+            using key = std::tuple<int, int, unsigned int, int, size_t, size_t>;
+            std::map<key, size_t> open_arrays;
+            std::vector<std::vector<size_t>> layers;
+            std::vector<glm::ivec2> placement(images.size());
+            for (size_t i = 0; i < images.size(); ++i) {
+                const utility::gl::image_data& image = images[i];
+                // Start a new array for the first map of its kind, or when the last array of its kind is full
+                const key id(image.width,
+                             image.height,
+                             image.compressed.format,
+                             image.channels,
+                             image.compressed.levels.size(),
+                             image.mipmaps.size());
+                auto array = open_arrays.find(id);
+                if (array == open_arrays.end() || layers[array->second].size() >= static_cast<size_t>(max_layers)) {
+                    open_arrays[id] = layers.size();
+                    layers.emplace_back();
+                }
+                const size_t index = open_arrays[id];
+                placement[i]       = glm::ivec2(static_cast<int>(index), static_cast<int>(layers[index].size()));
+                layers[index].push_back(i);
+            }
+
+            if (layers.size() > max_texture_arrays()) {
+                utility::gl::throw_gl_error(GL_INVALID_OPERATION,
+                                            fmt::format("Model needs {} texture arrays, at most {} are supported",
+                                                        layers.size(),
+                                                        max_texture_arrays()));
+            }
+            texture_arrays.reserve(layers.size());
+            for (const std::vector<size_t>& members : layers) {
+                std::vector<utility::gl::image_data> stacked;
+                stacked.reserve(members.size());
+                for (const size_t& member : members) {
+                    stacked.push_back(std::move(images[member]));
+                }
+                texture_array_units.push_back(static_cast<int>(texture_arrays.size()));
+                texture_arrays.emplace_back(utility::gl::TextureType::TEXTURE_2D_ARRAY);
+                texture_arrays.back().set_residency(cpu_residency);
+                texture_arrays.back().load_layers(std::move(stacked));
+                texture_arrays.back().generate(0);
+                utility::gl::apply_sampler(texture_arrays.back(), utility::gl::sampler_settings());
+            }
+
+            for (size_t i = 0; i < meshes.size(); ++i) {
+                std::vector<glm::ivec2> diffuse;
+                std::vector<glm::ivec2> specular;
+                for (const size_t& map : mesh_maps[i]) {
+                    if (pending_maps[map].style == utility::gl::TextureStyle::TEXTURE_DIFFUSE) {
+                        diffuse.push_back(placement[map]);
+                    }
+                    else {
+                        specular.push_back(placement[map]);
+                    }
+                }
+                meshes[i].use_texture_layers(std::move(diffuse), std::move(specular));
+            }
+
+            pending_maps.clear();
+            pending_map_index.clear();
+            mesh_maps.clear();
+        }
+
+        // Bind every texture array to its own unit and point the textureArrays samplers at them
+        // -------------------------------------------------------------------------------------
+        void bind_texture_arrays(utility::gl::shader_program& program) {
+            if (texture_arrays.empty()) {
+                return;
+            }
+            if (texture_array_program != static_cast<unsigned int>(program)) {
+                texture_array_uniform = program.get_uniform<int>("textureArrays");
+                texture_array_program = program;
+            }
+            for (size_t i = 0; i < texture_arrays.size(); ++i) {
+                texture_arrays[i].bind(GL_TEXTURE0 + static_cast<unsigned int>(i));
+            }
+            program.set_uniform(texture_array_uniform, texture_array_units);
+        }
+
+        // The shaders pick an array with one branch per array (see sampleTextureArray in assimp.frag), and every array
+        // is bound to its own unit, so a model is limited to the 16 units that every GL 3.3 driver has
+        static size_t max_texture_arrays() {
+            return 16;
+        }
+
+        // Number of maps of one style that a mesh has, counting maps that are still waiting for their texture array
+        size_t map_count(const size_t& mesh, const utility::gl::TextureStyle::Value& style) const {
+            if (mesh >= mesh_maps.size()) {
+                return meshes[mesh].texture_count(style);
+            }
+            return std::count_if(mesh_maps[mesh].begin(), mesh_maps[mesh].end(), [this, &style](const size_t& map) {
+                return pending_maps[map].style == style;
+            });
+        }
+
+        // Size in bytes of one vertex in the model's vertex buffer
+        size_t vertex_size() const {
+            return compress_vertices ? sizeof(utility::mesh::CompressedVertex) : sizeof(utility::mesh::Vertex);
+        }
+
+        // Get the textures that a material uses from the texture cache, images that are already loaded by this or any
+        // other model are shared instead of being loaded again. New images are decoded on worker threads and are
+        // uploaded by finish_loading. Maps that are going into texture arrays are only decoded, once for each
+        // image in the model, and are added to the maps of the last mesh instead (see setup_texture_arrays)
+        // ------------------------------------------------------------------------------------------------------------
         void load_textures(aiMaterial* material,
                            const aiTextureType& type,
                            const utility::gl::TextureStyle& texture_style,
-                           std::vector<utility::gl::texture>& textures) {
+                           std::vector<std::shared_ptr<utility::gl::texture>>& textures) {
+            utility::gl::texture_cache& cache = utility::gl::get_texture_cache();
             for (size_t i = 0; i < material->GetTextureCount(type); ++i) {
                 aiString str;
                 material->GetTexture(type, i, &str);
-                textures.emplace_back(
-                    fmt::format("{}/{}", directory, str.C_Str()), utility::gl::TextureType::TEXTURE_2D, texture_style);
-                textures.back().bind(GL_TEXTURE0 + i);
-                textures.back().generate(0);
-                textures.back().generate_mipmap();
-                textures.back().texture_wrap(GL_REPEAT, GL_REPEAT);
-                textures.back().texture_filter(GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR);
+                const std::string path = fmt::format("{}/{}", directory, str.C_Str());
+                if (!use_texture_arrays) {
+                    textures.push_back(
+                        cache.load_async(path, texture_style, utility::gl::sampler_settings(), cpu_residency));
+                    continue;
+                }
+
+                const std::string image = utility::gl::texture_cache::normalise_path(path);
+                auto pending            = pending_map_index.find(image);
+                if (pending == pending_map_index.end()) {
+                    pending = pending_map_index.emplace(image, pending_maps.size()).first;
+                    pending_maps.push_back(PendingMap{texture_style, cache.decode_async(image, texture_style)});
+                }
+                mesh_maps.back().push_back(pending->second);
             }
         }
 
         std::vector<utility::mesh::Mesh> meshes;
         std::string directory;
+        bool compress_vertices;
+        bool batch_meshes;
+        bool use_texture_arrays;
+        utility::gl::residency cpu_residency;
+        // Whether finish_loading has uploaded the textures
+        bool textures_uploaded = false;
+
+        // Maps that are going into texture arrays while they are decoded, see load_textures
+        struct PendingMap {
+            utility::gl::TextureStyle style;
+            std::future<utility::gl::image_data> decoded;
+        };
+        std::vector<PendingMap> pending_maps;
+        // Normalised path -> index in pending_maps, and the indices of the maps of each mesh
+        std::map<std::string, size_t> pending_map_index;
+        std::vector<std::vector<size_t>> mesh_maps;
+
+        // Material maps stacked by size and format, see setup_texture_arrays
+        std::vector<utility::gl::texture> texture_arrays;
+        // Array i is bound to unit i
+        std::vector<int> texture_array_units;
+        unsigned int texture_array_program = 0;
+        utility::gl::uniform<int> texture_array_uniform;
+
+        // A run of draw commands for consecutive meshes that share a material, drawn with the material of mesh
+        struct Batch {
+            size_t mesh;
+            size_t first;
+            size_t count;
+        };
+
+        // Where the model's data is when it is loaded into a pool, the ranges are given back when the model is
+        // destroyed. Moving the ranges to another model leaves nothing to give back here
+        struct PoolRanges {
+            explicit PoolRanges(utility::gl::buffer_pool* pool) : pool(pool) {}
+            PoolRanges(const PoolRanges& ranges) = delete;
+            PoolRanges(PoolRanges&& ranges) noexcept
+                : pool(ranges.pool)
+                , vertices(ranges.vertices)
+                , indices(ranges.indices)
+                , allocated(std::exchange(ranges.allocated, false)) {}
+            ~PoolRanges() {
+                release();
+            }
+            PoolRanges& operator=(const PoolRanges& ranges) = delete;
+            PoolRanges& operator=(PoolRanges&& ranges) noexcept {
+                if (this != &ranges) {
+                    release();
+                    pool      = ranges.pool;
+                    vertices  = ranges.vertices;
+                    indices   = ranges.indices;
+                    allocated = std::exchange(ranges.allocated, false);
+                }
+                return *this;
+            }
+
+            void release() {
+                if (allocated) {
+                    pool->free(vertices);
+                    pool->free(indices);
+                    allocated = false;
+                }
+            }
+
+            utility::gl::buffer_pool* pool;
+            utility::gl::buffer_pool::allocation vertices;
+            utility::gl::buffer_pool::allocation indices;
+            bool allocated = false;
+        };
+        PoolRanges pooled;
+
+        // Shared buffers for batched meshes, the vertex and element buffers are only created if there is no pool
+        utility::gl::vertex_array VAO;
+        std::unique_ptr<utility::gl::vertex_buffer> VBO;
+        std::unique_ptr<utility::gl::element_buffer> EBO;
+        utility::gl::indirect_buffer commands;
+        std::vector<Batch> batches;
+        // Draw commands relative to the start of the model's vertices and indices
+        std::vector<utility::gl::draw_elements_command> draw_commands;
     };
 }  // namespace model
 }  // namespace utility
@@ -18,6 +18,7 @@
 #include "AL/al.h"
 #include "AL/alc.h"
 #include "sndfile.h"
+#include "utility/error_policy.hpp"
 #include "utility/openal_error_category.hpp"
 #include "utility/sndfile_error_category.hpp"
 
@@ -33,6 +34,33 @@ namespace al {
         }
     }
 
+    // Check for an OpenAL error after a wrapped call, according to the build's error policy (see error_policy.hpp)
+    // The message is only formatted if an error actually occurred, and when checking is disabled this does nothing
+    // Example: check_al_error("Failed to set gain for source {}", source);
+    // -------------------------------------------------------------------------------------------------------------
+    template <typename... Args>
+    inline void check_al_error(const char* format, const Args&... args) {
+#if UTILITY_AL_CHECK_ERRORS
+        const int code = alGetError();
+        if (code != AL_NO_ERROR) {
+            throw std::system_error(
+                code, openal_error_category(), fmt::vformat(format, fmt::make_format_args(args...)));
+        }
+#endif
+    }
+    // Same as above, but for errors from the ALC device functions
+    // -----------------------------------------------------------
+    template <typename... Args>
+    inline void check_alc_error(ALCdevice* device, const char* format, const Args&... args) {
+#if UTILITY_AL_CHECK_ERRORS
+        const int code = alcGetError(device);
+        if (code != ALC_NO_ERROR) {
+            throw std::system_error(
+                code, openal_error_category(), fmt::vformat(format, fmt::make_format_args(args...)));
+        }
+#endif
+    }
+
     // A wrapper for throwing exceptions based on SndFile error codes
     // If no error is detector (code == SF_ERR_NO_ERROR) then nothing is thrown
     // Example: throw_sf_error(sf_error(), "Error doing something important");
@@ -77,19 +105,19 @@ namespace al {
 
             // Configure the source
             alGenSources(1, &audio_source);
-            throw_al_error(alGetError(), "Failed to create an audio source");
+            check_al_error("Failed to create an audio source");
             alSourcef(audio_source, AL_PITCH, 1.0f);
-            throw_al_error(alGetError(), "Failed to set source pitch");
+            check_al_error("Failed to set source pitch");
             alSourcef(audio_source, AL_GAIN, 1.0f);
-            throw_al_error(alGetError(), "Failed to set source gain");
+            check_al_error("Failed to set source gain");
             alSource3f(audio_source, AL_VELOCITY, 0.0f, 0.0f, 0.0f);
-            throw_al_error(alGetError(), "Failed to set source velocity");
+            check_al_error("Failed to set source velocity");
             alSourcei(audio_source, AL_LOOPING, AL_FALSE);
             set_source_position(position);
 
             // Generate a buffer
             alGenBuffers(1, &audio_buffer);
-            throw_al_error(alGetError(), "Failed to create an audio buffer");
+            check_al_error("Failed to create an audio buffer");
         }
 
         ~OpenAL() {
@@ -102,17 +130,17 @@ namespace al {
 
         void set_listener_position(const glm::vec3& position, const glm::vec3& velocity, const glm::vec3& up) {
             alListener3f(AL_POSITION, position.x, position.y, position.z);
-            throw_al_error(alGetError(), "Failed to set listener position");
+            check_al_error("Failed to set listener position");
             alListener3f(AL_VELOCITY, velocity.x, velocity.y, velocity.z);
-            throw_al_error(alGetError(), "Failed to set listener velocity");
+            check_al_error("Failed to set listener velocity");
             const std::array<float, 6> orientation = {position.x, position.y, position.z, up.x, up.y, up.z};
             alListenerfv(AL_ORIENTATION, orientation.data());
-            throw_al_error(alGetError(), "Failed to set listener orientation");
+            check_al_error("Failed to set listener orientation");
         }
 
         void set_source_position(const glm::vec3& position) {
             alSource3f(audio_source, AL_POSITION, position.x, position.y, position.z);
-            throw_al_error(alGetError(), "Failed to set source position");
+            check_al_error("Failed to set source position");
         }
 
         void load_audio(const std::string& audio_file) {
@@ -140,7 +168,7 @@ namespace al {
                          data.data(),
                          data.size() * sizeof(uint16_t),
                          info.samplerate);
-            throw_al_error(alGetError(), "Failed to load audio data");
+            check_al_error("Failed to load audio data");
 
             // Assign the audio buffer to the audio source
             alSourcei(audio_source, AL_BUFFER, audio_buffer);
@@ -154,7 +182,7 @@ namespace al {
                 throw_al_error(alGetError(), "Failed to make the audio context current");
             }
             alSourcePlay(audio_source);
-            throw_al_error(alGetError(), "Failed to play audio source");
+            check_al_error("Failed to play audio source");
         }
 
         void print_device_list() {
@@ -189,7 +217,7 @@ namespace al {
                 if (alcIsExtensionPresent(audio_device, "ALC_ENUMERATE_ALL_EXT") != AL_FALSE) {
                     devname = alcGetString(audio_device, ALC_ALL_DEVICES_SPECIFIER);
                 }
-                throw_al_error(alcGetError(audio_device), "Failed to get device name");
+                check_alc_error(audio_device, "Failed to get device name");
                 if (!devname) {
                     devname = alcGetString(audio_device, ALC_DEVICE_SPECIFIER);
                 }
@@ -197,12 +225,12 @@ namespace al {
             }
             alcGetIntegerv(audio_device, ALC_MAJOR_VERSION, 1, &major);
             alcGetIntegerv(audio_device, ALC_MINOR_VERSION, 1, &minor);
-            throw_al_error(alcGetError(audio_device), "Failed to get ALC version information");
+            check_alc_error(audio_device, "Failed to get ALC version information");
             std::cout << fmt::format("ALC version: {}.{}", major, minor) << std::endl;
             if (audio_device) {
                 std::cout << fmt::format("ALC Extensions:") << std::endl;
                 print_list(alcGetString(audio_device, ALC_EXTENSIONS), ' ');
-                throw_al_error(alcGetError(audio_device), "Failed to get extensions");
+                check_alc_error(audio_device, "Failed to get extensions");
             }
         }
 
@@ -0,0 +1,141 @@
+#ifndef UTILITY_OPENGL_DELETION_QUEUE_HPP
+#define UTILITY_OPENGL_DELETION_QUEUE_HPP
+
+#include <cstddef>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// clang-format off
+#include "glad/glad.h"
+// clang-format on
+
+#include "utility/opengl_state.hpp"
+
+namespace utility {
+namespace gl {
+    // Names of OpenGL objects that are waiting to be deleted
+    // The wrappers in opengl_utils.hpp don't delete their objects in their destructors, they hand the names to this
+    // queue instead. That way destructors never make GL calls, so they can't stall or throw, and they can run on
+    // threads that don't have the context current. Call flush from the thread that owns the context once per frame
+    // (and once more before the context is destroyed) to delete everything with one glDelete* call per object type
+    // -------------------------------------------------------------------------------------------------------------
+    struct deletion_queue {
+        // Queue a name for deletion, these are safe to call from any thread
+        // -----------------------------------------------------------------
+        void delete_program(const unsigned int& program) {
+            push(programs, program);
+        }
+        void delete_shader(const unsigned int& shader) {
+            push(shaders, shader);
+        }
+        void delete_vertex_array(const unsigned int& vao) {
+            push(vertex_arrays, vao);
+        }
+        void delete_buffer(const unsigned int& buffer) {
+            push(buffers, buffer);
+        }
+        void delete_texture(const unsigned int& texture) {
+            push(textures, texture);
+        }
+        void delete_sync(GLsync sync) {
+            std::lock_guard<std::mutex> lock(mutex);
+            syncs.push_back(sync);
+        }
+
+        // Delete everything that has been queued
+        // Must be called from the thread that has the context current
+        // Returns the number of objects that were deleted
+        // -----------------------------------------------------------
+        size_t flush() {
+            std::vector<unsigned int> flush_programs;
+            std::vector<unsigned int> flush_shaders;
+            std::vector<unsigned int> flush_vertex_arrays;
+            std::vector<unsigned int> flush_buffers;
+            std::vector<unsigned int> flush_textures;
+            std::vector<GLsync> flush_syncs;
+            {
+                // Take the queues so that other threads can keep queueing while we delete
+                std::lock_guard<std::mutex> lock(mutex);
+                flush_programs.swap(programs);
+                flush_shaders.swap(shaders);
+                flush_vertex_arrays.swap(vertex_arrays);
+                flush_buffers.swap(buffers);
+                flush_textures.swap(textures);
+                flush_syncs.swap(syncs);
+            }
+
+            // The binding cache has to forget the names before OpenGL can hand them out again
+            state& gl_state = get_state();
+            for (const unsigned int& program : flush_programs) {
+                glDeleteProgram(program);
+                gl_state.forget_program(program);
+            }
+            for (const unsigned int& shader : flush_shaders) {
+                glDeleteShader(shader);
+            }
+            if (!flush_vertex_arrays.empty()) {
+                glDeleteVertexArrays(static_cast<GLsizei>(flush_vertex_arrays.size()), flush_vertex_arrays.data());
+                for (const unsigned int& vao : flush_vertex_arrays) {
+                    gl_state.forget_vertex_array(vao);
+                }
+            }
+            if (!flush_buffers.empty()) {
+                glDeleteBuffers(static_cast<GLsizei>(flush_buffers.size()), flush_buffers.data());
+                for (const unsigned int& buffer : flush_buffers) {
+                    gl_state.forget_buffer(buffer);
+                }
+            }
+            if (!flush_textures.empty()) {
+                glDeleteTextures(static_cast<GLsizei>(flush_textures.size()), flush_textures.data());
+                for (const unsigned int& texture : flush_textures) {
+                    gl_state.forget_texture(texture);
+                }
+            }
+            for (GLsync sync : flush_syncs) {
+                glDeleteSync(sync);
+            }
+
+            return flush_programs.size() + flush_shaders.size() + flush_vertex_arrays.size() + flush_buffers.size()
+                   + flush_textures.size() + flush_syncs.size();
+        }
+
+        // Number of objects waiting to be deleted
+        // ---------------------------------------
+        size_t pending() const {
+            std::lock_guard<std::mutex> lock(mutex);
+            return programs.size() + shaders.size() + vertex_arrays.size() + buffers.size() + textures.size()
+                   + syncs.size();
+        }
+
+    private:
+        void push(std::vector<unsigned int>& queue, const unsigned int& name) {
+            // Name 0 is never a real object, it is what moved-from wrappers are left with
+            if (name == 0) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(name);
+        }
+
+        mutable std::mutex mutex;
+        std::vector<unsigned int> programs;
+        std::vector<unsigned int> shaders;
+        std::vector<unsigned int> vertex_arrays;
+        std::vector<unsigned int> buffers;
+        std::vector<unsigned int> textures;
+        std::vector<GLsync> syncs;
+    };
+
+    // Get the deletion queue for the current context
+    // These examples only ever create a single context, so there is only one queue
+    // ----------------------------------------------------------------------------
+    inline deletion_queue& get_deletion_queue() {
+        static deletion_queue instance;
+        return instance;
+    }
+}  // namespace gl
+}  // namespace utility
+
+
+#endif  // UTILITY_OPENGL_DELETION_QUEUE_HPP
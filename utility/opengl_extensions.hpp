@@ -0,0 +1,260 @@
+#ifndef UTILITY_OPENGL_EXTENSIONS_HPP
+#define UTILITY_OPENGL_EXTENSIONS_HPP
+
+#include <iostream>
+#include <set>
+#include <string>
+
+// For python style string formatting
+#include "fmt/format.h"
+
+// clang-format off
+#include "glad/glad.h"
+// clang-format on
+
+#include "utility/error_policy.hpp"
+
+// Enums from newer OpenGL versions that the glad 3.3 core headers don't define
+// ----------------------------------------------------------------------------
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT3_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT3_EXT 0x83F2
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_DEBUG_OUTPUT
+#define GL_DEBUG_OUTPUT 0x92E0
+#endif
+#ifndef GL_DEBUG_TYPE_ERROR
+#define GL_DEBUG_TYPE_ERROR 0x824C
+#endif
+#ifndef GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR
+#define GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR 0x824D
+#endif
+#ifndef GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR
+#define GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR 0x824E
+#endif
+#ifndef GL_DEBUG_TYPE_PORTABILITY
+#define GL_DEBUG_TYPE_PORTABILITY 0x824F
+#endif
+#ifndef GL_DEBUG_TYPE_PERFORMANCE
+#define GL_DEBUG_TYPE_PERFORMANCE 0x8250
+#endif
+#ifndef GL_DEBUG_SEVERITY_HIGH
+#define GL_DEBUG_SEVERITY_HIGH 0x9146
+#endif
+#ifndef GL_DEBUG_SEVERITY_MEDIUM
+#define GL_DEBUG_SEVERITY_MEDIUM 0x9147
+#endif
+#ifndef GL_DEBUG_SEVERITY_LOW
+#define GL_DEBUG_SEVERITY_LOW 0x9148
+#endif
+#ifndef GL_DEBUG_SEVERITY_NOTIFICATION
+#define GL_DEBUG_SEVERITY_NOTIFICATION 0x826B
+#endif
+
+namespace utility {
+namespace gl {
+    // OpenGL functionality beyond the 3.3 core profile that glad was generated for
+    // These entry points are loaded at runtime (see load_extensions) and are only used if the driver supports them
+    // ------------------------------------------------------------------------------------------------------------
+    struct extensions {
+        // Check if the context version is at least major.minor
+        // ----------------------------------------------------
+        bool version(const int& major, const int& minor) const {
+            return major_version > major || (major_version == major && minor_version >= minor);
+        }
+        // Check if the driver advertises the named extension
+        // --------------------------------------------------
+        bool has(const std::string& extension) const {
+            return names.find(extension) != names.end();
+        }
+        // Check if a feature is available, either from the core version it was promoted in or from its extension
+        // -------------------------------------------------------------------------------------------------------
+        bool supports(const int& major, const int& minor, const std::string& extension) const {
+            return version(major, minor) || has(extension);
+        }
+
+        int major_version = 0;
+        int minor_version = 0;
+        std::set<std::string> names;
+
+        // GL_ARB_get_program_binary (core in 4.1)
+        bool ARB_get_program_binary = false;
+        void(APIENTRYP get_program_binary)(GLuint, GLsizei, GLsizei*, GLenum*, void*) = nullptr;
+        void(APIENTRYP program_binary)(GLuint, GLenum, const void*, GLsizei)          = nullptr;
+        void(APIENTRYP program_parameteri)(GLuint, GLenum, GLint)                      = nullptr;
+
+        // GL_KHR_parallel_shader_compile (or the equivalent ARB extension)
+        bool KHR_parallel_shader_compile = false;
+        void(APIENTRYP max_shader_compiler_threads)(GLuint) = nullptr;
+
+        // GL_KHR_debug (core in 4.3)
+        bool KHR_debug = false;
+        void(APIENTRYP debug_message_callback)(GLDEBUGPROC, const void*) = nullptr;
+
+        // GL_ARB_buffer_storage (core in 4.4)
+        bool ARB_buffer_storage = false;
+        void(APIENTRYP buffer_storage)(GLenum, GLsizeiptr, const void*, GLbitfield) = nullptr;
+
+        // GL_ARB_texture_storage (core in 4.2)
+        bool ARB_texture_storage = false;
+        void(APIENTRYP tex_storage_2d)(GLenum, GLsizei, GLenum, GLsizei, GLsizei) = nullptr;
+        void(APIENTRYP tex_storage_3d)(GLenum, GLsizei, GLenum, GLsizei, GLsizei, GLsizei) = nullptr;
+
+        // GL_ARB_multi_draw_indirect (core in 4.3), which needs the GL_DRAW_INDIRECT_BUFFER from GL_ARB_draw_indirect
+        bool ARB_multi_draw_indirect = false;
+        void(APIENTRYP multi_draw_elements_indirect)(GLenum, GLenum, const void*, GLsizei, GLsizei) = nullptr;
+
+        // GL_EXT_texture_compression_s3tc (BC1, BC2, and BC3), never core but supported by every desktop driver
+        bool EXT_texture_compression_s3tc = false;
+    };
+
+    // Get the extensions that were found for the current context
+    // ----------------------------------------------------------
+    inline extensions& get_extensions() {
+        static extensions instance;
+        return instance;
+    }
+
+    // Print messages from the KHR_debug callback
+    // The driver may call this from another thread, and exceptions can't be thrown through the driver, so errors are
+    // only reported here and not thrown
+    // --------------------------------------------------------------------------------------------------------------
+    inline void APIENTRY report_debug_message(GLenum /* source */,
+                                              GLenum type,
+                                              GLuint id,
+                                              GLenum severity,
+                                              GLsizei /* length */,
+                                              const GLchar* message,
+                                              const void* /* user_param */) {
+        if (severity == GL_DEBUG_SEVERITY_NOTIFICATION) {
+            return;
+        }
+
+        const char* type_str = "Other";
+        switch (type) {
+            case GL_DEBUG_TYPE_ERROR: type_str = "Error"; break;
+            case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: type_str = "Deprecated behaviour"; break;
+            case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR: type_str = "Undefined behaviour"; break;
+            case GL_DEBUG_TYPE_PORTABILITY: type_str = "Portability"; break;
+            case GL_DEBUG_TYPE_PERFORMANCE: type_str = "Performance"; break;
+        }
+        const char* severity_str = "low";
+        switch (severity) {
+            case GL_DEBUG_SEVERITY_HIGH: severity_str = "high"; break;
+            case GL_DEBUG_SEVERITY_MEDIUM: severity_str = "medium"; break;
+        }
+        std::cerr << fmt::format("OpenGL {} ({} severity, id {}): {}", type_str, severity_str, id, message)
+                  << std::endl;
+    }
+
+    // Find all of the extensions that the current context supports and load their entry points
+    // Call this after gladLoadGLLoader with the same loader function
+    // Example: utility::gl::load_extensions((GLADloadproc) glfwGetProcAddress);
+    // -----------------------------------------------------------------------------------------
+    inline void load_extensions(GLADloadproc load) {
+        extensions& ext = get_extensions();
+
+        glGetIntegerv(GL_MAJOR_VERSION, &ext.major_version);
+        glGetIntegerv(GL_MINOR_VERSION, &ext.minor_version);
+
+        int count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        ext.names.clear();
+        for (int i = 0; i < count; ++i) {
+            ext.names.insert(reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, static_cast<GLuint>(i))));
+        }
+
+        if (ext.supports(4, 1, "GL_ARB_get_program_binary")) {
+            ext.get_program_binary = reinterpret_cast<decltype(ext.get_program_binary)>(load("glGetProgramBinary"));
+            ext.program_binary     = reinterpret_cast<decltype(ext.program_binary)>(load("glProgramBinary"));
+            ext.program_parameteri = reinterpret_cast<decltype(ext.program_parameteri)>(load("glProgramParameteri"));
+
+            ext.ARB_get_program_binary = ext.get_program_binary && ext.program_binary && ext.program_parameteri;
+        }
+
+        if (ext.has("GL_KHR_parallel_shader_compile")) {
+            ext.max_shader_compiler_threads =
+                reinterpret_cast<decltype(ext.max_shader_compiler_threads)>(load("glMaxShaderCompilerThreadsKHR"));
+        }
+        else if (ext.has("GL_ARB_parallel_shader_compile")) {
+            ext.max_shader_compiler_threads =
+                reinterpret_cast<decltype(ext.max_shader_compiler_threads)>(load("glMaxShaderCompilerThreadsARB"));
+        }
+        if (ext.max_shader_compiler_threads != nullptr) {
+            // Let the driver use as many threads as it wants for compiling shaders
+            ext.max_shader_compiler_threads(0xFFFFFFFF);
+            ext.KHR_parallel_shader_compile = true;
+        }
+
+        if (ext.supports(4, 3, "GL_KHR_debug")) {
+            // On desktop OpenGL the KHR_debug entry points don't have a suffix
+            ext.debug_message_callback =
+                reinterpret_cast<decltype(ext.debug_message_callback)>(load("glDebugMessageCallback"));
+
+            ext.KHR_debug = ext.debug_message_callback != nullptr;
+        }
+
+        if (ext.supports(4, 4, "GL_ARB_buffer_storage")) {
+            ext.buffer_storage     = reinterpret_cast<decltype(ext.buffer_storage)>(load("glBufferStorage"));
+            ext.ARB_buffer_storage = ext.buffer_storage != nullptr;
+        }
+
+        if (ext.supports(4, 2, "GL_ARB_texture_storage")) {
+            ext.tex_storage_2d      = reinterpret_cast<decltype(ext.tex_storage_2d)>(load("glTexStorage2D"));
+            ext.tex_storage_3d      = reinterpret_cast<decltype(ext.tex_storage_3d)>(load("glTexStorage3D"));
+            ext.ARB_texture_storage = ext.tex_storage_2d != nullptr && ext.tex_storage_3d != nullptr;
+        }
+
+        if (ext.supports(4, 3, "GL_ARB_multi_draw_indirect") && ext.supports(4, 0, "GL_ARB_draw_indirect")) {
+            ext.multi_draw_elements_indirect =
+                reinterpret_cast<decltype(ext.multi_draw_elements_indirect)>(load("glMultiDrawElementsIndirect"));
+            ext.ARB_multi_draw_indirect = ext.multi_draw_elements_indirect != nullptr;
+        }
+
+        ext.EXT_texture_compression_s3tc = ext.has("GL_EXT_texture_compression_s3tc");
+
+#if UTILITY_ERROR_POLICY == UTILITY_ERROR_CHECK_CALLBACK
+        // With the callback policy the wrappers never call glGetError, so errors have to come from the driver
+        if (ext.KHR_debug) {
+            glEnable(GL_DEBUG_OUTPUT);
+            ext.debug_message_callback(report_debug_message, nullptr);
+        }
+        else {
+            std::cerr << "KHR_debug is not available, OpenGL errors will not be reported" << std::endl;
+        }
+#endif
+    }
+}  // namespace gl
+}  // namespace utility
+
+
+#endif  // UTILITY_OPENGL_EXTENSIONS_HPP
@@ -0,0 +1,226 @@
+#ifndef UTILITY_OPENGL_STATE_HPP
+#define UTILITY_OPENGL_STATE_HPP
+
+#include <cstddef>
+#include <limits>
+#include <map>
+#include <utility>
+#include <vector>
+
+// clang-format off
+#include "glad/glad.h"
+// clang-format on
+
+namespace utility {
+namespace gl {
+    // Cache of the OpenGL binding state for the current context
+    // Every wrapper in opengl_utils.hpp changes bindings through this cache so that calls which would not change
+    // anything (binding the program that is already in use, the texture that is already on a unit, etc) are skipped
+    // If you change bindings with raw OpenGL calls call invalidate() afterwards so the cache doesn't go stale
+    // -------------------------------------------------------------------------------------------------------------
+    struct state {
+        // Number of GL calls that were made and skipped for one kind of binding
+        struct counter {
+            size_t issued = 0;
+            size_t elided = 0;
+        };
+        struct statistics {
+            counter program;
+            counter vertex_array;
+            counter buffer;
+            counter active_texture;
+            counter texture;
+        };
+
+        // Make a program the active program
+        // Returns true if a GL call was made
+        // ----------------------------------
+        bool use_program(const unsigned int& program) {
+            if (update(current_program, program, stats.program)) {
+                glUseProgram(program);
+                return true;
+            }
+            return false;
+        }
+
+        // Bind a vertex array
+        // The element array buffer binding belongs to the vertex array, so it is unknown after changing vertex arrays
+        // Returns true if a GL call was made
+        // -----------------------------------------------------------------------------------------------------------
+        bool bind_vertex_array(const unsigned int& vao) {
+            if (update(current_vertex_array, vao, stats.vertex_array)) {
+                glBindVertexArray(vao);
+                buffers.erase(GL_ELEMENT_ARRAY_BUFFER);
+                return true;
+            }
+            return false;
+        }
+
+        // Bind a buffer to a target (GL_ARRAY_BUFFER, GL_ELEMENT_ARRAY_BUFFER, GL_UNIFORM_BUFFER, ...)
+        // Returns true if a GL call was made
+        // ---------------------------------------------------------------------------------------------
+        bool bind_buffer(const unsigned int& target, const unsigned int& buffer) {
+            auto binding = buffers.emplace(target, unknown).first;
+            if (update(binding->second, buffer, stats.buffer)) {
+                glBindBuffer(target, buffer);
+                return true;
+            }
+            return false;
+        }
+
+        // Bind a buffer to an indexed binding point
+        // This also binds the buffer to the generic target
+        // Returns true if a GL call was made
+        // ------------------------------------------------
+        bool bind_buffer_base(const unsigned int& target, const unsigned int& index, const unsigned int& buffer) {
+            auto binding = indexed_buffers.emplace(std::make_pair(target, index), unknown).first;
+            if (update(binding->second, buffer, stats.buffer)) {
+                glBindBufferBase(target, index, buffer);
+                buffers[target] = buffer;
+                return true;
+            }
+            return false;
+        }
+
+        // Bind a range of a buffer to an indexed binding point
+        // Ranges aren't cached, so this always makes a GL call, but it keeps the cache up to date
+        // This also binds the buffer to the generic target
+        // ---------------------------------------------------------------------------------------
+        void bind_buffer_range(const unsigned int& target,
+                               const unsigned int& index,
+                               const unsigned int& buffer,
+                               const ptrdiff_t& offset,
+                               const ptrdiff_t& size) {
+            ++stats.buffer.issued;
+            glBindBufferRange(target, index, buffer, offset, size);
+            // A later bind_buffer_base with the same buffer has to rebind the whole buffer
+            indexed_buffers[std::make_pair(target, index)] = unknown;
+            buffers[target]                                = buffer;
+        }
+
+        // Select the active texture unit (GL_TEXTURE0 + i)
+        // Returns true if a GL call was made
+        // ------------------------------------------------
+        bool active_texture(const unsigned int& unit) {
+            if (update(current_unit, unit, stats.active_texture)) {
+                glActiveTexture(unit);
+                return true;
+            }
+            return false;
+        }
+
+        // Bind a texture to a target on the active texture unit
+        // Returns true if a GL call was made
+        // -----------------------------------------------------
+        bool bind_texture(const unsigned int& target, const unsigned int& texture) {
+            // If we don't know which unit is active we can't know what is bound to it either
+            if (current_unit == unknown) {
+                ++stats.texture.issued;
+                glBindTexture(target, texture);
+                return true;
+            }
+            const size_t unit = current_unit - GL_TEXTURE0;
+            if (unit >= textures.size()) {
+                textures.resize(unit + 1);
+            }
+            auto binding = textures[unit].emplace(target, unknown).first;
+            if (update(binding->second, texture, stats.texture)) {
+                glBindTexture(target, texture);
+                return true;
+            }
+            return false;
+        }
+
+        // Objects that are deleted are automatically unbound by OpenGL, so the cache needs to be told about it
+        // ----------------------------------------------------------------------------------------------------
+        void forget_program(const unsigned int& program) {
+            // Deleting the active program doesn't unbind it, but we can't use its name again either
+            if (current_program == program) {
+                current_program = unknown;
+            }
+        }
+        void forget_vertex_array(const unsigned int& vao) {
+            if (current_vertex_array == vao) {
+                current_vertex_array = 0;
+                buffers.erase(GL_ELEMENT_ARRAY_BUFFER);
+            }
+        }
+        void forget_buffer(const unsigned int& buffer) {
+            for (auto& binding : buffers) {
+                if (binding.second == buffer) {
+                    binding.second = 0;
+                }
+            }
+            for (auto& binding : indexed_buffers) {
+                if (binding.second == buffer) {
+                    binding.second = 0;
+                }
+            }
+        }
+        void forget_texture(const unsigned int& texture) {
+            for (auto& unit : textures) {
+                for (auto& binding : unit) {
+                    if (binding.second == texture) {
+                        binding.second = 0;
+                    }
+                }
+            }
+        }
+
+        // Forget everything we know about the current bindings
+        // The next call for each binding will always go to OpenGL
+        // -------------------------------------------------------
+        void invalidate() {
+            current_program      = unknown;
+            current_vertex_array = unknown;
+            current_unit         = unknown;
+            buffers.clear();
+            indexed_buffers.clear();
+            textures.clear();
+        }
+
+        // Get the number of GL calls that were made and skipped since the last reset
+        // ---------------------------------------------------------------------------
+        const statistics& get_statistics() const {
+            return stats;
+        }
+        void reset_statistics() {
+            stats = statistics();
+        }
+
+    private:
+        // Marker for bindings that we don't know the value of
+        enum : unsigned int { unknown = std::numeric_limits<unsigned int>::max() };
+
+        // Record a new value for a binding, returns true if the binding actually changed
+        static bool update(unsigned int& current, const unsigned int& value, counter& count) {
+            if (current == value) {
+                ++count.elided;
+                return false;
+            }
+            current = value;
+            ++count.issued;
+            return true;
+        }
+
+        unsigned int current_program      = unknown;
+        unsigned int current_vertex_array = unknown;
+        unsigned int current_unit         = unknown;
+        std::map<unsigned int, unsigned int> buffers;
+        std::map<std::pair<unsigned int, unsigned int>, unsigned int> indexed_buffers;
+        std::vector<std::map<unsigned int, unsigned int>> textures;
+        statistics stats;
+    };
+
+    // Get the binding state cache for the current context
+    // These examples only ever create a single context, so there is only one cache
+    // ----------------------------------------------------------------------------
+    inline state& get_state() {
+        static state instance;
+        return instance;
+    }
+}  // namespace gl
+}  // namespace utility
+
+
+#endif  // UTILITY_OPENGL_STATE_HPP
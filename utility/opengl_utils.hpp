@@ -1,12 +1,31 @@
 #ifndef UTILITY_OPENGL_UTILS_HPP
 #define UTILITY_OPENGL_UTILS_HPP
 
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
 #include <fstream>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <limits>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <stdexcept>
+#include <tuple>
 #include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 // For python style string formatting
@@ -23,7 +42,15 @@
 #include "glad/glad.h"
 // clang-format on
 
+#include "utility/block_compression.hpp"
+#include "utility/compressed_image.hpp"
+#include "utility/error_policy.hpp"
+#include "utility/mipmap.hpp"
 #include "utility/opengl_error_category.hpp"
+#include "utility/opengl_deletion_queue.hpp"
+#include "utility/opengl_extensions.hpp"
+#include "utility/opengl_state.hpp"
+#include "utility/thread_pool.hpp"
 
 namespace utility {
 namespace gl {
@@ -36,6 +63,125 @@ namespace gl {
             throw std::system_error(code, opengl_error_category(), msg);
         }
     }
+    // Same as above, but takes a string literal so that the success path does not need to allocate a std::string
+    // ----------------------------------------------------------------------------------------------------------
+    inline void throw_gl_error(const int& code, const char* msg) {
+        if (code != GL_NO_ERROR) {
+            throw std::system_error(code, opengl_error_category(), msg);
+        }
+    }
+
+    // Check for an OpenGL error after a wrapped call, according to the build's error policy (see error_policy.hpp)
+    // The message is only formatted if an error actually occurred, and when checking is disabled this does nothing
+    // Example: check_gl_error("Failed to bind texture {} to unit {}", texture, unit);
+    // -------------------------------------------------------------------------------------------------------------
+    template <typename... Args>
+    inline void check_gl_error(const char* format, const Args&... args) {
+#if UTILITY_GL_CHECK_ERRORS
+        const int code = glGetError();
+        if (code != GL_NO_ERROR) {
+            throw std::system_error(
+                code, opengl_error_category(), fmt::vformat(format, fmt::make_format_args(args...)));
+        }
+#endif
+    }
+
+    // A handle to a uniform in a linked shader program
+    // Handles are resolved once (see shader_program::get_uniform) so that setting a uniform in the render loop
+    // doesn't need any string formatting or lookups
+    // ---------------------------------------------------------------------------------------------------------
+    template <typename T>
+    struct uniform {
+        using value_type = T;
+
+        uniform() : index(-1), location(-1) {}
+        uniform(const int& index, const int& location) : index(index), location(location) {}
+
+        // A uniform that was optimised out of the program (or never existed) has a location of -1
+        // OpenGL silently ignores uniform updates to location -1
+        // ----------------------------------------------------------------------------------------
+        bool valid() const {
+            return location != -1;
+        }
+
+        // Index of the uniform in the owning programs uniform table
+        int index;
+        // Location of the uniform in the owning program
+        int location;
+    };
+
+    // Different overloads for uploading a value to a uniform location in the currently active program
+    // ------------------------------------------------------------------------------------------------
+    inline void upload_uniform(const int& location, const bool& value) {
+        glUniform1i(location, value ? 1 : 0);
+    }
+    inline void upload_uniform(const int& location, const int& value) {
+        glUniform1i(location, value);
+    }
+    inline void upload_uniform(const int& location, const float& value) {
+        glUniform1f(location, value);
+    }
+    inline void upload_uniform(const int& location, const glm::mat4& value) {
+        glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
+    }
+    inline void upload_uniform(const int& location, const glm::vec4& value) {
+        glUniform4fv(location, 1, glm::value_ptr(value));
+    }
+    inline void upload_uniform(const int& location, const glm::vec3& value) {
+        glUniform3fv(location, 1, glm::value_ptr(value));
+    }
+    inline void upload_uniform(const int& location, const std::array<float, 4>& value) {
+        glUniform4f(location, value[0], value[1], value[2], value[3]);
+    }
+    inline void upload_uniform(const int& location, const glm::mat3& value) {
+        glUniformMatrix3fv(location, 1, GL_FALSE, glm::value_ptr(value));
+    }
+    inline void upload_uniform(const int& location, const glm::vec2& value) {
+        glUniform2fv(location, 1, glm::value_ptr(value));
+    }
+    inline void upload_uniform(const int& location, const glm::ivec2& value) {
+        glUniform2iv(location, 1, glm::value_ptr(value));
+    }
+    inline void upload_uniform(const int& location, const glm::ivec3& value) {
+        glUniform3iv(location, 1, glm::value_ptr(value));
+    }
+    inline void upload_uniform(const int& location, const glm::ivec4& value) {
+        glUniform4iv(location, 1, glm::value_ptr(value));
+    }
+
+    // Different overloads for uploading count consecutive values to a uniform array in a single call
+    // The values are written to the array starting at location, values past the end of the array are ignored
+    // -------------------------------------------------------------------------------------------------------
+    inline void upload_uniform(const int& location, const int* values, const size_t& count) {
+        glUniform1iv(location, static_cast<GLsizei>(count), values);
+    }
+    inline void upload_uniform(const int& location, const float* values, const size_t& count) {
+        glUniform1fv(location, static_cast<GLsizei>(count), values);
+    }
+    inline void upload_uniform(const int& location, const glm::vec2* values, const size_t& count) {
+        glUniform2fv(location, static_cast<GLsizei>(count), glm::value_ptr(values[0]));
+    }
+    inline void upload_uniform(const int& location, const glm::vec3* values, const size_t& count) {
+        glUniform3fv(location, static_cast<GLsizei>(count), glm::value_ptr(values[0]));
+    }
+    inline void upload_uniform(const int& location, const glm::vec4* values, const size_t& count) {
+        glUniform4fv(location, static_cast<GLsizei>(count), glm::value_ptr(values[0]));
+    }
+    inline void upload_uniform(const int& location, const glm::ivec2* values, const size_t& count) {
+        glUniform2iv(location, static_cast<GLsizei>(count), glm::value_ptr(values[0]));
+    }
+    inline void upload_uniform(const int& location, const glm::ivec3* values, const size_t& count) {
+        glUniform3iv(location, static_cast<GLsizei>(count), glm::value_ptr(values[0]));
+    }
+    inline void upload_uniform(const int& location, const glm::ivec4* values, const size_t& count) {
+        glUniform4iv(location, static_cast<GLsizei>(count), glm::value_ptr(values[0]));
+    }
+    inline void upload_uniform(const int& location, const glm::mat3* values, const size_t& count) {
+        glUniformMatrix3fv(location, static_cast<GLsizei>(count), GL_FALSE, glm::value_ptr(values[0]));
+    }
+    inline void upload_uniform(const int& location, const glm::mat4* values, const size_t& count) {
+        glUniformMatrix4fv(location, static_cast<GLsizei>(count), GL_FALSE, glm::value_ptr(values[0]));
+    }
 
     // Create a smart enum to wrap shader enum types
     // ---------------------------------------------
@@ -244,6 +390,11 @@ namespace gl {
         }
     };
 
+    // Preprocessor defines to inject into shader source code, name -> value
+    // Ordered so that the same set of defines always produces the same source code
+    // ----------------------------------------------------------------------------
+    using shader_defines = std::map<std::string, std::string>;
+
     // Create a wrapper for OpenGL shader programs
     // -------------------------------------------
     struct shader_program {
@@ -251,32 +402,38 @@ namespace gl {
         shader_program() {
             // Create a shader program
             program = glCreateProgram();
-            throw_gl_error(glGetError(), fmt::format("Failed to create shader program"));
+            check_gl_error("Failed to create shader program");
         }
         shader_program(const shader_program& prog) = delete;
         // : shaders(prog.shaders), program(prog.program), uniforms(prog.uniforms) {}
         shader_program(shader_program&& prog) noexcept
             : shaders(std::move(prog.shaders))
             , program(std::exchange(prog.program, 0))
-            , uniforms(std::move(prog.uniforms)) {}
+            , uniforms(std::move(prog.uniforms))
+            , uniform_table(std::move(prog.uniform_table))
+            , uniform_stats(prog.uniform_stats)
+            , binary_cache(std::move(prog.binary_cache))
+            , sources(std::move(prog.sources))
+            , linking(std::exchange(prog.linking, false))
+            , failed(std::exchange(prog.failed, false))
+            , cache_file(std::move(prog.cache_file))
+            , defines(std::move(prog.defines)) {}
         // Clean up all references
         ~shader_program() {
             for (auto& shader : shaders) {
-                if (glIsShader(program) == GL_TRUE) {
+                if (shader.id != 0) {
 #ifndef NDEBUG
                     std::cout << "Deleting shader" << std::endl;
 #endif
-                    glDeleteShader(shader);
-                    throw_gl_error(glGetError(), fmt::format("Failed to delete shader object"));
+                    get_deletion_queue().delete_shader(shader.id);
                 }
             }
             shaders.clear();
-            if (glIsProgram(program) == GL_TRUE) {
+            if (program != 0) {
 #ifndef NDEBUG
                 std::cout << "Deleting program" << std::endl;
 #endif
-                glDeleteProgram(program);
-                throw_gl_error(glGetError(), fmt::format("Failed to delete shader program"));
+                get_deletion_queue().delete_program(program);
             }
         }
         shader_program& operator=(const shader_program& prog) = delete;  // {
@@ -286,13 +443,58 @@ namespace gl {
         //     return *this;
         // }
         shader_program& operator=(shader_program&& prog) noexcept {
-            shaders  = std::move(prog.shaders);
-            program  = std::exchange(prog.program, 0);
-            uniforms = std::move(prog.uniforms);
+            shaders       = std::move(prog.shaders);
+            program       = std::exchange(prog.program, 0);
+            uniforms      = std::move(prog.uniforms);
+            uniform_table = std::move(prog.uniform_table);
+            uniform_stats = prog.uniform_stats;
+            binary_cache  = std::move(prog.binary_cache);
+            sources       = std::move(prog.sources);
+            linking       = std::exchange(prog.linking, false);
+            failed        = std::exchange(prog.failed, false);
+            cache_file    = std::move(prog.cache_file);
+            defines       = std::move(prog.defines);
             return *this;
         }
 
+        // Cache linked program binaries in the given directory
+        // On the next run the program is loaded straight from the cache instead of compiling and linking the shaders
+        // The cache is keyed on the shader sources and the driver, so any change to either will rebuild the program
+        // Must be called before any shaders are added. Does nothing if the driver can't save program binaries
+        // ----------------------------------------------------------------------------------------------------------
+        // directory: Existing directory to store the program binaries in
+        // ----------------------------------------------------------------------------------------------------------
+        void use_binary_cache(const std::string& directory) {
+            if (!shaders.empty() || !sources.empty()) {
+                throw std::system_error(std::error_code(EINVAL, std::system_category()),
+                                        "The binary cache must be enabled before adding shaders");
+            }
+            if (get_extensions().ARB_get_program_binary) {
+                int formats = 0;
+                glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+                check_gl_error("Failed to get number of program binary formats");
+                if (formats > 0) {
+                    binary_cache = directory;
+                }
+            }
+        }
+
+        // Set preprocessor defines to inject into every shader in this program
+        // Shaders can use these to specialise themselves, e.g. to use an exact loop count instead of a uniform
+        // Must be called before any shaders are added
+        // ----------------------------------------------------------------------------------------------------
+        // defines: Names and values of the defines, the value can be empty
+        // ----------------------------------------------------------------------------------------------------
+        void set_defines(const shader_defines& defines) {
+            if (!shaders.empty() || !sources.empty()) {
+                throw std::system_error(std::error_code(EINVAL, std::system_category()),
+                                        "Defines must be set before adding shaders");
+            }
+            this->defines = defines;
+        }
+
         // Add shader source code from a file
+        // The shader starts compiling straight away, compile errors are reported when the program is linked
         // ------------------------------------------------------------------------------------
         // shader_source: Path to file that contains the shader source code
         // shader_type: The type of the shader that is being added (vertex, fragment, geometry)
@@ -307,140 +509,207 @@ namespace gl {
             }
             std::stringstream stream;
             stream << data.rdbuf();
-            std::string code(stream.str());
-
-            // Create the shader
-            unsigned int shader_id = glCreateShader(shader_type);
-            throw_gl_error(glGetError(), fmt::format("Failed to create shader for {}", shader_source));
-
-            // glShaderSource expects an array of strings
-            const char* shader_src = code.c_str();
-            glShaderSource(shader_id, 1, &shader_src, nullptr);
-            throw_gl_error(glGetError(), fmt::format("Failed to load shader source for {}", shader_source));
-
-            // Compile the shader
-            glCompileShader(shader_id);
-            throw_gl_error(glGetError(), fmt::format("Failed to compile shader with type {}", shader_type));
-
-            // Check for compile errors
-            int success;
-            glGetShaderiv(shader_id, GL_COMPILE_STATUS, &success);
-            throw_gl_error(glGetError(),
-                           fmt::format("Failed to get shader compile status for shader with type {}", shader_type));
+            const std::string code = inject_defines(stream.str());
 
-            if (success == GL_FALSE) {
-                std::string shader_type_str(shader_type);
-                int length = 0;
-                glGetShaderiv(shader_id, GL_INFO_LOG_LENGTH, &length);
-                std::string info_log(length, 0);
-                glGetShaderInfoLog(shader_id, length, nullptr, &info_log[0]);
-                throw_gl_error(glGetError(),
-                               fmt::format("Failed to get shader compile log for shader with type {}", shader_type));
-                throw std::system_error(
-                    std::error_code(EINVAL, std::system_category()),
-                    fmt::format("Shader Compilation Failed:\nShader Type: {}\nLog: {}", shader_type_str, info_log));
+            // When caching we don't know if we need to compile anything until we have seen all of the sources
+            if (!binary_cache.empty()) {
+                sources.push_back({shader_type, shader_source, code});
+            }
+            else {
+                compile_shader(code, shader_type, shader_source);
             }
-
-            // No errors, add shader to list of all shaders
-            shaders.push_back(shader_id);
         }
 
         // Link all the shaders into a shader program
         // ------------------------------------------
         void link() {
+            link_async();
+            wait();
+        }
+
+        // Start linking the shaders into a shader program without waiting for the driver to finish
+        // Compiling and linking of every program that is started this way can run in parallel, see ready() and wait()
+        // The program finishes linking (and reports any errors) the first time it is used
+        // ------------------------------------------------------------------------------------------------------------
+        void link_async() {
             // Make sure we actually have some shaders to link together
-            if (shaders.empty()) {
+            if (shaders.empty() && sources.empty()) {
                 throw std::system_error(std::error_code(EINVAL, std::system_category()),
                                         "Can't link a program with no shaders.");
             }
 
             // Make sure the program is valid
             if (glIsProgram(program) == GL_TRUE) {
+                if (!binary_cache.empty()) {
+                    cache_file = fmt::format("{}/{:016x}.bin", binary_cache, binary_cache_key());
+                    if (load_binary(cache_file)) {
+                        sources.clear();
+                        cache_file.clear();
+                        find_all_uniforms(false);
+                        return;
+                    }
+
+                    // Cache miss, compile everything now
+                    for (const auto& source : sources) {
+                        compile_shader(source.code, source.type, source.path);
+                    }
+                    sources.clear();
+
+                    // Let the driver know that we are going to ask for the binary
+                    get_extensions().program_parameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+                    check_gl_error("Failed to set program binary retrievable hint");
+                }
+
                 // Attach each of the provided shaders to the progrm
-                for (auto shader : shaders) {
-                    if (glIsShader(shader) == GL_TRUE) {
-                        glAttachShader(program, shader);
-                        throw_gl_error(glGetError(), fmt::format("Failed to attach shader to program"));
+                for (const auto& shader : shaders) {
+                    if (glIsShader(shader.id) == GL_TRUE) {
+                        glAttachShader(program, shader.id);
+                        check_gl_error("Failed to attach shader to program");
                     }
                     else {
-                        throw_gl_error(GL_INVALID_VALUE,
-                                       fmt::format("Shader {} is invalid", static_cast<unsigned int>(shader)));
+                        throw_gl_error(GL_INVALID_VALUE, fmt::format("Shader {} is invalid", shader.id));
                     }
                 }
 
                 // Link all of the shaders together
+                // Don't ask for the link status yet, that would make us wait for the driver
                 glLinkProgram(program);
-                throw_gl_error(glGetError(), fmt::format("Failed to link shader program"));
+                check_gl_error("Failed to link shader program");
+                linking = true;
+            }
+            else {
+                throw std::system_error(std::error_code(EINVAL, std::system_category()), "Invalid Program!");
+            }
+        }
 
-                // Check for linking errors
-                int success;
-                glGetProgramiv(program, GL_LINK_STATUS, &success);
-                throw_gl_error(glGetError(), fmt::format("Failed to get shader program link status"));
+        // Check if the program has finished compiling and linking, without blocking
+        // Needs KHR_parallel_shader_compile, without it we can't ask so the program is always reported as ready
+        // -----------------------------------------------------------------------------------------------------
+        bool ready() const {
+            if (!linking || !get_extensions().KHR_parallel_shader_compile) {
+                return true;
+            }
+            int complete = GL_TRUE;
+            glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &complete);
+            return complete == GL_TRUE;
+        }
 
-                if (success == GL_FALSE) {
-                    int length = 0;
-                    glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
-                    std::string info_log(length, 0);
-                    glGetProgramInfoLog(program, length, nullptr, &info_log[0]);
-                    throw_gl_error(glGetError(), fmt::format("Failed to get shader program link log"));
-                    throw std::system_error(std::error_code(EINVAL, std::system_category()),
-                                            fmt::format("Program Linking Failed:\nLog: {}", info_log));
-                }
+        // Check if wait found compile or link errors in the program
+        // ---------------------------------------------------------
+        bool link_failed() const {
+            return failed;
+        }
 
-                // Program is linked, we can discard the shaders now
-                for (auto& shader : shaders) {
-                    glDeleteShader(shader);
-                    throw_gl_error(glGetError(), fmt::format("Failed to delete shader object"));
-                }
-                shaders.clear();
+        // Wait for the program to finish linking and check for errors
+        // Called automatically the first time the program is used
+        // -----------------------------------------------------------
+        void wait() {
+            if (!linking) {
+                return;
+            }
+            linking = false;
+            failed  = true;
 
-#ifndef NDEBUG
-                list_all_attributes();
-                find_all_uniforms(true);
-#endif
-                find_all_uniforms(false);
+            // Check each of the shaders for compile errors first, they will explain a link failure better
+            for (const auto& shader : shaders) {
+                check_compile_status(shader);
             }
-            else {
-                throw std::system_error(std::error_code(EINVAL, std::system_category()), "Invalid Program!");
+
+            // Check for linking errors
+            int success;
+            glGetProgramiv(program, GL_LINK_STATUS, &success);
+            check_gl_error("Failed to get shader program link status");
+
+            if (success == GL_FALSE) {
+                int length = 0;
+                glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+                std::string info_log(length, 0);
+                glGetProgramInfoLog(program, length, nullptr, &info_log[0]);
+                check_gl_error("Failed to get shader program link log");
+                throw std::system_error(std::error_code(EINVAL, std::system_category()),
+                                        fmt::format("Program Linking Failed:\nLog: {}", info_log));
+            }
+            failed = false;
+
+            // Program is linked, we can discard the shaders now
+            for (const auto& shader : shaders) {
+                glDetachShader(program, shader.id);
+                glDeleteShader(shader.id);
+                check_gl_error("Failed to delete shader object");
+            }
+            shaders.clear();
+
+            if (!cache_file.empty()) {
+                save_binary(cache_file);
+                cache_file.clear();
             }
+
+#ifndef NDEBUG
+            list_all_attributes();
+            find_all_uniforms(true);
+#endif
+            find_all_uniforms(false);
         }
 
         void list_all_attributes() {
             GLint count;
-            GLint size;                  // size of the variable
-            GLenum type;                 // type of the variable (float, vec3 or mat4, etc)
-            const GLsizei bufSize = 64;  // maximum name length
-            GLchar name[bufSize];        // variable name in GLSL
-            GLsizei length;              // name length
+            GLint size;         // size of the variable
+            GLenum type;        // type of the variable (float, vec3 or mat4, etc)
+            GLint max_length;   // longest name of an active attribute, including the null terminator
+            GLsizei length;     // name length
 
             glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &count);
+            glGetProgramiv(program, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &max_length);
             std::cout << fmt::format("Active Attributes: {}\n", count) << std::endl;
 
+            std::string name(std::max(max_length, 1), '\0');
             for (int i = 0; i < count; i++) {
-                glGetActiveAttrib(program, static_cast<GLuint>(i), bufSize, &length, &size, &type, name);
+                glGetActiveAttrib(program, static_cast<GLuint>(i), max_length, &length, &size, &type, &name[0]);
 
-                std::cout << fmt::format("Attribute #{} Type: {} Name: {}\n", i, type, name) << std::endl;
+                std::cout << fmt::format("Attribute #{} Type: {} Name: {}\n", i, type, name.substr(0, length))
+                          << std::endl;
             }
         }
 
+        // Build the uniform table from the uniforms that the driver reports as active after linking
+        // Arrays of basic types are reported once as "name[0]" with the number of elements, they are added under both
+        // "name" and "name[0]" so that either can be used to set the whole array
+        // -----------------------------------------------------------------------------------------------------------
         void find_all_uniforms(const bool& list = false) {
             GLint count;
-            GLint size;                  // size of the variable
-            GLenum type;                 // type of the variable (float, vec3 or mat4, etc)
-            const GLsizei bufSize = 64;  // maximum name length
-            GLchar name[bufSize];        // variable name in GLSL
-            GLsizei length;              // name length
+            GLint size;         // number of elements, 1 if this isn't an array
+            GLenum type;        // type of the variable (float, vec3 or mat4, etc)
+            GLint max_length;   // longest name of an active uniform, including the null terminator
+            GLsizei length;     // name length
 
             glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+            glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
             if (list) {
                 std::cout << fmt::format("Active Uniforms: {}", count) << std::endl;
             }
 
+            std::string buffer(std::max(max_length, 1), '\0');
             for (int i = 0; i < count; i++) {
-                glGetActiveUniform(program, static_cast<GLuint>(i), bufSize, &length, &size, &type, name);
-                uniforms[name] = glGetUniformLocation(program, name);
+                glGetActiveUniform(program, static_cast<GLuint>(i), max_length, &length, &size, &type, &buffer[0]);
+                const std::string name = buffer.substr(0, length);
+
+                // Uniforms in uniform blocks don't have a location
+                const int location = glGetUniformLocation(program, name.c_str());
+                if (location == -1) {
+                    continue;
+                }
+                const int index = add_uniform(name, location, type, size);
+                if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0) {
+                    uniforms[name.substr(0, name.size() - 3)] = index;
+                }
                 if (list) {
-                    std::cout << fmt::format("Uniform #{} Type: {} Name: {}", i, type, name) << std::endl;
+                    std::cout << fmt::format("Uniform #{} Type: {:#x} Size: {} Location: {} Name: {}",
+                                             i,
+                                             type,
+                                             size,
+                                             location,
+                                             name)
+                              << std::endl;
                 }
             }
         }
@@ -448,14 +717,17 @@ namespace gl {
         // Make this program the currently active program
         // ----------------------------------------------
         void use() {
-            glUseProgram(program);
-            throw_gl_error(glGetError(), fmt::format("Failed to use shader program"));
+            wait();
+            if (get_state().use_program(program)) {
+                check_gl_error("Failed to use shader program");
+            }
         }
         // Deactive this program
         // ---------------------
         void release() {
-            glUseProgram(0);
-            throw_gl_error(glGetError(), fmt::format("Failed to release shader program"));
+            if (get_state().use_program(0)) {
+                check_gl_error("Failed to release shader program");
+            }
         }
 
         // Get the location of a named uniform in the program
@@ -463,281 +735,2432 @@ namespace gl {
         // uniform: The name of the uniform to find
         // --------------------------------------------------
         int get_uniform_location(const std::string& uniform) {
-            glUseProgram(program);
-            if (uniforms.find(uniform) == uniforms.end()) {
-                uniforms[uniform] = glGetUniformLocation(program, uniform.c_str());
-                throw_gl_error(glGetError(), fmt::format("Failed to find uniform '{}'", uniform));
-            }
-            return uniforms[uniform];
+            wait();
+            get_state().use_program(program);
+            return uniform_table[find_uniform(uniform)].location;
+        }
+
+        // Get a handle to a named uniform in the program
+        // Resolve handles once after linking and use them in the render loop
+        // ------------------------------------------------------------------
+        // uniform: The name of the uniform to find
+        // ------------------------------------------------------------------
+        template <typename T>
+        utility::gl::uniform<T> get_uniform(const std::string& uniform) {
+            wait();
+            const int index = find_uniform(uniform);
+            return utility::gl::uniform<T>(index, uniform_table[index].location);
         }
+
         // Different overloads for setting a named uniform to the provided value
+        // The upload is skipped if the uniform already has this value
         // ---------------------------------------------------------------------
         // uniform: The name of the uniform to set
         // value: The value to set the uniform to
         // ---------------------------------------------------------------------
         void set_uniform(const std::string& uniform, const bool& value) {
-            glUniform1i(get_uniform_location(uniform), value ? 1 : 0);
-            throw_gl_error(glGetError(),
-                           fmt::format("Failed to set bool uniform '{}' at location {}", uniform, uniforms[uniform]));
+            set_named_uniform(uniform, value, "bool");
         }
         void set_uniform(const std::string& uniform, const int& value) {
-            glUniform1i(get_uniform_location(uniform), value);
-            throw_gl_error(glGetError(),
-                           fmt::format("Failed to set int uniform '{}' at location {}", uniform, uniforms[uniform]));
+            set_named_uniform(uniform, value, "int");
         }
         void set_uniform(const std::string& uniform, const float& value) {
-            glUniform1f(get_uniform_location(uniform), value);
-            throw_gl_error(glGetError(),
-                           fmt::format("Failed to set float uniform '{}' at location {}", uniform, uniforms[uniform]));
+            set_named_uniform(uniform, value, "float");
         }
         void set_uniform(const std::string& uniform, const glm::mat4& value) {
-            glUniformMatrix4fv(get_uniform_location(uniform), 1, GL_FALSE, glm::value_ptr(value));
-            throw_gl_error(glGetError(),
-                           fmt::format("Failed to set mat4 uniform '{}' at location {}", uniform, uniforms[uniform]));
+            set_named_uniform(uniform, value, "mat4");
         }
         void set_uniform(const std::string& uniform, const glm::vec4& value) {
-            glUniform4fv(get_uniform_location(uniform), 1, glm::value_ptr(value));
-            throw_gl_error(glGetError(),
-                           fmt::format("Failed to set vec4 uniform '{}' at location {}", uniform, uniforms[uniform]));
+            set_named_uniform(uniform, value, "vec4");
         }
         void set_uniform(const std::string& uniform, const glm::vec3& value) {
-            glUniform3fv(get_uniform_location(uniform), 1, glm::value_ptr(value));
-            throw_gl_error(glGetError(),
-                           fmt::format("Failed to set vec3 uniform '{}' at location {}", uniform, uniforms[uniform]));
+            set_named_uniform(uniform, value, "vec3");
         }
         void set_uniform(const std::string& uniform, const std::array<float, 4>& value) {
-            glUniform4f(get_uniform_location(uniform), value[0], value[1], value[2], value[3]);
-            throw_gl_error(glGetError(),
-                           fmt::format("Failed to set array4 uniform '{}' at location {}", uniform, uniforms[uniform]));
+            set_named_uniform(uniform, value, "array4");
         }
-
-        // Allow this program wrapper to be passed OpenGL functions
-        // OpenGL functions expect an unsigned int
-        // --------------------------------------------------------
-        operator unsigned int() {
-            return program;
+        void set_uniform(const std::string& uniform, const glm::mat3& value) {
+            set_named_uniform(uniform, value, "mat3");
         }
-
-    private:
-        std::vector<unsigned int> shaders;
-        unsigned int program;
-        std::map<std::string, int> uniforms;
-    };
-
-    // Create a wrapper for OpenGL vertex arrays
-    // -----------------------------------------
-    struct vertex_array {
-        // Create a single vertex array
-        // ----------------------------
-        vertex_array() {
-            glGenVertexArrays(1, &VAO);
-            throw_gl_error(glGetError(), fmt::format("Failed to generate vertex array"));
+        void set_uniform(const std::string& uniform, const glm::vec2& value) {
+            set_named_uniform(uniform, value, "vec2");
         }
-        vertex_array(const vertex_array& va) = delete;  // : VAO(va.VAO) {}
-        vertex_array(vertex_array&& va) noexcept : VAO(std::exchange(va.VAO, 0)) {}
-        // Delete the vertex array
-        // -----------------------
-        ~vertex_array() {
-            if (glIsVertexArray(VAO) == GL_TRUE) {
-#ifndef NDEBUG
-                std::cout << "Deleting vertex array" << std::endl;
-#endif
-                glDeleteVertexArrays(1, &VAO);
-                throw_gl_error(glGetError(), fmt::format("Failed to delete vertex array"));
-            }
+        void set_uniform(const std::string& uniform, const glm::ivec2& value) {
+            set_named_uniform(uniform, value, "ivec2");
         }
-        vertex_array& operator=(const vertex_array& va) = delete;  // {
-        //     VAO = va.VAO;
-        //     return *this;
-        // }
-        vertex_array& operator=(vertex_array&& va) {
-            VAO = std::exchange(va.VAO, 0);
-            return *this;
+        void set_uniform(const std::string& uniform, const glm::ivec3& value) {
+            set_named_uniform(uniform, value, "ivec3");
+        }
+        void set_uniform(const std::string& uniform, const glm::ivec4& value) {
+            set_named_uniform(uniform, value, "ivec4");
         }
 
-        // Bind the vertex array and make it active
-        // ----------------------------------------
-        void bind() {
-            glBindVertexArray(VAO);
-            throw_gl_error(glGetError(), fmt::format("Failed to bind vertex array"));
+        // Set count consecutive elements of a named uniform array with a single upload
+        // Name the array ("lights") to start at the first element, or an element ("lights[2]") to start there
+        // ----------------------------------------------------------------------------------------------------
+        // uniform: The name of the uniform array to set
+        // values: The values to set the array elements to
+        // count: The number of values
+        // ----------------------------------------------------------------------------------------------------
+        template <typename T>
+        void set_uniform(const std::string& uniform, const T* values, const size_t& count) {
+            wait();
+            get_state().use_program(program);
+            const int index = find_uniform(uniform);
+            if (count > 0 && shadow_uniform(index, values, count * sizeof(T))) {
+                upload_uniform(uniform_table[index].location, values, count);
+                check_gl_error("Failed to set {} elements of uniform array '{}'", count, uniform);
+            }
         }
-        // Deactivate the vertex array
-        // ---------------------------
-        void unbind() {
-            glBindVertexArray(0);
-            throw_gl_error(glGetError(), fmt::format("Failed to unbind vertex array"));
+        template <typename T>
+        void set_uniform(const std::string& uniform, const std::vector<T>& values) {
+            set_uniform(uniform, values.data(), values.size());
         }
 
-        // Add a vertex attribute to the vertex array
-        // ------------------------------------------
-        template <typename Scalar>
-        void add_vertex_attrib(const unsigned int& location,
-                               const int& size,
-                               const int& width,
-                               const unsigned int& type,
-                               const bool& normalised,
-                               const unsigned int& offset) {
-            bind();
-            glVertexAttribPointer(location,
-                                  size,
-                                  type,
-                                  normalised ? GL_TRUE : GL_FALSE,
-                                  width * sizeof(Scalar),
-                                  (void*) (offset * sizeof(Scalar)));
-            throw_gl_error(glGetError(), fmt::format("Failed to create vertex attribute pointer"));
-            glEnableVertexAttribArray(location);
-            throw_gl_error(glGetError(), fmt::format("Failed to enable vertex attribute pointer"));
+        // Set a uniform through a previously resolved handle
+        // This program must be the currently active program (see use)
+        // The upload is skipped if the uniform already has this value
+        // -----------------------------------------------------------
+        // uniform: Handle to the uniform to set
+        // value: The value to set the uniform to
+        // -----------------------------------------------------------
+        template <typename T>
+        void set_uniform(const utility::gl::uniform<T>& uniform,
+                         const typename utility::gl::uniform<T>::value_type& value) {
+            if (shadow_uniform(uniform.index, &value, sizeof(value))) {
+                upload_uniform(uniform.location, value);
+                check_gl_error("Failed to set uniform '{}' at location {}", uniform_name(uniform), uniform.location);
+            }
         }
 
-        // Allow this vertex array wrapper to be passed OpenGL functions
-        // OpenGL functions expect an unsigned int
-        // -------------------------------------------------------------
-        operator unsigned int() const {
-            return VAO;
+        // Set count consecutive elements of a uniform array through a previously resolved handle
+        // All of the elements are uploaded with a single call, e.g. one glUniform3fv for every light position
+        // This program must be the currently active program (see use)
+        // ----------------------------------------------------------------------------------------------------
+        // uniform: Handle to the uniform array (or the first element to set)
+        // values: The values to set the array elements to
+        // count: The number of values
+        // ----------------------------------------------------------------------------------------------------
+        template <typename T>
+        void set_uniform(const utility::gl::uniform<T>& uniform, const T* values, const size_t& count) {
+            if (count > 0 && shadow_uniform(uniform.index, values, count * sizeof(T))) {
+                upload_uniform(uniform.location, values, count);
+                check_gl_error("Failed to set {} elements of uniform array '{}' at location {}",
+                               count,
+                               uniform_name(uniform),
+                               uniform.location);
+            }
         }
-
-    private:
-        unsigned int VAO;
-    };
-
-    // Create a wrapper for OpenGL vertex buffers
-    // ------------------------------------------
-    struct vertex_buffer {
-        // Create a single vertex buffer
-        // -----------------------------
-        vertex_buffer() {
-            glGenBuffers(1, &VBO);
-            throw_gl_error(glGetError(), fmt::format("Failed to generate vertex buffer"));
+        template <typename T>
+        void set_uniform(const utility::gl::uniform<T>& uniform, const std::vector<T>& values) {
+            set_uniform(uniform, values.data(), values.size());
         }
-        vertex_buffer(const vertex_buffer& vb) = delete;  // : VBO(vb.VBO) {}
-        vertex_buffer(vertex_buffer&& vb) noexcept : VBO(std::exchange(vb.VBO, 0)) {}
-        // Delete the vertex buffer
-        // ------------------------
-        ~vertex_buffer() {
-            if (glIsBuffer(VBO) == GL_TRUE) {
-#ifndef NDEBUG
-                std::cout << "Deleting vertex buffer" << std::endl;
-#endif
-                glDeleteBuffers(1, &VBO);
-                throw_gl_error(glGetError(), fmt::format("Failed to delete vertex buffer"));
+        template <typename T, size_t N>
+        void set_uniform(const utility::gl::uniform<T>& uniform, const std::array<T, N>& values) {
+            set_uniform(uniform, values.data(), N);
+        }
+
+        // Bind a named uniform block in this program to a uniform buffer binding point
+        // -------------------------------------------------------------------------------
+        // block: The name of the uniform block in the shader
+        // binding: The binding point that the uniform buffer is attached to (see uniform_buffer::bind_base)
+        // -------------------------------------------------------------------------------
+        void bind_uniform_block(const std::string& block, const unsigned int& binding) {
+            wait();
+            const unsigned int index = glGetUniformBlockIndex(program, block.c_str());
+            check_gl_error("Failed to find uniform block '{}'", block);
+            if (index == GL_INVALID_INDEX) {
+                throw_gl_error(GL_INVALID_VALUE, fmt::format("Uniform block '{}' is not active", block));
             }
+            glUniformBlockBinding(program, index, binding);
+            check_gl_error("Failed to bind uniform block '{}' to {}", block, binding);
         }
-        vertex_buffer& operator=(const vertex_buffer& vb) = delete;  //{
-        //     VBO = vb.VBO;
-        //     return *this;
-        // }
-        vertex_buffer& operator=(vertex_buffer&& vb) {
-            VBO = std::exchange(vb.VBO, 0);
-            return *this;
+        // Same as above, but also check that the C++ struct is big enough to fill the block
+        // ---------------------------------------------------------------------------------
+        template <typename T>
+        void bind_uniform_block(const std::string& block, const unsigned int& binding) {
+            bind_uniform_block(block, binding);
+            int size = 0;
+            glGetActiveUniformBlockiv(
+                program, glGetUniformBlockIndex(program, block.c_str()), GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+            check_gl_error("Failed to get size of uniform block '{}'", block);
+            if (static_cast<size_t>(size) > sizeof(T)) {
+                throw_gl_error(GL_INVALID_OPERATION,
+                               fmt::format("Uniform block '{}' needs {} bytes but the struct only has {} bytes",
+                                           block,
+                                           size,
+                                           sizeof(T)));
+            }
         }
 
-        // Bind the vertex buffer and make it active
-        // -----------------------------------------
-        void bind() {
-            glBindBuffer(GL_ARRAY_BUFFER, VBO);
-            throw_gl_error(glGetError(), fmt::format("Failed to bind vertex buffer"));
+        // What the driver reported about a uniform when the program was linked
+        // type is the GL type of the uniform (GL_FLOAT_VEC3, GL_SAMPLER_2D, ...) and size is the number of array
+        // elements, 1 if the uniform isn't an array. Uniforms the driver didn't report have GL_NONE and 0
+        // ------------------------------------------------------------------------------------------------------
+        struct uniform_reflection {
+            std::string name;
+            int location      = -1;
+            unsigned int type = GL_NONE;
+            int size          = 0;
+        };
+        const uniform_reflection& get_reflection(const std::string& uniform) {
+            wait();
+            return uniform_table[find_uniform(uniform)];
         }
-        // Deactivate the vertex buffer
-        // ----------------------------
-        void unbind() {
-            glBindBuffer(GL_ARRAY_BUFFER, 0);
-            throw_gl_error(glGetError(), fmt::format("Failed to unbind vertex buffer"));
+        template <typename T>
+        const uniform_reflection& get_reflection(const utility::gl::uniform<T>& uniform) const {
+            static const uniform_reflection unknown{"UNKNOWN", -1, GL_NONE, 0};
+            return (uniform.index >= 0 && uniform.index < static_cast<int>(uniform_table.size()))
+                       ? uniform_table[uniform.index]
+                       : unknown;
         }
 
-        // Copy vertex buffer data to the GPU
-        // ----------------------------------
-        template <int N>
-        void copy_data(const std::array<float, N>& vertices, const unsigned int& draw_method) {
-            bind();
-            glBufferData(GL_ARRAY_BUFFER, N * sizeof(float), &vertices[0], draw_method);
-            throw_gl_error(glGetError(), fmt::format("Failed to copy statically-allocated vertex buffer data"));
+        // Number of uniform uploads that were skipped (hits) or made (misses) because of the shadow values
+        struct uniform_statistics {
+            size_t hits   = 0;
+            size_t misses = 0;
+        };
+        const uniform_statistics& get_uniform_statistics() const {
+            return uniform_stats;
         }
+        void reset_uniform_statistics() {
+            uniform_stats = uniform_statistics();
+        }
+
+        // Get the name of the uniform that a handle refers to
+        // ---------------------------------------------------
         template <typename T>
-        void copy_data(const std::vector<T>& vertices, const unsigned int& draw_method) {
-            bind();
-            glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(T), &vertices[0], draw_method);
-            throw_gl_error(glGetError(), fmt::format("Failed to copy dynamically-allocated vertex buffer data"));
+        const std::string& uniform_name(const utility::gl::uniform<T>& uniform) const {
+            return get_reflection(uniform).name;
         }
 
-        // Allow this vertex buffer wrapper to be passed OpenGL functions
+        // Allow this program wrapper to be passed OpenGL functions
         // OpenGL functions expect an unsigned int
-        // --------------------------------------------------------------
-        operator unsigned int() const {
-            return VBO;
+        // --------------------------------------------------------
+        operator unsigned int() {
+            return program;
         }
 
     private:
-        unsigned int VBO;
-    };
+        // A shader that has been compiled but not linked yet
+        struct shader_object {
+            unsigned int id;
+            ShaderType type;
+            std::string source;
+        };
+        // Shader source code that hasn't been compiled yet
+        struct shader_source {
+            ShaderType type;
+            std::string path;
+            std::string code;
+        };
 
-    // Create a wrapper for OpenGL element buffers
-    // -------------------------------------------
-    struct element_buffer {
-        // Create a single element buffer
-        // ------------------------------
-        element_buffer() {
-            glGenBuffers(1, &EBO);
-            throw_gl_error(glGetError(), fmt::format("Failed to generate vertex buffer"));
-        }
-        element_buffer(const element_buffer& eb) = delete;  // : EBO(eb.EBO) {}
-        element_buffer(element_buffer&& eb) noexcept : EBO(std::exchange(eb.EBO, 0)) {}
-        // Delete the element buffer
-        // -------------------------
-        ~element_buffer() {
-            if (glIsBuffer(EBO) == GL_TRUE) {
-#ifndef NDEBUG
-                std::cout << "Deleting element buffer" << std::endl;
-#endif
-                glDeleteBuffers(1, &EBO);
-                throw_gl_error(glGetError(), fmt::format("Failed to delete vertex buffer"));
+        // Insert our defines into shader source code
+        // --------------------------------------------
+        std::string inject_defines(const std::string& code) const {
+            if (defines.empty()) {
+                return code;
             }
-        }
-        element_buffer& operator=(const element_buffer& eb) = delete;  // {
-        //     EBO = eb.EBO;
-        //     return *this;
-        // }
-        element_buffer& operator=(element_buffer&& eb) {
-            EBO = std::exchange(eb.EBO, 0);
-            return *this;
-        }
 
-        // Bind the element buffer and make it active
-        // ------------------------------------------
+            std::string block;
+            for (const auto& define : defines) {
+                block += fmt::format("#define {} {}\n", define.first, define.second);
+            }
+
+            // #version has to come before anything else, so the defines go on the line after it
+            size_t split = 0;
+            size_t line  = 0;
+            const size_t version = code.find("#version");
+            if (version != std::string::npos) {
+                split = code.find('\n', version);
+                split = (split == std::string::npos) ? code.size() : split + 1;
+                line  = std::count(code.begin(), code.begin() + split, '\n');
+            }
+
+            // Reset the line number so that compile errors still point at the right line in the file
+            return code.substr(0, split) + block + fmt::format("#line {}\n", line + 1) + code.substr(split);
+        }
+
+        // Start compiling shader source code and add it to the list of shaders to link
+        // The compile status isn't checked until the program is linked so that the driver can compile in parallel
+        // -------------------------------------------------------------------------------------------------------
+        void compile_shader(const std::string& code, const ShaderType& shader_type, const std::string& shader_source) {
+            // Create the shader
+            unsigned int shader_id = glCreateShader(shader_type);
+            check_gl_error("Failed to create shader for {}", shader_source);
+
+            // glShaderSource expects an array of strings
+            const char* shader_src = code.c_str();
+            glShaderSource(shader_id, 1, &shader_src, nullptr);
+            check_gl_error("Failed to load shader source for {}", shader_source);
+
+            // Compile the shader
+            glCompileShader(shader_id);
+            check_gl_error("Failed to compile shader with type {}", shader_type);
+
+            // Add shader to list of all shaders
+            shaders.push_back({shader_id, shader_type, shader_source});
+        }
+
+        // Check a shader for compile errors
+        // ---------------------------------
+        void check_compile_status(const shader_object& shader) {
+            int success;
+            glGetShaderiv(shader.id, GL_COMPILE_STATUS, &success);
+            check_gl_error("Failed to get shader compile status for shader with type {}", shader.type);
+
+            if (success == GL_FALSE) {
+                std::string shader_type_str(shader.type);
+                int length = 0;
+                glGetShaderiv(shader.id, GL_INFO_LOG_LENGTH, &length);
+                std::string info_log(length, 0);
+                glGetShaderInfoLog(shader.id, length, nullptr, &info_log[0]);
+                check_gl_error("Failed to get shader compile log for shader with type {}", shader.type);
+                throw std::system_error(std::error_code(EINVAL, std::system_category()),
+                                        fmt::format("Shader Compilation Failed:\nShader: {}\nShader Type: {}\nLog: {}",
+                                                    shader.source,
+                                                    shader_type_str,
+                                                    info_log));
+            }
+        }
+
+        // Hash all of the shader sources and the driver details to make a key for the binary cache
+        // Uses FNV-1a so that the key is stable between runs and compilers
+        // ----------------------------------------------------------------------------------------
+        uint64_t binary_cache_key() const {
+            uint64_t hash = 14695981039346656037ull;
+            auto combine  = [&hash](const std::string& data) {
+                for (const char& c : data) {
+                    hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+                }
+                // Separate each item so that moving text between items changes the hash
+                hash = (hash ^ 0xFF) * 1099511628211ull;
+            };
+            for (auto name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+                const GLubyte* value = glGetString(name);
+                combine(value != nullptr ? reinterpret_cast<const char*>(value) : "");
+            }
+            for (const auto& source : sources) {
+                combine(std::to_string(static_cast<unsigned int>(source.type)));
+                combine(source.code);
+            }
+            return hash;
+        }
+
+        // Try to load the program from a cached binary
+        // Returns false if there was no cached binary or the driver rejected it
+        // ---------------------------------------------------------------------
+        bool load_binary(const std::string& cache_file) {
+            std::ifstream file(cache_file, std::ios::in | std::ios::binary);
+            if (!file.good()) {
+                return false;
+            }
+            GLenum format = 0;
+            file.read(reinterpret_cast<char*>(&format), sizeof(format));
+            std::vector<char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            if (!file.eof() || binary.empty()) {
+                return false;
+            }
+
+            get_extensions().program_binary(program, format, binary.data(), static_cast<GLsizei>(binary.size()));
+            int success = GL_FALSE;
+            glGetProgramiv(program, GL_LINK_STATUS, &success);
+
+            // The driver is allowed to reject binaries at any time (e.g. after a driver update), so clear any error
+            // that it might have raised and fall back to compiling
+            glGetError();
+#ifndef NDEBUG
+            std::cout << fmt::format("Program binary cache {} for '{}'", (success == GL_TRUE) ? "hit" : "miss",
+                                     cache_file)
+                      << std::endl;
+#endif
+            return success == GL_TRUE;
+        }
+
+        // Save the linked program binary to the cache
+        // Failing to save is not an error, we will just compile again next time
+        // ---------------------------------------------------------------------
+        void save_binary(const std::string& cache_file) {
+            int length = 0;
+            glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+            check_gl_error("Failed to get program binary length");
+            if (length <= 0) {
+                return;
+            }
+
+            GLenum format = 0;
+            std::vector<char> binary(length);
+            get_extensions().get_program_binary(program, length, nullptr, &format, binary.data());
+            check_gl_error("Failed to get program binary");
+
+            std::ofstream file(cache_file, std::ios::out | std::ios::binary | std::ios::trunc);
+            if (file.good()) {
+                file.write(reinterpret_cast<const char*>(&format), sizeof(format));
+                file.write(binary.data(), binary.size());
+            }
+#ifndef NDEBUG
+            else {
+                std::cout << fmt::format("Failed to write program binary cache '{}'", cache_file) << std::endl;
+            }
+#endif
+        }
+
+        // Make this program current and set a named uniform
+        // --------------------------------------------------
+        template <typename T>
+        void set_named_uniform(const std::string& uniform, const T& value, const char* type) {
+            wait();
+            get_state().use_program(program);
+            const int index = find_uniform(uniform);
+            if (shadow_uniform(index, &value, sizeof(T))) {
+                upload_uniform(uniform_table[index].location, value);
+                check_gl_error("Failed to set {} uniform '{}'", type, uniform);
+            }
+        }
+
+        // Compare a value with the last value that was uploaded to a uniform and remember it
+        // Returns true if the value is different and needs to be uploaded
+        // Uniform values belong to the program so this stays valid no matter what other programs do
+        // -----------------------------------------------------------------------------------------
+        bool shadow_uniform(const int& index, const void* value, const size_t& size) {
+            if (index < 0 || index >= static_cast<int>(uniform_table.size())) {
+                return true;
+            }
+            uniform_info& info        = uniform_table[index];
+            const unsigned char* data = static_cast<const unsigned char*>(value);
+            if (info.shadow.size() == size && std::memcmp(info.shadow.data(), data, size) == 0) {
+                ++uniform_stats.hits;
+                return false;
+            }
+            info.shadow.assign(data, data + size);
+
+            // An array and its elements share storage, so writing one makes the shadows of the array and of every
+            // other element stale. Elements cover the rest of the array from their index, so they overlap each other
+            const int array = info.parent != -1 ? info.parent : index;
+            if (array != index) {
+                uniform_table[array].shadow.clear();
+            }
+            for (const int& element : uniform_table[array].elements) {
+                if (element != index) {
+                    uniform_table[element].shadow.clear();
+                }
+            }
+            ++uniform_stats.misses;
+            return true;
+        }
+
+        // Find the index of a named uniform in the uniform table
+        // Uniforms that weren't found at link time are looked up and added to the table
+        // ------------------------------------------------------------------------------
+        int find_uniform(const std::string& uniform) {
+            auto it = uniforms.find(uniform);
+            if (it != uniforms.end()) {
+                return it->second;
+            }
+            const int location = glGetUniformLocation(program, uniform.c_str());
+            check_gl_error("Failed to find uniform '{}'", uniform);
+
+            // Elements of an array that was found at link time have the type of the array and cover the rest of it
+            unsigned int type     = GL_NONE;
+            int size              = 0;
+            int parent            = -1;
+            const size_t bracket  = uniform.rfind('[');
+            if (location != -1 && bracket != std::string::npos && uniform.back() == ']') {
+                auto array = uniforms.find(uniform.substr(0, bracket));
+                if (array != uniforms.end()) {
+                    parent            = array->second;
+                    const int element = std::atoi(uniform.c_str() + bracket + 1);
+                    type              = uniform_table[parent].type;
+                    size              = std::max(uniform_table[parent].size - element, 0);
+                }
+            }
+
+            const int index = add_uniform(uniform, location, type, size);
+            if (parent != -1) {
+                uniform_table[index].parent = parent;
+                uniform_table[parent].elements.push_back(index);
+            }
+            return index;
+        }
+        int add_uniform(const std::string& uniform,
+                        const int& location,
+                        const unsigned int& type = GL_NONE,
+                        const int& size          = 0) {
+            auto it = uniforms.find(uniform);
+            if (it != uniforms.end()) {
+                uniform_info& info = uniform_table[it->second];
+                info.location      = location;
+                info.type          = type;
+                info.size          = size;
+                info.shadow.clear();
+                return it->second;
+            }
+            uniform_info info;
+            info.name     = uniform;
+            info.location = location;
+            info.type     = type;
+            info.size     = size;
+            uniform_table.push_back(std::move(info));
+            uniforms[uniform] = static_cast<int>(uniform_table.size()) - 1;
+            return uniforms[uniform];
+        }
+
+        struct uniform_info : uniform_reflection {
+            // Index of the array that this uniform is an element of, and of the elements that were looked up
+            int parent = -1;
+            std::vector<int> elements;
+            // Bytes of the last value that was uploaded, empty if we don't know what the uniform holds
+            std::vector<unsigned char> shadow;
+        };
+
+        std::vector<shader_object> shaders;
+        unsigned int program;
+        std::map<std::string, int> uniforms;
+        std::vector<uniform_info> uniform_table;
+        uniform_statistics uniform_stats;
+
+        // Directory to cache program binaries in, empty if caching is disabled
+        std::string binary_cache;
+        // Shader sources that haven't been compiled yet, only used when caching
+        std::vector<shader_source> sources;
+
+        // True between link_async and wait
+        bool linking = false;
+        // True if wait found compile or link errors
+        bool failed = false;
+        // Where to save the program binary once it has been linked, empty if it shouldn't be saved
+        std::string cache_file;
+        // Preprocessor defines to inject into every shader
+        shader_defines defines;
+    };
+
+    // A set of shaders that can be specialised with different preprocessor defines
+    // Each distinct set of defines is compiled into its own program the first time that it is asked for, and the same
+    // program is returned every time after that
+    // ----------------------------------------------------------------------------------------------------------------
+    struct shader_variants {
+        // Cache the binaries for every variant in the given directory (see shader_program::use_binary_cache)
+        // --------------------------------------------------------------------------------------------------
+        void use_binary_cache(const std::string& directory) {
+            binary_cache = directory;
+        }
+
+        // Add a shader source file to every variant
+        // ------------------------------------------------------------------------------------
+        // shader_source: Path to file that contains the shader source code
+        // shader_type: The type of the shader that is being added (vertex, fragment, geometry)
+        // ------------------------------------------------------------------------------------
+        void add_shader(const std::string& shader_source, const ShaderType& shader_type) {
+            if (!programs.empty()) {
+                throw std::system_error(std::error_code(EINVAL, std::system_category()),
+                                        "Shaders must be added before any variants are created");
+            }
+            shader_files.emplace_back(shader_source, shader_type);
+        }
+
+        // Get the program for a set of defines, compiling it if this is the first time it has been asked for
+        // Programs are linked asynchronously, so asking for every variant up front lets them compile in parallel.
+        // Compile and link errors are only reported once the program is used (see shader_program::wait), a variant
+        // that failed is compiled again the next time it is asked for, in place so references to it stay valid
+        // --------------------------------------------------------------------------------------------------------
+        // defines: The defines that specialise this variant
+        // --------------------------------------------------------------------------------------------------------
+        shader_program& get(const shader_defines& defines) {
+            auto it = programs.find(defines);
+            if (it != programs.end() && !it->second.link_failed()) {
+                return it->second;
+            }
+
+            // Missing shader files throw here, before the cache is touched
+            shader_program program;
+            if (!binary_cache.empty()) {
+                program.use_binary_cache(binary_cache);
+            }
+            program.set_defines(defines);
+            for (const auto& shader : shader_files) {
+                program.add_shader(shader.first, shader.second);
+            }
+            program.link_async();
+
+            if (it != programs.end()) {
+                // The failed program is deleted along with the local
+                std::swap(it->second, program);
+                return it->second;
+            }
+            return programs.emplace(defines, std::move(program)).first->second;
+        }
+
+        // Number of variants that have been created
+        // -----------------------------------------
+        size_t size() const {
+            return programs.size();
+        }
+
+    private:
+        std::vector<std::pair<std::string, ShaderType>> shader_files;
+        std::string binary_cache;
+        std::map<shader_defines, shader_program> programs;
+    };
+
+    // Compile-time descriptions of vertex formats
+    // A layout lists the attributes of a vertex struct, and the stride, offsets, and GL types of every attribute are
+    // worked out from the C++ types so that they never have to be written out by hand (see vertex_array::add_layout)
+    // ---------------------------------------------------------------------------------------------------------------
+    namespace vertex_format {
+        // Convert between 32-bit floats and 16-bit half floats, rounding to the nearest half
+        // ---------------------------------------------------------------------------------
+        inline uint16_t float_to_half(const float& value) {
+            uint32_t bits = 0;
+            std::memcpy(&bits, &value, sizeof(bits));
+            const uint32_t sign = (bits >> 16) & 0x8000u;
+            bits &= 0x7FFFFFFFu;
+
+            uint32_t half = 0;
+            if (bits >= 0x47800000u) {
+                // Too big for a half, or already infinity or NaN
+                half = bits > 0x7F800000u ? 0x7E00u : 0x7C00u;
+            }
+            else if (bits < 0x38800000u) {
+                // Too small for a normal half, let the FPU round the mantissa into place for us
+                const uint32_t magic_bits = 0x3F000000u;
+                float magic               = 0.0f;
+                float scaled              = 0.0f;
+                std::memcpy(&magic, &magic_bits, sizeof(magic));
+                std::memcpy(&scaled, &bits, sizeof(scaled));
+                scaled += magic;
+                std::memcpy(&half, &scaled, sizeof(half));
+                half -= magic_bits;
+            }
+            else {
+                // Rebias the exponent and round the mantissa to nearest even
+                const uint32_t odd = (bits >> 13) & 1u;
+                bits += 0xC8000FFFu + odd;
+                half = bits >> 13;
+            }
+            return static_cast<uint16_t>(half | sign);
+        }
+        inline float half_to_float(const uint16_t& half) {
+            const uint32_t exponent_mask = 0x7C00u << 13;
+            uint32_t bits                = (half & 0x7FFFu) << 13;
+            const uint32_t exponent      = bits & exponent_mask;
+            bits += (127 - 15) << 23;
+            if (exponent == exponent_mask) {
+                // Infinity or NaN
+                bits += (128 - 16) << 23;
+            }
+            else if (exponent == 0) {
+                // Zero or subnormal, renormalise
+                const uint32_t magic_bits = 113u << 23;
+                float magic               = 0.0f;
+                float value               = 0.0f;
+                bits += 1u << 23;
+                std::memcpy(&magic, &magic_bits, sizeof(magic));
+                std::memcpy(&value, &bits, sizeof(value));
+                value -= magic;
+                std::memcpy(&bits, &value, sizeof(bits));
+            }
+            bits |= static_cast<uint32_t>(half & 0x8000u) << 16;
+            float value = 0.0f;
+            std::memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+
+        // A 16-bit half float component (GL_HALF_FLOAT)
+        // ---------------------------------------------
+        struct half {
+            half() = default;
+            explicit half(const float& value) : bits(float_to_half(value)) {}
+            explicit operator float() const {
+                return half_to_float(bits);
+            }
+            uint16_t bits;
+        };
+
+        // An integer component that the shader reads as a float in [0, 1] (unsigned) or [-1, 1] (signed)
+        // ----------------------------------------------------------------------------------------------
+        template <typename Int>
+        struct normalised {
+            static_assert(std::is_integral<Int>::value && sizeof(Int) <= 2, "Normalised components are 8 or 16-bit");
+            normalised() = default;
+            explicit normalised(const float& value) {
+                const float low  = std::is_signed<Int>::value ? -1.0f : 0.0f;
+                const float high = static_cast<float>(std::numeric_limits<Int>::max());
+                this->value      = static_cast<Int>(std::round(std::min(std::max(value, low), 1.0f) * high));
+            }
+            explicit operator float() const {
+                const float high = static_cast<float>(std::numeric_limits<Int>::max());
+                return std::max(static_cast<float>(value) / high, -1.0f);
+            }
+            Int value;
+        };
+
+        // Four signed normalised components packed into 32 bits, 10 bits each for x, y, z and 2 bits for w
+        // (GL_INT_2_10_10_10_REV), good for normals and tangents
+        // ------------------------------------------------------------------------------------------------
+        struct packed_10_10_10_2 {
+            packed_10_10_10_2() = default;
+            explicit packed_10_10_10_2(const glm::vec4& value) {
+                auto pack = [](const float& component, const float& high, const unsigned int& shift) {
+                    const float clamped = std::min(std::max(component, -1.0f), 1.0f);
+                    const int packed    = static_cast<int>(std::round(clamped * high));
+                    const uint32_t mask = shift == 30 ? 0x3u : 0x3FFu;
+                    return (static_cast<uint32_t>(packed) & mask) << shift;
+                };
+                bits = pack(value.x, 511.0f, 0) | pack(value.y, 511.0f, 10) | pack(value.z, 511.0f, 20)
+                       | pack(value.w, 1.0f, 30);
+            }
+            explicit packed_10_10_10_2(const glm::vec3& value) : packed_10_10_10_2(glm::vec4(value, 0.0f)) {}
+            uint32_t bits;
+        };
+
+        // Number of components, GL type, and whether integer components are normalised for an attribute type
+        // --------------------------------------------------------------------------------------------------
+        template <typename T>
+        struct traits;
+        template <unsigned int Type, int Components, bool Normalised = false>
+        struct basic_traits {
+            static constexpr unsigned int type = Type;
+            static constexpr int components    = Components;
+            static constexpr bool normalised   = Normalised;
+        };
+        template <>
+        struct traits<float> : basic_traits<GL_FLOAT, 1> {};
+        template <>
+        struct traits<glm::vec2> : basic_traits<GL_FLOAT, 2> {};
+        template <>
+        struct traits<glm::vec3> : basic_traits<GL_FLOAT, 3> {};
+        template <>
+        struct traits<glm::vec4> : basic_traits<GL_FLOAT, 4> {};
+        template <>
+        struct traits<half> : basic_traits<GL_HALF_FLOAT, 1> {};
+        // Plain integers are converted to floats without normalising them
+        template <>
+        struct traits<int8_t> : basic_traits<GL_BYTE, 1> {};
+        template <>
+        struct traits<uint8_t> : basic_traits<GL_UNSIGNED_BYTE, 1> {};
+        template <>
+        struct traits<int16_t> : basic_traits<GL_SHORT, 1> {};
+        template <>
+        struct traits<uint16_t> : basic_traits<GL_UNSIGNED_SHORT, 1> {};
+        template <>
+        struct traits<int32_t> : basic_traits<GL_INT, 1> {};
+        template <>
+        struct traits<uint32_t> : basic_traits<GL_UNSIGNED_INT, 1> {};
+        template <typename Int>
+        struct traits<normalised<Int>> : basic_traits<traits<Int>::type, 1, true> {};
+        template <>
+        struct traits<packed_10_10_10_2> : basic_traits<GL_INT_2_10_10_10_REV, 4, true> {};
+        // Arrays of single components make vectors, e.g. std::array<half, 2> for half float texture coordinates
+        template <typename T, size_t N>
+        struct traits<std::array<T, N>> : basic_traits<traits<T>::type, N, traits<T>::normalised> {
+            static_assert(traits<T>::components == 1, "Attribute arrays must be made of single components");
+            static_assert(N >= 1 && N <= 4, "Attributes have 1 to 4 components");
+        };
+
+        // Everything glVertexAttribPointer needs to know about one attribute
+        // ------------------------------------------------------------------
+        struct attribute_format {
+            unsigned int location;
+            int components;
+            unsigned int type;
+            bool normalised;
+            size_t stride;
+            size_t offset;
+
+            template <typename T>
+            static attribute_format of(const unsigned int& location, const size_t& stride, const size_t& offset) {
+                return {location, traits<T>::components, traits<T>::type, traits<T>::normalised, stride, offset};
+            }
+        };
+
+        // A member of a vertex struct at a shader attribute location
+        // Example: attribute<0, glm::vec3, offsetof(Vertex, position)>
+        // ------------------------------------------------------------
+        template <unsigned int Location, typename T, size_t Offset>
+        struct attribute {
+            using value_type = T;
+            static constexpr unsigned int location() {
+                return Location;
+            }
+            static constexpr size_t offset() {
+                return Offset;
+            }
+        };
+
+        // The attributes of a vertex struct, the stride is the size of the struct
+        // -----------------------------------------------------------------------
+        template <typename Vertex, typename... Attributes>
+        struct layout {
+            static constexpr size_t stride() {
+                return sizeof(Vertex);
+            }
+            // Check that every attribute lies inside the struct
+            static constexpr bool fits() {
+                const size_t ends[] = {(Attributes::offset() + sizeof(typename Attributes::value_type))..., 0};
+                for (const size_t& end : ends) {
+                    if (end > sizeof(Vertex)) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            static std::array<attribute_format, sizeof...(Attributes)> formats() {
+                static_assert(fits(), "Vertex attribute lies outside of the vertex struct");
+                return {{attribute_format::of<typename Attributes::value_type>(
+                    Attributes::location(), stride(), Attributes::offset())...}};
+            }
+        };
+
+        // Attributes that are packed one after the other with no padding, at locations 0, 1, 2, ...
+        // For interleaved arrays of floats, e.g. packed_layout<glm::vec3, glm::vec2> for a position and a texture
+        // coordinate in every 5 floats
+        // -------------------------------------------------------------------------------------------------------
+        template <typename... Ts>
+        struct packed_layout {
+            static constexpr size_t stride() {
+                const size_t sizes[] = {sizeof(Ts)..., 0};
+                size_t stride        = 0;
+                for (const size_t& size : sizes) {
+                    stride += size;
+                }
+                return stride;
+            }
+
+            static std::array<attribute_format, sizeof...(Ts)> formats() {
+                std::array<attribute_format, sizeof...(Ts)> formats = {{attribute_format::of<Ts>(0, stride(), 0)...}};
+                const size_t sizes[] = {sizeof(Ts)..., 0};
+                size_t offset        = 0;
+                for (size_t i = 0; i < formats.size(); ++i) {
+                    formats[i].location = static_cast<unsigned int>(i);
+                    formats[i].offset   = offset;
+                    offset += sizes[i];
+                }
+                return formats;
+            }
+        };
+    }  // namespace vertex_format
+
+    // Create a wrapper for OpenGL vertex arrays
+    // -----------------------------------------
+    struct vertex_array {
+        // Create a single vertex array
+        // ----------------------------
+        vertex_array() {
+            glGenVertexArrays(1, &VAO);
+            check_gl_error("Failed to generate vertex array");
+        }
+        vertex_array(const vertex_array& va) = delete;  // : VAO(va.VAO) {}
+        vertex_array(vertex_array&& va) noexcept : VAO(std::exchange(va.VAO, 0)) {}
+        // Delete the vertex array
+        // -----------------------
+        ~vertex_array() {
+            if (VAO != 0) {
+#ifndef NDEBUG
+                std::cout << "Deleting vertex array" << std::endl;
+#endif
+                get_deletion_queue().delete_vertex_array(VAO);
+            }
+        }
+        vertex_array& operator=(const vertex_array& va) = delete;  // {
+        //     VAO = va.VAO;
+        //     return *this;
+        // }
+        vertex_array& operator=(vertex_array&& va) {
+            VAO = std::exchange(va.VAO, 0);
+            return *this;
+        }
+
+        // Bind the vertex array and make it active
+        // ----------------------------------------
+        void bind() {
+            if (get_state().bind_vertex_array(VAO)) {
+                check_gl_error("Failed to bind vertex array");
+            }
+        }
+        // Deactivate the vertex array
+        // ---------------------------
+        void unbind() {
+            if (get_state().bind_vertex_array(0)) {
+                check_gl_error("Failed to unbind vertex array");
+            }
+        }
+
+        // Add a vertex attribute to the vertex array
+        // ------------------------------------------
+        template <typename Scalar>
+        void add_vertex_attrib(const unsigned int& location,
+                               const int& size,
+                               const int& width,
+                               const unsigned int& type,
+                               const bool& normalised,
+                               const unsigned int& offset) {
+            bind();
+            glVertexAttribPointer(location,
+                                  size,
+                                  type,
+                                  normalised ? GL_TRUE : GL_FALSE,
+                                  width * sizeof(Scalar),
+                                  (void*) (offset * sizeof(Scalar)));
+            check_gl_error("Failed to create vertex attribute pointer");
+            glEnableVertexAttribArray(location);
+            check_gl_error("Failed to enable vertex attribute pointer");
+        }
+
+        // Add a vertex attribute described by a vertex_format
+        // ----------------------------------------------------
+        void add_vertex_attrib(const vertex_format::attribute_format& format) {
+            bind();
+            glVertexAttribPointer(format.location,
+                                  format.components,
+                                  format.type,
+                                  format.normalised ? GL_TRUE : GL_FALSE,
+                                  static_cast<GLsizei>(format.stride),
+                                  reinterpret_cast<void*>(format.offset));
+            check_gl_error("Failed to create vertex attribute pointer for location {}", format.location);
+            glEnableVertexAttribArray(format.location);
+            check_gl_error("Failed to enable vertex attribute pointer for location {}", format.location);
+        }
+
+        // Add every attribute in a vertex layout (see vertex_format::layout and vertex_format::packed_layout)
+        // The vertex buffer with the data must be bound to GL_ARRAY_BUFFER
+        // ---------------------------------------------------------------------------------------------------
+        template <typename Layout>
+        void add_layout() {
+            for (const auto& format : Layout::formats()) {
+                add_vertex_attrib(format);
+            }
+        }
+
+        // Allow this vertex array wrapper to be passed OpenGL functions
+        // OpenGL functions expect an unsigned int
+        // -------------------------------------------------------------
+        operator unsigned int() const {
+            return VAO;
+        }
+
+    private:
+        unsigned int VAO;
+    };
+
+    // Reallocate a buffer with a new capacity, keeping the first size bytes of its data
+    // The buffer keeps its name, so vertex arrays that refer to it don't need to be set up again
+    // The old data is copied out to a scratch buffer and back on the GPU, it never comes back to the CPU
+    // --------------------------------------------------------------------------------------------------
+    inline void reallocate_buffer(const unsigned int& buffer,
+                                  const size_t& size,
+                                  const size_t& capacity,
+                                  const unsigned int& usage) {
+        state& gl_state = get_state();
+        if (size == 0) {
+            gl_state.bind_buffer(GL_COPY_WRITE_BUFFER, buffer);
+            glBufferData(GL_COPY_WRITE_BUFFER, capacity, nullptr, usage);
+            check_gl_error("Failed to allocate {} bytes of buffer storage", capacity);
+            return;
+        }
+
+        unsigned int scratch = 0;
+        glGenBuffers(1, &scratch);
+        gl_state.bind_buffer(GL_COPY_WRITE_BUFFER, scratch);
+        glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STREAM_COPY);
+        gl_state.bind_buffer(GL_COPY_READ_BUFFER, buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, size);
+
+        gl_state.bind_buffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, capacity, nullptr, usage);
+        gl_state.bind_buffer(GL_COPY_READ_BUFFER, scratch);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, size);
+
+        glDeleteBuffers(1, &scratch);
+        gl_state.forget_buffer(scratch);
+        check_gl_error("Failed to grow buffer from {} to {} bytes", size, capacity);
+    }
+
+    // Capacity to grow a buffer to so that it can hold required bytes
+    // Grows geometrically like std::vector so that repeatedly appending data doesn't reallocate every time
+    // ----------------------------------------------------------------------------------------------------
+    inline size_t grow_capacity(const size_t& capacity, const size_t& required) {
+        return std::max(required, capacity * 2);
+    }
+
+    // Storage shared by vertex_buffer and element_buffer: the buffer object, how much of it is in use, and growing,
+    // updating, orphaning, and mapping it. These go through GL_COPY_WRITE_BUFFER so that they don't disturb the
+    // element buffer of the bound vertex array
+    // -------------------------------------------------------------------------------------------------------------
+    struct resizable_buffer {
+        // Make sure the buffer can hold at least capacity bytes without reallocating, keeping its contents
+        // ------------------------------------------------------------------------------------------------
+        // capacity: The number of bytes to make room for
+        // usage: Usage hint if the buffer hasn't been allocated yet (GL_DYNAMIC_DRAW, GL_STREAM_DRAW, ...)
+        // ------------------------------------------------------------------------------------------------
+        void reserve(const size_t& capacity, const unsigned int& usage = GL_DYNAMIC_DRAW) {
+            if (capacity > allocated) {
+                if (allocated == 0) {
+                    draw_method = usage;
+                }
+                reallocate_buffer(buffer, used, capacity, draw_method);
+                allocated = capacity;
+            }
+        }
+
+        // Throw away the contents of the buffer without changing its capacity
+        // The driver hands back fresh storage straight away instead of waiting for the GPU to finish with the old
+        // data, use this before rewriting the whole buffer while the GPU may still be drawing from it
+        // -------------------------------------------------------------------------------------------------------
+        void orphan() {
+            used = 0;
+            // There is no storage to give back yet
+            if (allocated == 0) {
+                return;
+            }
+            get_state().bind_buffer(GL_COPY_WRITE_BUFFER, buffer);
+            glBufferData(GL_COPY_WRITE_BUFFER, allocated, nullptr, draw_method);
+            check_gl_error("Failed to orphan {} buffer", kind);
+        }
+
+        // Map part of the buffer into client memory so that it can be written directly, call unmap when done
+        // Use GL_MAP_INVALIDATE_RANGE_BIT if the old data in the range isn't needed anymore so the driver doesn't
+        // have to keep it, or GL_MAP_INVALIDATE_BUFFER_BIT to orphan the whole buffer
+        // --------------------------------------------------------------------------------------------------------
+        // offset: The byte offset of the range to map
+        // length: The number of bytes to map
+        // access: GL_MAP_*_BIT flags that say how the range will be used
+        // --------------------------------------------------------------------------------------------------------
+        template <typename T = void>
+        T* map_range(const size_t& offset,
+                     const size_t& length,
+                     const unsigned int& access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT) {
+            get_state().bind_buffer(GL_COPY_WRITE_BUFFER, buffer);
+            void* data = glMapBufferRange(GL_COPY_WRITE_BUFFER, offset, length, access);
+            if (data == nullptr) {
+                throw_gl_error(glGetError(),
+                               fmt::format("Failed to map {} bytes of {} buffer at offset {}", length, kind, offset));
+            }
+            if ((access & GL_MAP_WRITE_BIT) != 0) {
+                used = std::max(used, offset + length);
+            }
+            return static_cast<T*>(data);
+        }
+        void unmap() {
+            get_state().bind_buffer(GL_COPY_WRITE_BUFFER, buffer);
+            if (glUnmapBuffer(GL_COPY_WRITE_BUFFER) == GL_FALSE) {
+                throw_gl_error(GL_INVALID_OPERATION, fmt::format("The {} buffer's data was lost while mapped", kind));
+            }
+            check_gl_error("Failed to unmap {} buffer", kind);
+        }
+
+        // Number of bytes of data in the buffer and the number of bytes that it can hold without reallocating
+        // ---------------------------------------------------------------------------------------------------
+        size_t size() const {
+            return used;
+        }
+        size_t capacity() const {
+            return allocated;
+        }
+
+        // Allow this buffer wrapper to be passed OpenGL functions
+        // OpenGL functions expect an unsigned int
+        // -------------------------------------------------------
+        operator unsigned int() const {
+            return buffer;
+        }
+
+    protected:
+        // kind: What the buffer holds, for messages
+        explicit resizable_buffer(const char* kind) : kind(kind) {
+            glGenBuffers(1, &buffer);
+            check_gl_error("Failed to generate {} buffer", kind);
+        }
+        resizable_buffer(const resizable_buffer& other) = delete;
+        resizable_buffer(resizable_buffer&& other) noexcept
+            : buffer(std::exchange(other.buffer, 0))
+            , used(std::exchange(other.used, 0))
+            , allocated(std::exchange(other.allocated, 0))
+            , draw_method(other.draw_method)
+            , kind(other.kind) {}
+        ~resizable_buffer() {
+            release();
+        }
+        resizable_buffer& operator=(const resizable_buffer& other) = delete;
+        resizable_buffer& operator=(resizable_buffer&& other) noexcept {
+            if (this != &other) {
+                release();
+                buffer      = std::exchange(other.buffer, 0);
+                used        = std::exchange(other.used, 0);
+                allocated   = std::exchange(other.allocated, 0);
+                draw_method = other.draw_method;
+            }
+            return *this;
+        }
+
+        // Replace the whole contents of the buffer, which has to be bound to target
+        void copy(const unsigned int& target, const void* data, const size_t& bytes, const unsigned int& usage) {
+            glBufferData(target, bytes, data, usage);
+            used        = bytes;
+            allocated   = bytes;
+            draw_method = usage;
+        }
+
+        // Copy bytes into part of the buffer, growing it like a std::vector if they go past the end
+        void write(const size_t& offset, const void* data, const size_t& bytes) {
+            if (offset + bytes > allocated) {
+                reserve(grow_capacity(allocated, offset + bytes));
+            }
+            get_state().bind_buffer(GL_COPY_WRITE_BUFFER, buffer);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, offset, bytes, data);
+            check_gl_error("Failed to update {} bytes of {} buffer at offset {}", bytes, kind, offset);
+            used = std::max(used, offset + bytes);
+        }
+
+        unsigned int buffer = 0;
+        // Bytes of data in the buffer, bytes allocated, and the usage hint it was allocated with
+        size_t used              = 0;
+        size_t allocated         = 0;
+        unsigned int draw_method = GL_STATIC_DRAW;
+
+    private:
+        void release() {
+            if (buffer != 0) {
+#ifndef NDEBUG
+                std::cout << "Deleting " << kind << " buffer" << std::endl;
+#endif
+                get_deletion_queue().delete_buffer(buffer);
+                buffer = 0;
+            }
+        }
+
+        const char* kind;
+    };
+
+    // Create a wrapper for OpenGL vertex buffers
+    // ------------------------------------------
+    struct vertex_buffer : resizable_buffer {
+        // Create a single vertex buffer
+        // -----------------------------
+        vertex_buffer() : resizable_buffer("vertex") {}
+        vertex_buffer(const vertex_buffer& vb) = delete;
+        vertex_buffer(vertex_buffer&& vb) noexcept = default;
+        vertex_buffer& operator=(const vertex_buffer& vb) = delete;
+        vertex_buffer& operator=(vertex_buffer&& vb) noexcept = default;
+
+        // Bind the vertex buffer and make it active
+        // -----------------------------------------
+        void bind() {
+            if (get_state().bind_buffer(GL_ARRAY_BUFFER, buffer)) {
+                check_gl_error("Failed to bind vertex buffer");
+            }
+        }
+        // Deactivate the vertex buffer
+        // ----------------------------
+        void unbind() {
+            if (get_state().bind_buffer(GL_ARRAY_BUFFER, 0)) {
+                check_gl_error("Failed to unbind vertex buffer");
+            }
+        }
+
+        // Copy vertex buffer data to the GPU
+        // ----------------------------------
+        template <int N>
+        void copy_data(const std::array<float, N>& vertices, const unsigned int& draw_method) {
+            bind();
+            copy(GL_ARRAY_BUFFER, &vertices[0], N * sizeof(float), draw_method);
+            check_gl_error("Failed to copy statically-allocated vertex buffer data");
+        }
+        template <typename T>
+        void copy_data(const std::vector<T>& vertices, const unsigned int& draw_method) {
+            bind();
+            copy(GL_ARRAY_BUFFER, &vertices[0], vertices.size() * sizeof(T), draw_method);
+            check_gl_error("Failed to copy dynamically-allocated vertex buffer data");
+        }
+
+        // Copy data into part of the buffer without reallocating it
+        // The buffer grows like a std::vector if the data goes past the end of it
+        // -----------------------------------------------------------------------
+        // offset: The byte offset in the buffer to copy the data to
+        // data: The vertex data to copy
+        // count: The number of elements in data
+        // -----------------------------------------------------------------------
+        template <typename T>
+        void update(const size_t& offset, const T* data, const size_t& count) {
+            write(offset, data, count * sizeof(T));
+        }
+        template <typename T>
+        void update(const size_t& offset, const std::vector<T>& data) {
+            update(offset, data.data(), data.size());
+        }
+    };
+
+    // GL type of the indices in an element buffer
+    // -------------------------------------------
+    template <typename T>
+    struct index_traits;
+    template <>
+    struct index_traits<uint8_t> {
+        static constexpr unsigned int type = GL_UNSIGNED_BYTE;
+    };
+    template <>
+    struct index_traits<uint16_t> {
+        static constexpr unsigned int type = GL_UNSIGNED_SHORT;
+    };
+    template <>
+    struct index_traits<uint32_t> {
+        static constexpr unsigned int type = GL_UNSIGNED_INT;
+    };
+    // Size in bytes of one index of the given GL type
+    inline size_t index_size(const unsigned int& type) {
+        switch (type) {
+            case GL_UNSIGNED_BYTE: return 1;
+            case GL_UNSIGNED_SHORT: return 2;
+            case GL_UNSIGNED_INT: return 4;
+            default: throw_gl_error(GL_INVALID_ENUM, fmt::format("Invalid index type '{}'", type)); return 0;
+        }
+    }
+
+    // Create a wrapper for OpenGL element buffers
+    // -------------------------------------------
+    struct element_buffer : resizable_buffer {
+        // Create a single element buffer
+        // ------------------------------
+        element_buffer() : resizable_buffer("element") {}
+        element_buffer(const element_buffer& eb) = delete;
+        element_buffer(element_buffer&& eb) noexcept = default;
+        element_buffer& operator=(const element_buffer& eb) = delete;
+        element_buffer& operator=(element_buffer&& eb) noexcept = default;
+
+        // Bind the element buffer and make it active
+        // ------------------------------------------
+        void bind() {
+            if (get_state().bind_buffer(GL_ELEMENT_ARRAY_BUFFER, buffer)) {
+                check_gl_error("Failed to bind element buffer");
+            }
+        }
+        // Deactivate the element buffer
+        // -----------------------------
+        void unbind() {
+            if (get_state().bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 0)) {
+                check_gl_error("Failed to unbind element buffer");
+            }
+        }
+
+        // Copy the element buffer data to the GPU
+        // The buffer remembers the type of the indices (8, 16, or 32-bit) for draw calls, see type()
+        // ------------------------------------------------------------------------------------------
+        template <int N, typename Index>
+        void copy_data(const std::array<Index, N>& indices, const unsigned int& draw_method) {
+            bind();
+            copy(GL_ELEMENT_ARRAY_BUFFER, &indices[0], N * sizeof(Index), draw_method);
+            check_gl_error("Failed to copy statically-allocated element buffer data");
+            index_type = index_traits<Index>::type;
+        }
+        template <typename Index>
+        void copy_data(const std::vector<Index>& indices, const unsigned int& draw_method) {
+            bind();
+            copy(GL_ELEMENT_ARRAY_BUFFER, &indices[0], indices.size() * sizeof(Index), draw_method);
+            check_gl_error("Failed to copy dynamically-allocated element buffer data");
+            index_type = index_traits<Index>::type;
+        }
+
+        // Copy indices into part of the buffer without reallocating it
+        // The buffer grows like a std::vector if the indices go past the end of it
+        // ------------------------------------------------------------------------
+        // offset: The byte offset in the buffer to copy the indices to
+        // indices: The indices to copy
+        // count: The number of indices
+        // ------------------------------------------------------------------------
+        template <typename Index>
+        void update(const size_t& offset, const Index* indices, const size_t& count) {
+            // All of the indices in a buffer have to be the same type
+            if (used > 0 && index_type != index_traits<Index>::type) {
+                throw_gl_error(GL_INVALID_OPERATION,
+                               fmt::format("Can't update an element buffer of type {} with indices of type {}",
+                                           index_type,
+                                           index_traits<Index>::type));
+            }
+            index_type = index_traits<Index>::type;
+            write(offset, indices, count * sizeof(Index));
+        }
+        template <typename Index>
+        void update(const size_t& offset, const std::vector<Index>& indices) {
+            update(offset, indices.data(), indices.size());
+        }
+
+        // GL type of the indices in the buffer (GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT, or GL_UNSIGNED_INT) and the
+        // number of indices, for draw calls
+        // ------------------------------------------------------------------------------------------------------
+        unsigned int type() const {
+            return index_type;
+        }
+        size_t count() const {
+            return used / index_size(index_type);
+        }
+
+    private:
+        unsigned int index_type = GL_UNSIGNED_INT;
+    };
+
+    // Sub-allocates vertex and index data out of a few large buffers (arenas)
+    // Every mesh that is put in a pool shares the arena buffers with the other meshes instead of creating buffers of
+    // its own, so loading many meshes makes a handful of GL allocations and drawing them needs fewer buffer binds
+    // Free ranges are kept sorted by offset so that neighbouring ranges merge when they are freed, and allocations take
+    // the smallest free range that fits (best fit). A request that is bigger than the arena size gets an arena of its
+    // own. The pool has to outlive everything that was allocated from it
+    // ---------------------------------------------------------------------------------------------------------------
+    struct buffer_pool {
+        // A range of one of the arenas
+        struct allocation {
+            size_t arena  = 0;
+            size_t offset = 0;
+            size_t size   = 0;
+        };
+        // An allocation that was moved by defragment
+        struct relocation {
+            allocation from;
+            allocation to;
+        };
+        struct statistics {
+            size_t arenas       = 0;
+            size_t capacity     = 0;
+            size_t used         = 0;
+            size_t free         = 0;
+            size_t largest_free = 0;
+            size_t free_ranges  = 0;
+            size_t allocations  = 0;
+
+            // How much of the free space can't be used for an allocation of all of it, 0 when the free space is in
+            // one range and close to 1 when it is split into many small ranges
+            // -----------------------------------------------------------------------------------------------------
+            double fragmentation() const {
+                return free == 0 ? 0.0 : 1.0 - static_cast<double>(largest_free) / static_cast<double>(free);
+            }
+        };
+
+        // Create an empty pool, arenas are only created when they are needed
+        // ------------------------------------------------------------------------------------------
+        // arena_size: The size in bytes of each arena
+        // draw_method: The usage hint for the arena buffers
+        // ------------------------------------------------------------------------------------------
+        buffer_pool(const size_t& arena_size = 32 << 20, const unsigned int& draw_method = GL_STATIC_DRAW)
+            : arena_size(arena_size), draw_method(draw_method) {}
+        buffer_pool(const buffer_pool& bp) = delete;
+        buffer_pool(buffer_pool&& bp) noexcept
+            : arenas(std::exchange(bp.arenas, {})), arena_size(bp.arena_size), draw_method(bp.draw_method) {}
+        // Delete all of the arenas
+        // ------------------------
+        ~buffer_pool() {
+            release();
+        }
+        buffer_pool& operator=(const buffer_pool& bp) = delete;
+        buffer_pool& operator=(buffer_pool&& bp) {
+            if (this == &bp) {
+                return *this;
+            }
+            release();
+            arenas      = std::exchange(bp.arenas, {});
+            arena_size  = bp.arena_size;
+            draw_method = bp.draw_method;
+            return *this;
+        }
+
+        // Reserve a range of the pool
+        // ------------------------------------------------------------------------------------------------------
+        // requested: The number of bytes to reserve
+        // alignment: The offset of the range is a multiple of this, use the vertex size for vertex data so that
+        //            offset / vertex size can be used as the base vertex of a draw
+        // ------------------------------------------------------------------------------------------------------
+        allocation allocate(const size_t& requested, const size_t& alignment = 4) {
+            // Empty allocations still take a byte so that every allocation has its own offset
+            const size_t size = std::max<size_t>(requested, 1);
+
+            // Find the smallest free range that still fits once its offset has been aligned
+            size_t best_arena  = arenas.size();
+            size_t best_offset = 0;
+            size_t best_size   = std::numeric_limits<size_t>::max();
+            for (size_t i = 0; i < arenas.size(); ++i) {
+                for (const auto& range : arenas[i].free_ranges) {
+                    const size_t offset = align(range.first, alignment);
+                    if (offset + size <= range.first + range.second && range.second < best_size) {
+                        best_arena  = i;
+                        best_offset = offset;
+                        best_size   = range.second;
+                    }
+                }
+            }
+            if (best_arena == arenas.size()) {
+                best_offset = 0;
+                add_arena(std::max(arena_size, size));
+            }
+
+            arena& a = arenas[best_arena];
+            // Take the range out of the free range that contains it, the space left on either side stays free
+            auto range               = std::prev(a.free_ranges.upper_bound(best_offset));
+            const size_t range_start = range->first;
+            const size_t range_end   = range->first + range->second;
+            a.free_ranges.erase(range);
+            if (best_offset > range_start) {
+                a.free_ranges[range_start] = best_offset - range_start;
+            }
+            if (best_offset + size < range_end) {
+                a.free_ranges[best_offset + size] = range_end - (best_offset + size);
+            }
+            a.allocations[best_offset] = std::make_pair(size, alignment);
+
+            return allocation{best_arena, best_offset, size};
+        }
+
+        // Give a range back to the pool
+        // -----------------------------
+        void free(const allocation& range) {
+            arena& a = arenas.at(range.arena);
+            if (a.allocations.erase(range.offset) == 0) {
+                throw_gl_error(
+                    GL_INVALID_VALUE,
+                    fmt::format("No allocation at offset {} of buffer pool arena {}", range.offset, range.arena));
+            }
+
+            // Merge with the free ranges on either side
+            size_t start = range.offset;
+            size_t end   = range.offset + range.size;
+            auto next    = a.free_ranges.lower_bound(start);
+            if (next != a.free_ranges.end() && next->first == end) {
+                end  = next->first + next->second;
+                next = a.free_ranges.erase(next);
+            }
+            if (next != a.free_ranges.begin()) {
+                auto previous = std::prev(next);
+                if (previous->first + previous->second == start) {
+                    start = previous->first;
+                    a.free_ranges.erase(previous);
+                }
+            }
+            a.free_ranges[start] = end - start;
+        }
+
+        // Copy data into part of an allocation
+        // ---------------------------------------------------------------
+        // range: The allocation to copy to
+        // data: The data to copy
+        // size: The number of bytes to copy
+        // offset: The byte offset of the data in the allocation
+        // ---------------------------------------------------------------
+        void update(const allocation& range, const void* data, const size_t& size, const size_t& offset = 0) {
+            if (offset + size > range.size) {
+                throw_gl_error(GL_INVALID_VALUE,
+                               fmt::format("Can't copy {} bytes at offset {} of a {} byte allocation",
+                                           size,
+                                           offset,
+                                           range.size));
+            }
+            get_state().bind_buffer(GL_COPY_WRITE_BUFFER, buffer(range));
+            glBufferSubData(GL_COPY_WRITE_BUFFER, range.offset + offset, size, data);
+            check_gl_error("Failed to copy {} bytes to buffer pool arena {}", size, range.arena);
+        }
+        template <typename T>
+        void update(const allocation& range, const std::vector<T>& data) {
+            update(range, data.data(), data.size() * sizeof(T));
+        }
+
+        // Move every allocation down to the start of its arena so that the free space in each arena is in one range
+        // The data is copied on the GPU through a scratch buffer. Returns the allocations that moved, so that their
+        // owners can update their offsets (e.g. the base vertex and first index of their draws)
+        // ----------------------------------------------------------------------------------------------------------
+        std::vector<relocation> defragment() {
+            std::vector<relocation> moved;
+            state& gl_state = get_state();
+            for (size_t i = 0; i < arenas.size(); ++i) {
+                arena& a = arenas[i];
+                // Nothing to do if the only free range (if any) is already at the end
+                const bool compact = a.free_ranges.empty()
+                                     || (a.free_ranges.size() == 1
+                                         && a.free_ranges.begin()->first + a.free_ranges.begin()->second == a.size);
+                if (compact) {
+                    continue;
+                }
+                if (a.allocations.empty()) {
+                    a.free_ranges.clear();
+                    a.free_ranges[0] = a.size;
+                    continue;
+                }
+
+                // Work out where everything goes
+                std::map<size_t, std::pair<size_t, size_t>> packed;
+                std::map<size_t, size_t> gaps;
+                std::vector<std::pair<size_t, size_t>> moves;
+                size_t end = 0;
+                for (const auto& block : a.allocations) {
+                    const size_t offset = align(end, block.second.second);
+                    packed[offset]      = block.second;
+                    // Padding for alignment is still free space
+                    if (offset > end) {
+                        gaps[end] = offset - end;
+                    }
+                    moves.emplace_back(block.first, offset);
+                    end = offset + block.second.first;
+                }
+
+                // Copy the allocations into a scratch buffer in their new layout, then back in one go
+                unsigned int scratch = 0;
+                glGenBuffers(1, &scratch);
+                gl_state.bind_buffer(GL_COPY_WRITE_BUFFER, scratch);
+                glBufferData(GL_COPY_WRITE_BUFFER, end, nullptr, GL_STREAM_COPY);
+                gl_state.bind_buffer(GL_COPY_READ_BUFFER, a.buffer);
+                for (const auto& move : moves) {
+                    glCopyBufferSubData(GL_COPY_READ_BUFFER,
+                                        GL_COPY_WRITE_BUFFER,
+                                        move.first,
+                                        move.second,
+                                        a.allocations[move.first].first);
+                }
+                gl_state.bind_buffer(GL_COPY_WRITE_BUFFER, a.buffer);
+                gl_state.bind_buffer(GL_COPY_READ_BUFFER, scratch);
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, end);
+                glDeleteBuffers(1, &scratch);
+                gl_state.forget_buffer(scratch);
+                check_gl_error("Failed to defragment buffer pool arena {}", i);
+
+                for (const auto& move : moves) {
+                    if (move.first != move.second) {
+                        const size_t size = a.allocations[move.first].first;
+                        moved.push_back(relocation{allocation{i, move.first, size}, allocation{i, move.second, size}});
+                    }
+                }
+                a.allocations = std::move(packed);
+                a.free_ranges = std::move(gaps);
+                if (end < a.size) {
+                    a.free_ranges[end] = a.size - end;
+                }
+            }
+            return moved;
+        }
+
+        // The buffer that an allocation (or arena) is in, bind it to GL_ARRAY_BUFFER or GL_ELEMENT_ARRAY_BUFFER
+        // ------------------------------------------------------------------------------------------------------
+        unsigned int buffer(const allocation& range) const {
+            return arenas.at(range.arena).buffer;
+        }
+        unsigned int buffer(const size_t& arena) const {
+            return arenas.at(arena).buffer;
+        }
+
+        // Get the space used and how fragmented the free space is across all arenas
+        // -------------------------------------------------------------------------
+        statistics get_statistics() const {
+            statistics stats;
+            stats.arenas = arenas.size();
+            for (const arena& a : arenas) {
+                stats.capacity += a.size;
+                stats.free_ranges += a.free_ranges.size();
+                stats.allocations += a.allocations.size();
+                for (const auto& range : a.free_ranges) {
+                    stats.free += range.second;
+                    stats.largest_free = std::max(stats.largest_free, range.second);
+                }
+            }
+            stats.used = stats.capacity - stats.free;
+            return stats;
+        }
+
+    private:
+        struct arena {
+            unsigned int buffer;
+            size_t size;
+            // Offset -> size of each free range
+            std::map<size_t, size_t> free_ranges;
+            // Offset -> size and alignment of each allocation
+            std::map<size_t, std::pair<size_t, size_t>> allocations;
+        };
+
+        static size_t align(const size_t& offset, const size_t& alignment) {
+            return (offset + alignment - 1) / alignment * alignment;
+        }
+
+        void add_arena(const size_t& size) {
+            arena a;
+            glGenBuffers(1, &a.buffer);
+            get_state().bind_buffer(GL_COPY_WRITE_BUFFER, a.buffer);
+            glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, draw_method);
+            check_gl_error("Failed to allocate a {} byte buffer pool arena", size);
+            a.size           = size;
+            a.free_ranges[0] = size;
+            arenas.push_back(std::move(a));
+        }
+
+        // Queue every arena for deletion
+        void release() {
+            for (const arena& a : arenas) {
+                if (a.buffer != 0) {
+#ifndef NDEBUG
+                    std::cout << "Deleting buffer pool arena" << std::endl;
+#endif
+                    get_deletion_queue().delete_buffer(a.buffer);
+                }
+            }
+            arenas.clear();
+        }
+
+        std::vector<arena> arenas;
+        size_t arena_size;
+        unsigned int draw_method;
+    };
+
+    // Compile-time std140 layout rules
+    // The std140 layout is the portable layout for uniform blocks, so a C++ struct that follows these rules can be
+    // copied straight into a uniform buffer
+    // See: OpenGL 3.3 specification section 2.11.4 "Standard Uniform Block Layout"
+    // -------------------------------------------------------------------------------------------------------------
+    namespace std140 {
+        template <typename... Ts>
+        struct make_void {
+            using type = void;
+        };
+
+        constexpr size_t align_up(const size_t& value, const size_t& alignment) {
+            return ((value + alignment - 1) / alignment) * alignment;
+        }
+
+        // Base alignment and size of a type in a std140 block
+        // ---------------------------------------------------
+        template <typename T, typename = void>
+        struct traits;
+        template <>
+        struct traits<float> {
+            static constexpr size_t alignment = 4;
+            static constexpr size_t size      = 4;
+        };
+        template <>
+        struct traits<int> {
+            static constexpr size_t alignment = 4;
+            static constexpr size_t size      = 4;
+        };
+        template <>
+        struct traits<unsigned int> {
+            static constexpr size_t alignment = 4;
+            static constexpr size_t size      = 4;
+        };
+        template <>
+        struct traits<glm::vec2> {
+            static constexpr size_t alignment = 8;
+            static constexpr size_t size      = 8;
+        };
+        template <>
+        struct traits<glm::vec3> {
+            static constexpr size_t alignment = 16;
+            static constexpr size_t size      = 12;
+        };
+        template <>
+        struct traits<glm::vec4> {
+            static constexpr size_t alignment = 16;
+            static constexpr size_t size      = 16;
+        };
+        // Matrices are stored as arrays of column vectors
+        template <>
+        struct traits<glm::mat3> {
+            static constexpr size_t alignment = 16;
+            static constexpr size_t size      = 48;
+        };
+        template <>
+        struct traits<glm::mat4> {
+            static constexpr size_t alignment = 16;
+            static constexpr size_t size      = 64;
+        };
+        // Array elements are padded out to a multiple of a vec4
+        template <typename T, size_t N>
+        struct traits<std::array<T, N>> {
+            static constexpr size_t alignment = align_up(traits<T>::alignment, 16);
+            static constexpr size_t stride    = align_up(traits<T>::size, 16);
+            static constexpr size_t size      = stride * N;
+        };
+        // Structs describe their members with a std140_layout
+        template <typename T>
+        struct traits<T, typename make_void<typename T::std140_layout>::type> {
+            static constexpr size_t alignment = T::std140_layout::alignment();
+            static constexpr size_t size      = T::std140_layout::size();
+        };
+
+        // Calculate the std140 offsets of a list of struct members
+        // Use this to static_assert that a C++ struct matches the layout that the shader will expect
+        // ------------------------------------------------------------------------------------------
+        template <typename... Ts>
+        struct layout {
+            static constexpr size_t count = sizeof...(Ts);
+
+            // Offset of the member at the given index
+            static constexpr size_t offset(const size_t& index) {
+                const size_t alignments[] = {traits<Ts>::alignment...};
+                const size_t sizes[]      = {traits<Ts>::size...};
+                size_t offset             = 0;
+                for (size_t i = 0; i < index; ++i) {
+                    offset = align_up(offset, alignments[i]) + sizes[i];
+                }
+                return align_up(offset, alignments[index]);
+            }
+            // Structs are aligned to the largest member alignment, rounded up to a vec4
+            static constexpr size_t alignment() {
+                const size_t alignments[] = {traits<Ts>::alignment...};
+                size_t alignment          = 16;
+                for (size_t i = 0; i < count; ++i) {
+                    alignment = alignments[i] > alignment ? alignments[i] : alignment;
+                }
+                return alignment;
+            }
+            // Structs are padded out to a multiple of their alignment
+            static constexpr size_t size() {
+                const size_t sizes[] = {traits<Ts>::size...};
+                return align_up(offset(count - 1) + sizes[count - 1], alignment());
+            }
+        };
+    }  // namespace std140
+
+    // Create a wrapper for OpenGL uniform buffers
+    // -------------------------------------------
+    struct uniform_buffer {
+        // Create a single uniform buffer
+        // ------------------------------
+        uniform_buffer() {
+            glGenBuffers(1, &UBO);
+            check_gl_error("Failed to generate uniform buffer");
+        }
+        uniform_buffer(const uniform_buffer& ub) = delete;
+        uniform_buffer(uniform_buffer&& ub) noexcept : UBO(std::exchange(ub.UBO, 0)) {}
+        // Delete the uniform buffer
+        // -------------------------
+        ~uniform_buffer() {
+            release();
+        }
+        uniform_buffer& operator=(const uniform_buffer& ub) = delete;
+        uniform_buffer& operator=(uniform_buffer&& ub) {
+            if (this == &ub) {
+                return *this;
+            }
+            release();
+            UBO = std::exchange(ub.UBO, 0);
+            return *this;
+        }
+
+        // Bind the uniform buffer and make it active
+        // ------------------------------------------
+        void bind() {
+            if (get_state().bind_buffer(GL_UNIFORM_BUFFER, UBO)) {
+                check_gl_error("Failed to bind uniform buffer");
+            }
+        }
+        // Deactivate the uniform buffer
+        // -----------------------------
+        void unbind() {
+            if (get_state().bind_buffer(GL_UNIFORM_BUFFER, 0)) {
+                check_gl_error("Failed to unbind uniform buffer");
+            }
+        }
+
+        // Attach the uniform buffer to a binding point
+        // Every program that has a uniform block bound to the same binding point (see
+        // shader_program::bind_uniform_block) will read from this buffer
+        // ---------------------------------------------------------------------------
+        // binding: The uniform buffer binding point to attach to
+        // ---------------------------------------------------------------------------
+        void bind_base(const unsigned int& binding) {
+            if (get_state().bind_buffer_base(GL_UNIFORM_BUFFER, binding, UBO)) {
+                check_gl_error("Failed to bind uniform buffer to binding point {}", binding);
+            }
+        }
+
+        // Allocate the uniform buffer and copy a std140 struct to the GPU
+        // ---------------------------------------------------------------
+        template <typename T>
+        void copy_data(const T& data, const unsigned int& draw_method) {
+            static_assert(std::is_standard_layout<T>::value, "Uniform buffer data must be a standard layout type");
+            static_assert(sizeof(T) == std140::traits<T>::size, "Uniform buffer data does not match its std140 layout");
+            bind();
+            glBufferData(GL_UNIFORM_BUFFER, sizeof(T), &data, draw_method);
+            check_gl_error("Failed to copy uniform buffer data");
+        }
+        // Update part of the uniform buffer without reallocating it
+        // ------------------------------------------------------------------
+        // data: The data to copy to the GPU
+        // offset: The byte offset of the data in the buffer (see offsetof)
+        // ------------------------------------------------------------------
+        template <typename T>
+        void update(const T& data, const size_t& offset = 0) {
+            static_assert(std::is_standard_layout<T>::value, "Uniform buffer data must be a standard layout type");
+            bind();
+            glBufferSubData(GL_UNIFORM_BUFFER, offset, sizeof(T), &data);
+            check_gl_error("Failed to update uniform buffer data at offset {}", offset);
+        }
+
+        // Allow this uniform buffer wrapper to be passed OpenGL functions
+        // OpenGL functions expect an unsigned int
+        // ---------------------------------------------------------------
+        operator unsigned int() const {
+            return UBO;
+        }
+
+    private:
+        // Queue the buffer for deletion
+        void release() {
+            if (UBO != 0) {
+#ifndef NDEBUG
+                std::cout << "Deleting uniform buffer" << std::endl;
+#endif
+                get_deletion_queue().delete_buffer(UBO);
+                UBO = 0;
+            }
+        }
+
+        unsigned int UBO;
+    };
+
+    // A ring buffer for data that changes every frame, like per-object transforms, light data, or immediate geometry
+    // Data is written straight into mapped buffer memory, so the driver never has to reallocate the buffer or wait for
+    // the GPU to finish with it. Call fence() once the draws that read the data have been issued (e.g. at the end of
+    // the frame), space is only reused after the GPU has passed the fence that covers it
+    // With ARB_buffer_storage the buffer stays mapped for its whole lifetime, otherwise each write maps just the range
+    // that it writes without synchronising
+    // ----------------------------------------------------------------------------------------------------------------
+    struct stream_buffer {
+        // Create a stream buffer
+        // ------------------------------------------------------------------------------------------
+        // target: The target the data is used from (GL_ARRAY_BUFFER, GL_UNIFORM_BUFFER, ...)
+        // capacity: Size of the ring in bytes, big enough to hold a few frames worth of data
+        // ------------------------------------------------------------------------------------------
+        stream_buffer(const unsigned int& target, const size_t& capacity) : target(target), capacity(capacity) {
+            glGenBuffers(1, &buffer);
+            check_gl_error("Failed to generate stream buffer");
+
+            // Allocate through the copy target so that we don't disturb the element buffer of the bound vertex array
+            get_state().bind_buffer(GL_COPY_WRITE_BUFFER, buffer);
+            if (get_extensions().ARB_buffer_storage) {
+                const unsigned int flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+                get_extensions().buffer_storage(GL_COPY_WRITE_BUFFER, capacity, nullptr, flags);
+                check_gl_error("Failed to allocate {} bytes of stream buffer storage", capacity);
+                mapped = static_cast<unsigned char*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, capacity, flags));
+                if (mapped == nullptr) {
+                    throw_gl_error(glGetError(), "Failed to persistently map stream buffer");
+                }
+            }
+            else {
+                glBufferData(GL_COPY_WRITE_BUFFER, capacity, nullptr, GL_STREAM_DRAW);
+                check_gl_error("Failed to allocate {} bytes of stream buffer storage", capacity);
+            }
+
+            // Uniform buffer ranges have to start at a multiple of the offset alignment
+            if (target == GL_UNIFORM_BUFFER) {
+                int offset_alignment = 1;
+                glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &offset_alignment);
+                check_gl_error("Failed to get uniform buffer offset alignment");
+                alignment = std::max(offset_alignment, 1);
+            }
+        }
+        stream_buffer(const stream_buffer& sb) = delete;
+        stream_buffer(stream_buffer&& sb) noexcept
+            : buffer(std::exchange(sb.buffer, 0))
+            , target(sb.target)
+            , capacity(sb.capacity)
+            , alignment(sb.alignment)
+            , mapped(std::exchange(sb.mapped, nullptr))
+            , head(sb.head)
+            , tail(sb.tail)
+            , fences(std::move(sb.fences))
+            , stalls(sb.stalls) {
+            sb.fences.clear();
+        }
+        // Delete the stream buffer, deleting a mapped buffer also unmaps it
+        // -----------------------------------------------------------------
+        ~stream_buffer() {
+            release();
+        }
+        stream_buffer& operator=(const stream_buffer& sb) = delete;
+        stream_buffer& operator=(stream_buffer&& sb) {
+            if (this == &sb) {
+                return *this;
+            }
+            release();
+            buffer    = std::exchange(sb.buffer, 0);
+            target    = sb.target;
+            capacity  = sb.capacity;
+            alignment = sb.alignment;
+            mapped    = std::exchange(sb.mapped, nullptr);
+            head      = sb.head;
+            tail      = sb.tail;
+            fences    = std::move(sb.fences);
+            stalls    = sb.stalls;
+            sb.fences.clear();
+            return *this;
+        }
+
+        // Bind the stream buffer to its target
+        // ------------------------------------
         void bind() {
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-            throw_gl_error(glGetError(), fmt::format("Failed to bind element buffer"));
+            if (get_state().bind_buffer(target, buffer)) {
+                check_gl_error("Failed to bind stream buffer");
+            }
+        }
+        // Attach part of the stream buffer to an indexed binding point, e.g. the data from a write to a uniform block
+        // ------------------------------------------------------------------------------------------------------------
+        // binding: The binding point to attach to
+        // offset: The offset that write returned
+        // size: The number of bytes that were written
+        // ------------------------------------------------------------------------------------------------------------
+        void bind_range(const unsigned int& binding, const size_t& offset, const size_t& size) {
+            get_state().bind_buffer_range(target, binding, buffer, offset, size);
+            check_gl_error("Failed to bind {} bytes at offset {} of stream buffer to {}", size, offset, binding);
+        }
+
+        // Copy data into the next free part of the ring
+        // Blocks if the GPU is still using that part of the ring
+        // Returns the byte offset of the data in the buffer, to use with bind_range or as a vertex attribute offset
+        // ---------------------------------------------------------------------------------------------------------
+        size_t write(const void* data, const size_t& size) {
+            if (size > capacity) {
+                throw_gl_error(GL_INVALID_VALUE,
+                               fmt::format("Can't write {} bytes to a stream buffer of {} bytes", size, capacity));
+            }
+
+            // Align the start of the data, and go back to the start of the ring if it doesn't fit before the end
+            const uint64_t ring = head - (head % capacity);
+            uint64_t start      = ring + ((head - ring + alignment - 1) / alignment) * alignment;
+            if (start + size > ring + capacity) {
+                start = ring + capacity;
+            }
+            const size_t offset = static_cast<size_t>(start % capacity);
+            reserve(start + size);
+            head = start + size;
+
+            if (mapped != nullptr) {
+                std::memcpy(mapped + offset, data, size);
+            }
+            else {
+                get_state().bind_buffer(GL_COPY_WRITE_BUFFER, buffer);
+                const unsigned int flags = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+                void* range              = glMapBufferRange(GL_COPY_WRITE_BUFFER, offset, size, flags);
+                if (range == nullptr) {
+                    throw_gl_error(glGetError(), fmt::format("Failed to map {} bytes of stream buffer", size));
+                }
+                std::memcpy(range, data, size);
+                glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+                check_gl_error("Failed to unmap stream buffer");
+            }
+            return offset;
+        }
+        template <typename T>
+        size_t write(const T& data) {
+            static_assert(std::is_standard_layout<T>::value, "Stream buffer data must be a standard layout type");
+            return write(&data, sizeof(T));
+        }
+        template <typename T>
+        size_t write(const std::vector<T>& data) {
+            static_assert(std::is_standard_layout<T>::value, "Stream buffer data must be a standard layout type");
+            return write(data.data(), data.size() * sizeof(T));
+        }
+
+        // Mark everything written so far as in use until the GPU has finished the commands issued before now
+        // ---------------------------------------------------------------------------------------------------
+        void fence() {
+            if (fences.empty() ? head == tail : head == fences.back().second) {
+                return;
+            }
+            GLsync sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            check_gl_error("Failed to create stream buffer fence");
+            fences.emplace_back(sync, head);
+        }
+
+        // Number of writes that had to wait for the GPU because the ring was full
+        // A non-zero count means the ring is too small for the amount of data written each frame
+        // --------------------------------------------------------------------------------------
+        size_t stall_count() const {
+            return stalls;
+        }
+
+        // Allow this stream buffer wrapper to be passed OpenGL functions
+        // OpenGL functions expect an unsigned int
+        // --------------------------------------------------------------
+        operator unsigned int() const {
+            return buffer;
+        }
+
+    private:
+        // Queue the fences and the buffer for deletion, deleting the buffer also unmaps it
+        void release() {
+            for (auto& fence : fences) {
+                get_deletion_queue().delete_sync(fence.first);
+            }
+            fences.clear();
+            if (buffer != 0) {
+#ifndef NDEBUG
+                std::cout << "Deleting stream buffer" << std::endl;
+#endif
+                get_deletion_queue().delete_buffer(buffer);
+                buffer = 0;
+            }
+            mapped = nullptr;
+        }
+
+        // Wait until the GPU has finished with everything that the ring needs to overwrite to reach end
+        // ---------------------------------------------------------------------------------------------
+        void reserve(const uint64_t& end) {
+            while (end - tail > capacity) {
+                // The space we need hasn't been fenced yet, fence it now so that we can wait for it
+                if (fences.empty()) {
+                    fence();
+                }
+                // Nothing is in flight, so the whole ring is free
+                if (fences.empty()) {
+                    tail = end - capacity;
+                    break;
+                }
+                GLsync sync = fences.front().first;
+                tail        = fences.front().second;
+                fences.pop_front();
+
+                GLenum result = glClientWaitSync(sync, 0, 0);
+                if (result == GL_TIMEOUT_EXPIRED) {
+                    ++stalls;
+                    do {
+                        result = glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+                    } while (result == GL_TIMEOUT_EXPIRED);
+                }
+                glDeleteSync(sync);
+                if (result == GL_WAIT_FAILED) {
+                    throw_gl_error(glGetError(), "Failed to wait for stream buffer fence");
+                }
+            }
+        }
+
+        unsigned int buffer;
+        unsigned int target;
+        size_t capacity;
+        size_t alignment = 1;
+        // Persistently mapped storage, nullptr without ARB_buffer_storage
+        unsigned char* mapped = nullptr;
+        // Total bytes written and released, head - tail bytes are still in use
+        uint64_t head = 0;
+        uint64_t tail = 0;
+        // Fences and the head position when they were inserted
+        std::deque<std::pair<GLsync, uint64_t>> fences;
+        size_t stalls = 0;
+    };
+
+    // One indexed draw, laid out the way glMultiDrawElementsIndirect reads it from a draw indirect buffer
+    // ---------------------------------------------------------------------------------------------------
+    struct draw_elements_command {
+        // Number of indices to draw and the position of the first one in the element buffer
+        uint32_t count          = 0;
+        uint32_t instance_count = 1;
+        uint32_t first_index    = 0;
+        // Added to every index before it is used to fetch a vertex
+        int32_t base_vertex    = 0;
+        uint32_t base_instance = 0;
+    };
+    static_assert(sizeof(draw_elements_command) == 20, "Draw commands must be tightly packed");
+
+    // A list of draw commands that are submitted together
+    // With ARB_multi_draw_indirect the commands live in a draw indirect buffer and a whole run of them is submitted
+    // with one call. Otherwise the commands are kept on the CPU and issued one by one with glDrawElementsBaseVertex
+    // (core in 3.3), so the same code works on every driver
+    // -------------------------------------------------------------------------------------------------------------
+    struct indirect_buffer {
+        // Create an empty command list
+        // ----------------------------
+        indirect_buffer() : indirect(get_extensions().ARB_multi_draw_indirect) {
+            if (indirect) {
+                glGenBuffers(1, &buffer);
+                check_gl_error("Failed to generate draw indirect buffer");
+            }
+        }
+        indirect_buffer(const indirect_buffer& ib) = delete;
+        indirect_buffer(indirect_buffer&& ib) noexcept
+            : buffer(std::exchange(ib.buffer, 0)), indirect(ib.indirect), commands(std::move(ib.commands)) {}
+        // Delete the draw indirect buffer
+        // -------------------------------
+        ~indirect_buffer() {
+            release();
+        }
+        indirect_buffer& operator=(const indirect_buffer& ib) = delete;
+        indirect_buffer& operator=(indirect_buffer&& ib) {
+            if (this == &ib) {
+                return *this;
+            }
+            release();
+            buffer   = std::exchange(ib.buffer, 0);
+            indirect = ib.indirect;
+            commands = std::move(ib.commands);
+            return *this;
+        }
+
+        // Copy the draw commands to the GPU
+        // ---------------------------------
+        void copy_data(const std::vector<draw_elements_command>& commands, const unsigned int& draw_method) {
+            this->commands = commands;
+            if (indirect && !commands.empty()) {
+                get_state().bind_buffer(GL_DRAW_INDIRECT_BUFFER, buffer);
+                glBufferData(GL_DRAW_INDIRECT_BUFFER,
+                             commands.size() * sizeof(draw_elements_command),
+                             commands.data(),
+                             draw_method);
+                check_gl_error("Failed to copy {} draw commands", commands.size());
+            }
+        }
+
+        // Draw a run of consecutive commands with the vertex array and element buffer that are currently bound
+        // ------------------------------------------------------------------------------------------------------
+        // mode: The kind of primitives to draw (GL_TRIANGLES, ...)
+        // type: The type of the indices in the element buffer (see element_buffer::type)
+        // first: The first command to draw
+        // count: The number of commands to draw
+        // ------------------------------------------------------------------------------------------------------
+        void draw(const unsigned int& mode, const unsigned int& type, const size_t& first, const size_t& count) {
+            if (indirect) {
+                get_state().bind_buffer(GL_DRAW_INDIRECT_BUFFER, buffer);
+                get_extensions().multi_draw_elements_indirect(
+                    mode,
+                    type,
+                    reinterpret_cast<const void*>(first * sizeof(draw_elements_command)),
+                    static_cast<GLsizei>(count),
+                    0);
+                check_gl_error("Failed to draw {} indirect commands", count);
+                return;
+            }
+
+            const size_t size = index_size(type);
+            for (size_t i = first; i < first + count; ++i) {
+                const draw_elements_command& command = commands[i];
+                glDrawElementsBaseVertex(mode,
+                                         command.count,
+                                         type,
+                                         reinterpret_cast<const void*>(command.first_index * size),
+                                         command.base_vertex);
+            }
+            check_gl_error("Failed to draw {} commands", count);
+        }
+
+        // Number of commands in the list
+        // ------------------------------
+        size_t size() const {
+            return commands.size();
+        }
+
+    private:
+        // Queue the draw indirect buffer for deletion
+        void release() {
+            if (buffer != 0) {
+#ifndef NDEBUG
+                std::cout << "Deleting draw indirect buffer" << std::endl;
+#endif
+                get_deletion_queue().delete_buffer(buffer);
+                buffer = 0;
+            }
+        }
+
+        // Only created with ARB_multi_draw_indirect
+        unsigned int buffer = 0;
+        bool indirect;
+        // CPU copy of the commands for drivers without ARB_multi_draw_indirect
+        std::vector<draw_elements_command> commands;
+    };
+
+    // What happens to the CPU copy of a texture's image or a mesh's vertices once it has been uploaded to the GPU
+    // ----------------------------------------------------------------------------------------------------------
+    enum class residency {
+        // Free the copy as soon as it has been uploaded, the data then only lives on the GPU
+        release,
+        // Keep the copy, for picking, collision, or uploading it again
+        keep
+    };
+
+    // Bytes of an image, owned either by a vector or by the image decoder
+    // Decoded images are adopted straight from the decoder's buffer, instead of being copied into a vector
+    // ----------------------------------------------------------------------------------------------------
+    struct pixel_buffer {
+        pixel_buffer() = default;
+        explicit pixel_buffer(std::vector<unsigned char>&& pixels) : owned(std::move(pixels)) {}
+        // Adopt a buffer that is freed with release, e.g. SOIL_free_image_data
+        pixel_buffer(unsigned char* pixels, const size_t& size, void (*release)(unsigned char*))
+            : adopted(pixels, release), adopted_size(size) {}
+        pixel_buffer(const pixel_buffer& buffer) = delete;
+        pixel_buffer(pixel_buffer&& buffer) noexcept
+            : owned(std::move(buffer.owned))
+            , adopted(std::move(buffer.adopted))
+            , adopted_size(std::exchange(buffer.adopted_size, 0)) {}
+        pixel_buffer& operator=(const pixel_buffer& buffer) = delete;
+        pixel_buffer& operator=(pixel_buffer&& buffer) noexcept {
+            owned        = std::move(buffer.owned);
+            adopted      = std::move(buffer.adopted);
+            adopted_size = std::exchange(buffer.adopted_size, 0);
+            return *this;
+        }
+
+        const unsigned char* data() const {
+            return adopted ? adopted.get() : owned.data();
+        }
+        size_t size() const {
+            return adopted ? adopted_size : owned.size();
+        }
+        bool empty() const {
+            return size() == 0;
+        }
+
+        // Free the bytes
+        // --------------
+        void clear() {
+            std::vector<unsigned char>().swap(owned);
+            adopted.reset();
+            adopted_size = 0;
+        }
+
+    private:
+        std::vector<unsigned char> owned;
+        std::unique_ptr<unsigned char, void (*)(unsigned char*)> adopted{nullptr, nullptr};
+        size_t adopted_size = 0;
+    };
+
+    // Pixels of a decoded image file
+    // DDS and KTX files keep their blocks in compressed instead, with channels and pixels left empty
+    // Images from decode_with_mipmaps also have levels 1 and below of their mip chain in mipmaps
+    // ----------------------------------------------------------------------------------------------
+    struct image_data {
+        std::string path;
+        int width    = 0;
+        int height   = 0;
+        int channels = 0;
+        pixel_buffer pixels;
+        compressed_image compressed;
+        std::vector<std::vector<unsigned char>> mipmaps;
+    };
+
+    namespace detail {
+        // SOIL keeps its last result in a global string and isn't documented as reentrant, so only one thread decodes
+        // with it at a time. Reading the files, compressing, and filtering mip chains still run in parallel
+        inline std::mutex& soil_mutex() {
+            static std::mutex mutex;
+            return mutex;
+        }
+
+        // Key for the cache entry of an image file: FNV-1a of the file, followed by a version number for whatever
+        // builds the entry so that changing it rebuilds the cache
+        inline uint64_t cache_key(const std::vector<unsigned char>& file, const uint64_t& version) {
+            uint64_t hash = 14695981039346656037ull;
+            for (const unsigned char& byte : file) {
+                hash = (hash ^ byte) * 1099511628211ull;
+            }
+            return (hash ^ version) * 1099511628211ull;
+        }
+
+        // Write a cache entry to a temporary file and rename it, so nobody can read a half written entry
+        // Failing to write the cache isn't an error, the entry is just built again next time
+        template <typename F>
+        void write_cache_entry(const std::string& cache_file, F&& save) {
+            const std::string temporary =
+                fmt::format("{}.{}.tmp", cache_file, std::hash<std::thread::id>()(std::this_thread::get_id()));
+            if (!save(temporary) || std::rename(temporary.c_str(), cache_file.c_str()) != 0) {
+                std::remove(temporary.c_str());
+#ifndef NDEBUG
+                std::cout << fmt::format("Failed to write texture cache '{}'", cache_file) << std::endl;
+#endif
+            }
+        }
+
+        // Decode an image file that has already been read into memory, the caller frees the pixels with
+        // SOIL_free_image_data
+        inline unsigned char* decode_file(const std::vector<unsigned char>& file, image_data& image) {
+            unsigned char* data = nullptr;
+            std::string result;
+            {
+                std::lock_guard<std::mutex> lock(soil_mutex());
+                data   = SOIL_load_image_from_memory(file.data(),
+                                                   static_cast<int>(file.size()),
+                                                   &image.width,
+                                                   &image.height,
+                                                   &image.channels,
+                                                   SOIL_LOAD_AUTO);
+                result = SOIL_last_result();
+            }
+            if (data == nullptr) {
+                throw_gl_error(GL_INVALID_OPERATION,
+                               fmt::format("File: {} == Data: ({}, {}, {}) -> '{}'",
+                                           image.path,
+                                           image.width,
+                                           image.height,
+                                           image.channels,
+                                           result));
+            }
+            return data;
+        }
+    }  // namespace detail
+
+    // Decode an image file into memory
+    // This doesn't make any OpenGL calls, so it can run on a worker thread (see texture_cache::load_async)
+    // ----------------------------------------------------------------------------------------------------
+    inline image_data decode_image(const std::string& path) {
+        image_data image;
+        image.path = path;
+        if (is_compressed_container(path)) {
+            image.compressed = load_compressed_image(path);
+            image.width      = image.compressed.width;
+            image.height     = image.compressed.height;
+#ifndef NDEBUG
+            std::cout << fmt::format("File: {} == Data: ({}, {}, {} with {} levels)",
+                                     path,
+                                     image.width,
+                                     image.height,
+                                     compressed_format_name(image.compressed.format),
+                                     image.compressed.levels.size())
+                      << std::endl;
+#endif
+            return image;
+        }
+        // Keep SOIL's result with the image, another thread can overwrite it as soon as the lock is released
+        unsigned char* data = nullptr;
+        std::string result;
+        {
+            std::lock_guard<std::mutex> lock(detail::soil_mutex());
+            data   = SOIL_load_image(path.c_str(), &image.width, &image.height, &image.channels, SOIL_LOAD_AUTO);
+            result = SOIL_last_result();
+        }
+        if (data == nullptr) {
+            throw_gl_error(GL_INVALID_OPERATION,
+                           fmt::format("File: {} == Data: ({}, {}, {}) -> '{}'",
+                                       path,
+                                       image.width,
+                                       image.height,
+                                       image.channels,
+                                       result));
+        }
+#ifndef NDEBUG
+        std::cout << fmt::format("File: {} == Data: ({}, {}, {}) -> '{}'",
+                                 path,
+                                 image.width,
+                                 image.height,
+                                 image.channels,
+                                 result)
+                  << std::endl;
+#endif
+        // Keep the decoder's buffer rather than copying it
+        image.pixels = pixel_buffer(data, image.width * image.height * image.channels, SOIL_free_image_data);
+        return image;
+    }
+
+    // Decode an image file and compress it to BC1 or BC3 along with its mip chain (see compress_image)
+    // The compressed image is saved in the cache directory, keyed on the contents of the file, so later runs skip
+    // both decoding and compressing. Images that can't be compressed are returned as decode_image returns them
+    // This doesn't make any OpenGL calls either, so it can run on a worker thread
+    // -----------------------------------------------------------------------------------------------------------
+    // path: Path to the image file
+    // cache_directory: Existing directory to keep the compressed images in, or empty to compress every time
+    // -----------------------------------------------------------------------------------------------------------
+    inline image_data decode_and_compress_image(const std::string& path, const std::string& cache_directory) {
+        if (is_compressed_container(path)) {
+            return decode_image(path);
+        }
+
+        // Version 1 of the encoder
+        const std::vector<unsigned char> file = detail::read_file(path);
+        const uint64_t hash                   = detail::cache_key(file, 1);
+        const std::string cache_file =
+            cache_directory.empty() ? "" : fmt::format("{}/{:016x}.dds", cache_directory, hash);
+
+        image_data image;
+        image.path = path;
+        if (!cache_file.empty() && std::ifstream(cache_file).good()) {
+            // Another thread (or run) may still be writing the file, if it is incomplete just compress again
+            try {
+                image.compressed = load_dds(cache_file);
+                image.width      = image.compressed.width;
+                image.height     = image.compressed.height;
+#ifndef NDEBUG
+                std::cout << fmt::format("Compressed texture cache hit for '{}' in '{}'", path, cache_file)
+                          << std::endl;
+#endif
+                return image;
+            }
+            catch (const std::system_error&) {
+                image.compressed = compressed_image();
+            }
         }
-        // Deactivate the element buffer
-        // -----------------------------
-        void unbind() {
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-            throw_gl_error(glGetError(), fmt::format("Failed to unbind element buffer"));
+
+        unsigned char* data = detail::decode_file(file, image);
+        image.compressed    = compress_image(data, image.width, image.height, image.channels);
+        if (image.compressed.format == GL_NONE) {
+            image.pixels = pixel_buffer(data, image.width * image.height * image.channels, SOIL_free_image_data);
+        }
+        else {
+            SOIL_free_image_data(data);
         }
+#ifndef NDEBUG
+        std::cout << fmt::format("File: {} == Data: ({}, {}, {}) -> {}",
+                                 path,
+                                 image.width,
+                                 image.height,
+                                 image.channels,
+                                 compressed_format_name(image.compressed.format))
+                  << std::endl;
+#endif
 
-        // Copy the element buffer data to the GPU
-        // ---------------------------------------
-        template <int N>
-        void copy_data(const std::array<unsigned int, N>& indices, const unsigned int& draw_method) {
-            bind();
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER, N * sizeof(unsigned int), &indices[0], draw_method);
-            throw_gl_error(glGetError(), fmt::format("Failed to copy statically-allocated element buffer data"));
+        if (!cache_file.empty() && image.compressed.format != GL_NONE) {
+            detail::write_cache_entry(cache_file, [&image](const std::string& temporary) {
+                return save_dds(temporary, image.compressed);
+            });
         }
-        void copy_data(const std::vector<unsigned int>& indices, const unsigned int& draw_method) {
-            bind();
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], draw_method);
-            throw_gl_error(glGetError(), fmt::format("Failed to copy dynamically-allocated element buffer data"));
+        return image;
+    }
+
+    // Decode an image file and generate its mip chain on the CPU (see generate_mip_chain), so the driver doesn't
+    // have to generate it after the upload. The chain is saved in the cache directory, keyed on the contents of the
+    // file, so later runs skip both decoding and filtering. DDS and KTX files are returned as decode_image returns
+    // them, since they bring their own levels
+    // This doesn't make any OpenGL calls either, so it can run on a worker thread
+    // -------------------------------------------------------------------------------------------------------------
+    // path: Path to the image file
+    // srgb: Whether the colour channels are sRGB encoded, true for colour maps and false for data maps
+    // cache_directory: Existing directory to keep the mip chains in, or empty to generate them on every run
+    // max_size: Largest width or height of a cached image, GL_MAX_TEXTURE_SIZE (bigger ones are decoded again)
+    // -------------------------------------------------------------------------------------------------------------
+    inline image_data decode_with_mipmaps(const std::string& path,
+                                          const bool& srgb,
+                                          const std::string& cache_directory,
+                                          const int& max_size) {
+        if (is_compressed_container(path)) {
+            return decode_image(path);
         }
 
-        // Allow this element buffer wrapper to be passed OpenGL functions
-        // OpenGL functions expect an unsigned int
-        // ---------------------------------------------------------------
-        operator unsigned int() const {
-            return EBO;
+        // Cache key versions 2 (data maps) and 3 (colour maps) are the first version of the downsampler, so that the
+        // two colour spaces of one file differ and neither collides with the block compressor's version 1
+        const std::vector<unsigned char> file = detail::read_file(path);
+        const uint64_t hash                   = detail::cache_key(file, srgb ? 3 : 2);
+        const std::string cache_file =
+            cache_directory.empty() ? "" : fmt::format("{}/{:016x}.mip", cache_directory, hash);
+
+        image_data image;
+        image.path = path;
+        std::vector<unsigned char> cached;
+        if (!cache_file.empty()
+            && load_mip_chain(
+                cache_file, max_size, image.width, image.height, image.channels, cached, image.mipmaps)) {
+#ifndef NDEBUG
+            std::cout << fmt::format("Mip chain cache hit for '{}' in '{}'", path, cache_file) << std::endl;
+#endif
+            image.pixels = pixel_buffer(std::move(cached));
+            return image;
         }
 
-    private:
-        unsigned int EBO;
-    };
+        unsigned char* data = detail::decode_file(file, image);
+        image.pixels        = pixel_buffer(data, image.width * image.height * image.channels, SOIL_free_image_data);
+        image.mipmaps       = generate_mip_chain(data, image.width, image.height, image.channels, srgb);
+#ifndef NDEBUG
+        std::cout << fmt::format("File: {} == Data: ({}, {}, {}) -> {} mip levels",
+                                 path,
+                                 image.width,
+                                 image.height,
+                                 image.channels,
+                                 image.mipmaps.size() + 1)
+                  << std::endl;
+#endif
+
+        if (!cache_file.empty()) {
+            detail::write_cache_entry(cache_file, [&image](const std::string& temporary) {
+                return save_mip_chain(
+                    temporary, image.width, image.height, image.channels, image.pixels.data(), image.mipmaps);
+            });
+        }
+        return image;
+    }
 
     // Create a wrapper for OpenGL textures
     // ------------------------------------
@@ -746,7 +3169,7 @@ namespace gl {
         // ------------------------------
         texture(const TextureType& texture_type, const TextureStyle& texture_style = TextureStyle::TEXTURE_DIFFUSE) {
             glGenTextures(1, &tex);
-            throw_gl_error(glGetError(), fmt::format("Failed to generate texture"));
+            check_gl_error("Failed to generate texture");
             this->texture_type  = texture_type;
             this->texture_style = texture_style;
             texture_data.clear();
@@ -760,28 +3183,10 @@ namespace gl {
                 const TextureType& texture_type,
                 const TextureStyle& texture_style = TextureStyle::TEXTURE_DIFFUSE) {
             glGenTextures(1, &tex);
-            throw_gl_error(glGetError(), fmt::format("Failed to generate texture"));
+            check_gl_error("Failed to generate texture");
             this->texture_type  = texture_type;
             this->texture_style = texture_style;
-            this->texture_path  = image;
-
-            unsigned char* data = SOIL_load_image(image.c_str(), &width, &height, &channels, SOIL_LOAD_AUTO);
-            texture_data.clear();
-            if (data == nullptr) {
-                throw_gl_error(
-                    GL_INVALID_OPERATION,
-                    fmt::format(
-                        "File: {} == Data: ({}, {}, {}) -> '{}'", image, width, height, channels, SOIL_last_result()));
-            }
-            else {
-#ifndef NDEBUG
-                std::cout << fmt::format(
-                    "File: {} == Data: ({}, {}, {}) -> '{}'", image, width, height, channels, SOIL_last_result())
-                          << std::endl;
-#endif
-                texture_data.assign(data, data + (width * height * channels));
-                SOIL_free_image_data(data);
-            }
+            load_data(decode_image(image));
         }
         texture(const texture& other_texture) = delete;
         texture(texture&& other_texture) noexcept
@@ -792,97 +3197,192 @@ namespace gl {
             , width(std::exchange(other_texture.width, 0))
             , height(std::exchange(other_texture.height, 0))
             , channels(std::exchange(other_texture.channels, 0))
-            , texture_data(std::move(other_texture.texture_data)) {}
+            , layers(std::exchange(other_texture.layers, 1))
+            , texture_data(std::move(other_texture.texture_data))
+            , compressed_data(std::move(other_texture.compressed_data))
+            , mipmap_data(std::move(other_texture.mipmap_data))
+            , cpu_residency(other_texture.cpu_residency)
+            , immutable(std::exchange(other_texture.immutable, false))
+            , precomputed_mipmaps(std::exchange(other_texture.precomputed_mipmaps, false))
+            , uploaded(std::exchange(other_texture.uploaded, false)) {}
         // Delete the texture
         // ------------------
         ~texture() {
-            if (glIsTexture(tex) == GL_TRUE) {
+            if (tex != 0) {
 #ifndef NDEBUG
                 std::cout << "Deleting texture " << tex << std::endl;
 #endif
-                glDeleteTextures(1, &tex);
-                throw_gl_error(glGetError(), fmt::format("Failed to delete texture"));
+                get_deletion_queue().delete_texture(tex);
             }
         }
         texture& operator=(const texture& other_texture) = delete;
         texture& operator                                =(texture&& other_texture) {
-            tex           = std::exchange(other_texture.tex, 0);
-            texture_type  = std::exchange(other_texture.texture_type, TextureType::UNKNOWN);
-            texture_style = std::exchange(other_texture.texture_style, TextureStyle::UNKNOWN);
-            texture_path  = std::move(other_texture.texture_path);
-            width         = std::exchange(other_texture.width, 0);
-            height        = std::exchange(other_texture.height, 0);
-            channels      = std::exchange(other_texture.channels, 0);
-            texture_data  = std::move(other_texture.texture_data);
+            tex                 = std::exchange(other_texture.tex, 0);
+            texture_type        = std::exchange(other_texture.texture_type, TextureType::UNKNOWN);
+            texture_style       = std::exchange(other_texture.texture_style, TextureStyle::UNKNOWN);
+            texture_path        = std::move(other_texture.texture_path);
+            width               = std::exchange(other_texture.width, 0);
+            height              = std::exchange(other_texture.height, 0);
+            channels            = std::exchange(other_texture.channels, 0);
+            layers              = std::exchange(other_texture.layers, 1);
+            texture_data        = std::move(other_texture.texture_data);
+            compressed_data     = std::move(other_texture.compressed_data);
+            mipmap_data         = std::move(other_texture.mipmap_data);
+            cpu_residency       = other_texture.cpu_residency;
+            immutable           = std::exchange(other_texture.immutable, false);
+            precomputed_mipmaps = std::exchange(other_texture.precomputed_mipmaps, false);
+            uploaded            = std::exchange(other_texture.uploaded, false);
             return *this;
         }
 
         // Load texture data from the provided array
-        // -------------------------------------------------
+        // A texture with immutable storage is given a new texture object
+        // --------------------------------------------------------------
         // data: Array of bytes to load into the texture
         // width: Width of the texture data
         // height: Height of the texture data
         // channels: Number of channels in the texture data
-        // -------------------------------------------------
+        // --------------------------------------------------------------
         void load_data(const std::vector<unsigned char>& data,
                        const unsigned int& width,
                        const unsigned int& height,
                        const unsigned int& channels) {
-            texture_data.clear();
-            texture_data.assign(data.begin(), data.end());
+            reset_storage();
+            texture_data = pixel_buffer(std::vector<unsigned char>(data.begin(), data.end()));
+            mipmap_data.clear();
             this->width    = width;
             this->height   = height;
             this->channels = channels;
         }
         // Load texture data from the provided array
-        // -------------------------------------------------
+        // A texture with immutable storage is given a new texture object
+        // --------------------------------------------------------------
         // data: Array of bytes to load into the texture
         // width: Width of the texture data
         // height: Height of the texture data
         // channels: Number of channels in the texture data
-        // -------------------------------------------------
+        // --------------------------------------------------------------
         void load_data(const unsigned char* data,
                        const unsigned int& width,
                        const unsigned int& height,
                        const unsigned int& channels) {
-            texture_data.clear();
-            texture_data.assign(data, data + (width * height * channels));
+            reset_storage();
+            texture_data = pixel_buffer(std::vector<unsigned char>(data, data + (width * height * channels)));
+            mipmap_data.clear();
             this->width    = width;
             this->height   = height;
             this->channels = channels;
         }
+        // Take the pixels of a decoded image (see decode_image), and its mip chain if it has one
+        // A texture with immutable storage is given a new texture object
+        // --------------------------------------------------------------------------------------
+        void load_data(image_data&& image) {
+            reset_storage();
+            texture_data    = std::move(image.pixels);
+            compressed_data = std::move(image.compressed);
+            mipmap_data     = std::move(image.mipmaps);
+            texture_path    = std::move(image.path);
+            this->width     = image.width;
+            this->height    = image.height;
+            this->channels  = image.channels;
+        }
+
+        // Stack decoded images into the layers of this texture, for a TEXTURE_2D_ARRAY texture
+        // Every image must have the same size, number of channels, and compressed format, and the same number of
+        // compressed or precomputed mip levels, which are stacked level by level so generate uploads the whole chain.
+        // Decode them with texture_cache::decode_async so they are never uploaded on their own
+        // ------------------------------------------------------------------------------------------------------------
+        // images: The images to use for each layer, in layer order
+        // ------------------------------------------------------------------------------------------------------------
+        void load_layers(std::vector<image_data>&& images) {
+            if (images.empty()) {
+                throw_gl_error(GL_INVALID_VALUE, "A texture array needs at least one layer");
+            }
+            reset_storage();
+            const image_data& first = images.front();
+            std::vector<unsigned char> stacked_pixels;
+            compressed_data        = compressed_image();
+            compressed_data.format = first.compressed.format;
+            compressed_data.width  = first.width;
+            compressed_data.height = first.height;
+            compressed_data.levels.resize(first.compressed.levels.size());
+            std::vector<std::vector<unsigned char>> stacked_mipmaps(first.mipmaps.size());
+            for (const image_data& image : images) {
+                if (image.width != first.width || image.height != first.height || image.channels != first.channels
+                    || image.compressed.format != first.compressed.format
+                    || image.compressed.levels.size() != first.compressed.levels.size()
+                    || image.mipmaps.size() != first.mipmaps.size()) {
+                    throw_gl_error(GL_INVALID_VALUE,
+                                   fmt::format("Layer '{}' doesn't match the size and format of '{}'",
+                                               image.path,
+                                               first.path));
+                }
+                const unsigned char* pixels = image.pixels.data();
+                stacked_pixels.insert(stacked_pixels.end(), pixels, pixels + image.pixels.size());
+                for (size_t level = 0; level < compressed_data.levels.size(); ++level) {
+                    const std::vector<unsigned char>& blocks = image.compressed.levels[level];
+                    std::vector<unsigned char>& stacked      = compressed_data.levels[level];
+                    stacked.insert(stacked.end(), blocks.begin(), blocks.end());
+                }
+                for (size_t level = 0; level < stacked_mipmaps.size(); ++level) {
+                    const std::vector<unsigned char>& level_pixels = image.mipmaps[level];
+                    std::vector<unsigned char>& stacked            = stacked_mipmaps[level];
+                    stacked.insert(stacked.end(), level_pixels.begin(), level_pixels.end());
+                }
+            }
+            texture_data = pixel_buffer(std::move(stacked_pixels));
+            mipmap_data  = std::move(stacked_mipmaps);
+            texture_path = first.path;
+            width        = first.width;
+            height       = first.height;
+            channels     = first.channels;
+            layers       = static_cast<int>(images.size());
+        }
 
         // Bind the texture and make it active
         // ---------------------------------------------
         // unit: The texture unit to bind the texture to
         // ---------------------------------------------
         void bind(const unsigned int& unit = GL_TEXTURE0) {
-            glActiveTexture(unit);
-            throw_gl_error(glGetError(), fmt::format("Failed to activate texture unit {}", unit - GL_TEXTURE0));
-            glBindTexture(texture_type, tex);
-            throw_gl_error(glGetError(), fmt::format("Failed to bind texture"));
+            if (get_state().active_texture(unit)) {
+                check_gl_error("Failed to activate texture unit {}", unit - GL_TEXTURE0);
+            }
+            if (get_state().bind_texture(texture_type, tex)) {
+                check_gl_error("Failed to bind texture");
+            }
         }
         // Deactivate the texture
         // ----------------------
         void unbind() {
-            glBindTexture(texture_type, 0);
-            throw_gl_error(glGetError(), fmt::format("Failed to unbind texture"));
+            if (get_state().bind_texture(texture_type, 0)) {
+                check_gl_error("Failed to unbind texture");
+            }
         }
 
         // Load the texture data on to the GPU
-        // -----------------------------------
+        // Block compressed images upload every level that was stored in their file, and ignore both arguments.
+        // 2D textures and texture arrays get immutable storage for their whole mip chain when the driver supports it
+        // (unless a pixel_type is given), and upload the mip chain that came with their images (see
+        // decode_with_mipmaps and load_layers)
+        // ------------------------------------------------------------------------------------------------------------
         void generate(const unsigned int& mipmap_level, const unsigned int& pixel_type = -1) {
-            unsigned int pixel_format = pixel_type;
-            if (pixel_format == -1) {
-                switch (channels) {
-                    case 1: pixel_format = GL_RED; break;
-                    case 3: pixel_format = GL_RGB; break;
-                    case 4: pixel_format = GL_RGBA; break;
-                }
+            if (compressed()) {
+                generate_compressed();
+                return;
             }
+            // -1 (the default) means the pixel format for the number of channels
+            const bool default_type   = pixel_type == static_cast<unsigned int>(-1);
+            unsigned int pixel_format = default_type ? channel_format() : pixel_type;
+            const bool whole_chain    = mipmap_level == 0
+                                     && (immutable || (default_type && get_extensions().ARB_texture_storage)
+                                         || !mipmap_data.empty());
             switch (texture_type) {
                 case TextureType::TEXTURE_2D:
                     bind();
+                    if (whole_chain) {
+                        generate_levels(pixel_format);
+                        break;
+                    }
                     glTexImage2D(texture_type,
                                  mipmap_level,
                                  pixel_format,
@@ -892,21 +3392,116 @@ namespace gl {
                                  pixel_format,
                                  GL_UNSIGNED_BYTE,
                                  texture_data.data());
-                    throw_gl_error(glGetError(), fmt::format("Failed to generate texture"));
+                    check_gl_error("Failed to generate texture");
+                    finish_upload();
+                    break;
+                case TextureType::TEXTURE_2D_ARRAY:
+                    bind();
+                    if (whole_chain) {
+                        generate_levels(pixel_format);
+                        break;
+                    }
+                    glTexImage3D(texture_type,
+                                 mipmap_level,
+                                 pixel_format,
+                                 width,
+                                 height,
+                                 layers,
+                                 0,
+                                 pixel_format,
+                                 GL_UNSIGNED_BYTE,
+                                 texture_data.data());
+                    check_gl_error("Failed to generate texture array with {} layers", layers);
+                    finish_upload();
+                    break;
+                default:
+                    throw_gl_error(GL_INVALID_OPERATION,
+                                   fmt::format("Texture type '{}' currently not supported", texture_type));
+            }
+        }
+
+        // Give the texture storage for its image without copying any pixels, the pixels are copied later with
+        // generate_rows. The storage is immutable and has room for the whole mip chain if the driver supports it
+        // ------------------------------------------------------------------------------------------------------
+        void allocate() {
+            switch (texture_type) {
+                case TextureType::TEXTURE_2D:
+                    bind();
+                    if (immutable || get_extensions().ARB_texture_storage) {
+                        allocate_storage();
+                        break;
+                    }
+                    glTexImage2D(texture_type,
+                                 0,
+                                 channel_format(),
+                                 width,
+                                 height,
+                                 0,
+                                 channel_format(),
+                                 GL_UNSIGNED_BYTE,
+                                 nullptr);
+                    check_gl_error("Failed to allocate {}x{} texture", width, height);
                     break;
                 default:
                     throw_gl_error(GL_INVALID_OPERATION,
                                    fmt::format("Texture type '{}' currently not supported", texture_type));
             }
         }
+        // Copy some rows of the image to the texture through a pixel unpack buffer
+        // The pixels are written into the ring and the GPU copies them from there, so unlike generate this doesn't
+        // wait for the driver to copy the pixels out of client memory. Call allocate first, and fence the ring once
+        // the copies have been issued. The texture is ready once the last row has been copied
+        // ----------------------------------------------------------------------------------------------------------
+        // staging: A stream buffer for GL_PIXEL_UNPACK_BUFFER with room for the rows
+        // first_row: The first row to copy
+        // rows: The number of rows to copy
+        // ----------------------------------------------------------------------------------------------------------
+        void generate_rows(stream_buffer& staging, const int& first_row, const int& rows) {
+            if (texture_type != TextureType::TEXTURE_2D) {
+                throw_gl_error(GL_INVALID_OPERATION,
+                               fmt::format("Texture type '{}' currently not supported", texture_type));
+            }
+            const size_t offset = staging.write(texture_data.data() + first_row * row_size(), rows * row_size());
+
+            bind();
+            staging.bind();
+            // Rows are tightly packed in the ring
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glTexSubImage2D(texture_type,
+                            0,
+                            0,
+                            first_row,
+                            width,
+                            rows,
+                            channel_format(),
+                            GL_UNSIGNED_BYTE,
+                            reinterpret_cast<const void*>(offset));
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            // Other uploads read from client memory, which only works with no pixel unpack buffer bound
+            get_state().bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            check_gl_error("Failed to copy rows {} to {} of texture", first_row, first_row + rows);
+
+            // The mip chain is small next to level 0, so it goes straight from client memory
+            if (first_row + rows >= height) {
+                upload_mipmaps(channel_format());
+                finish_upload();
+            }
+        }
+
         // Generate mipmapped textures
-        // ---------------------------
+        // Compressed textures already have the levels from their file, and OpenGL can't generate more of them.
+        // Textures that uploaded a precomputed mip chain already have every level too
+        // ----------------------------------------------------------------------------------------------------
         void generate_mipmap() {
+            if (compressed() || precomputed_mipmaps) {
+                return;
+            }
             switch (texture_type) {
                 case TextureType::TEXTURE_2D:
+                case TextureType::TEXTURE_2D_ARRAY:
                     bind();
-                    glGenerateMipmap(GL_TEXTURE_2D);
-                    throw_gl_error(glGetError(), fmt::format("Failed to generate mipmapped texture"));
+                    glGenerateMipmap(texture_type);
+                    check_gl_error("Failed to generate mipmapped texture");
                     break;
                 default:
                     throw_gl_error(GL_INVALID_OPERATION,
@@ -921,9 +3516,9 @@ namespace gl {
                           const unsigned int& unit = GL_TEXTURE0) {
             bind(unit);
             glTexParameteri(texture_type, GL_TEXTURE_WRAP_S, s_wrap);
-            throw_gl_error(glGetError(), fmt::format("Failed to set s-wrap texture parameter"));
+            check_gl_error("Failed to set s-wrap texture parameter");
             glTexParameteri(texture_type, GL_TEXTURE_WRAP_T, t_wrap);
-            throw_gl_error(glGetError(), fmt::format("Failed to set t-wrap texture parameter"));
+            check_gl_error("Failed to set t-wrap texture parameter");
         }
 
         // Tell OpenGL how to handle texture minifying and magnifying
@@ -933,9 +3528,9 @@ namespace gl {
                             const unsigned int& unit = GL_TEXTURE0) {
             bind(unit);
             glTexParameteri(texture_type, GL_TEXTURE_MIN_FILTER, min_filter);
-            throw_gl_error(glGetError(), fmt::format("Failed to set min-filter texture parameter"));
+            check_gl_error("Failed to set min-filter texture parameter");
             glTexParameteri(texture_type, GL_TEXTURE_MAG_FILTER, mag_filter);
-            throw_gl_error(glGetError(), fmt::format("Failed to set mag-filter texture parameter"));
+            check_gl_error("Failed to set mag-filter texture parameter");
         }
 
         // Allow this texture  wrapper to be passed OpenGL functions
@@ -953,14 +3548,679 @@ namespace gl {
             return texture_path;
         }
 
+        // Choose whether the CPU copy of the image is freed once it has been uploaded (the default) or kept, e.g. to
+        // upload it again or to read texels back for picking. Call this before generate
+        // ----------------------------------------------------------------------------------------------------------
+        void set_residency(const residency& policy) {
+            cpu_residency = policy;
+        }
+        // Check if the texture still has a CPU copy of its image
+        // ------------------------------------------------------
+        bool resident() const {
+            return !texture_data.empty() || !compressed_data.levels.empty();
+        }
+
+        // Check if the texture has been given storage with generate, textures from texture_cache::load_async aren't
+        // ready until their image has been decoded and uploaded
+        // ----------------------------------------------------------------------------------------------------------
+        bool ready() const {
+            return uploaded;
+        }
+
+        // Size of the image in pixels, and the number of bytes in one row of it
+        // ---------------------------------------------------------------------
+        int rows() const {
+            return height;
+        }
+        size_t row_size() const {
+            return static_cast<size_t>(width) * channels;
+        }
+
+        // Width of the image in pixels, and the number of layers in a texture array
+        // --------------------------------------------------------------------------
+        int columns() const {
+            return width;
+        }
+        int depth() const {
+            return layers;
+        }
+
+        // The format that the image is stored in on the GPU, either a compressed format or the pixel format for the
+        // number of channels. Also the number of mip levels that came with the image: the levels of a compressed
+        // image, or level 0 and its precomputed mip chain (see decode_with_mipmaps). Images without a precomputed
+        // chain have 1 level and generate the rest after uploading it. Levels are counted from the CPU copy, so ask
+        // before a released texture is uploaded
+        // ----------------------------------------------------------------------------------------------------------
+        unsigned int format() const {
+            return compressed() ? compressed_data.format : channel_format();
+        }
+        size_t stored_levels() const {
+            return compressed() ? compressed_data.levels.size() : mipmap_data.size() + 1;
+        }
+
+        // Check if the texture holds a block compressed image, and get the name of its format
+        // ------------------------------------------------------------------------------------
+        bool compressed() const {
+            return compressed_data.format != GL_NONE;
+        }
+        const char* format_name() const {
+            return compressed_format_name(compressed_data.format);
+        }
+
     private:
+        // Upload every level of a block compressed image, mipmaps can't be generated for these so only the levels
+        // that were stored are made available for sampling
+        void generate_compressed() {
+            if (texture_type != TextureType::TEXTURE_2D && texture_type != TextureType::TEXTURE_2D_ARRAY) {
+                throw_gl_error(GL_INVALID_OPERATION,
+                               fmt::format("Texture type '{}' currently not supported", texture_type));
+            }
+            if (!compressed_format_supported(compressed_data.format)) {
+                throw_gl_error(GL_INVALID_ENUM,
+                               fmt::format("Compressed format {} of '{}' is not supported by the driver",
+                                           format_name(),
+                                           texture_path));
+            }
+            bind();
+            for (size_t level = 0; level < compressed_data.levels.size(); ++level) {
+                const std::vector<unsigned char>& blocks = compressed_data.levels[level];
+                if (texture_type == TextureType::TEXTURE_2D_ARRAY) {
+                    // The level holds the blocks of every layer, one after the other
+                    glCompressedTexImage3D(texture_type,
+                                           static_cast<GLint>(level),
+                                           compressed_data.format,
+                                           std::max(1, width >> level),
+                                           std::max(1, height >> level),
+                                           layers,
+                                           0,
+                                           static_cast<GLsizei>(blocks.size()),
+                                           blocks.data());
+                }
+                else {
+                    glCompressedTexImage2D(texture_type,
+                                           static_cast<GLint>(level),
+                                           compressed_data.format,
+                                           std::max(1, width >> level),
+                                           std::max(1, height >> level),
+                                           0,
+                                           static_cast<GLsizei>(blocks.size()),
+                                           blocks.data());
+                }
+                check_gl_error("Failed to upload level {} of compressed texture", level);
+            }
+            glTexParameteri(texture_type, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(compressed_data.levels.size()) - 1);
+            check_gl_error("Failed to set the max level of compressed texture");
+            finish_upload();
+        }
+
+        // Give a 2D texture or texture array immutable storage for its whole mip chain, if the driver supports it and
+        // it doesn't have it yet. The storage can't be resized or given another format afterwards, only written to
+        void allocate_storage() {
+            if (immutable || !get_extensions().ARB_texture_storage) {
+                return;
+            }
+            const int levels = mip_level_count(width, height);
+            if (texture_type == TextureType::TEXTURE_2D_ARRAY) {
+                get_extensions().tex_storage_3d(texture_type, levels, sized_format(), width, height, layers);
+            }
+            else {
+                get_extensions().tex_storage_2d(texture_type, levels, sized_format(), width, height);
+            }
+            check_gl_error("Failed to allocate immutable storage for {}x{}x{} texture", width, height, layers);
+            immutable = true;
+        }
+
+        // Forget the storage of the previous image before a new one is loaded. Immutable storage can't be given
+        // another size or format, so the texture object is replaced by a new one that the next generate can size
+        void reset_storage() {
+            precomputed_mipmaps = false;
+            if (!immutable) {
+                return;
+            }
+            get_deletion_queue().delete_texture(tex);
+            glGenTextures(1, &tex);
+            check_gl_error("Failed to generate texture");
+            immutable = false;
+            uploaded  = false;
+        }
+
+        // Upload level 0 and the precomputed mip chain from client memory
+        void generate_levels(const unsigned int& pixel_format) {
+            allocate_storage();
+            // Rows of decoded images are tightly packed
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            upload_level(0, pixel_format, texture_data.data());
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            upload_mipmaps(pixel_format);
+            finish_upload();
+        }
+
+        // Upload levels 1 and below from the precomputed mip chain, if the image came with one
+        void upload_mipmaps(const unsigned int& pixel_format) {
+            if (mipmap_data.empty()) {
+                return;
+            }
+            bind();
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            for (size_t level = 0; level < mipmap_data.size(); ++level) {
+                upload_level(static_cast<int>(level) + 1, pixel_format, mipmap_data[level].data());
+            }
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            precomputed_mipmaps = true;
+        }
+
+        // Copy one level of the image, or of every layer of a texture array, into the immutable storage if the texture
+        // has it
+        void upload_level(const int& level, const unsigned int& pixel_format, const unsigned char* pixels) {
+            const int level_width  = std::max(1, width >> level);
+            const int level_height = std::max(1, height >> level);
+            if (texture_type == TextureType::TEXTURE_2D_ARRAY && immutable) {
+                glTexSubImage3D(texture_type,
+                                level,
+                                0,
+                                0,
+                                0,
+                                level_width,
+                                level_height,
+                                layers,
+                                pixel_format,
+                                GL_UNSIGNED_BYTE,
+                                pixels);
+            }
+            else if (texture_type == TextureType::TEXTURE_2D_ARRAY) {
+                glTexImage3D(texture_type,
+                             level,
+                             pixel_format,
+                             level_width,
+                             level_height,
+                             layers,
+                             0,
+                             pixel_format,
+                             GL_UNSIGNED_BYTE,
+                             pixels);
+            }
+            else if (immutable) {
+                glTexSubImage2D(
+                    texture_type, level, 0, 0, level_width, level_height, pixel_format, GL_UNSIGNED_BYTE, pixels);
+            }
+            else {
+                glTexImage2D(texture_type,
+                             level,
+                             pixel_format,
+                             level_width,
+                             level_height,
+                             0,
+                             pixel_format,
+                             GL_UNSIGNED_BYTE,
+                             pixels);
+            }
+            check_gl_error("Failed to upload level {} of texture", level);
+        }
+
+        // Mark the texture as uploaded, and free the CPU copy of the image unless it is being kept
+        void finish_upload() {
+            uploaded = true;
+            if (cpu_residency == residency::release) {
+                texture_data.clear();
+                std::vector<std::vector<unsigned char>>().swap(mipmap_data);
+                compressed_data.levels.clear();
+                compressed_data.levels.shrink_to_fit();
+            }
+        }
+
+        // Sized internal format for the number of channels in the image, which immutable storage needs
+        unsigned int sized_format() const {
+            switch (channels) {
+                case 1: return GL_R8;
+                case 2: return GL_RG8;
+                case 3: return GL_RGB8;
+                default: return GL_RGBA8;
+            }
+        }
+
+        // Pixel format for the number of channels in the image
+        unsigned int channel_format() const {
+            switch (channels) {
+                case 1: return GL_RED;
+                case 2: return GL_RG;
+                case 3: return GL_RGB;
+                default: return GL_RGBA;
+            }
+        }
+
         unsigned int tex;
         TextureType texture_type;
         TextureStyle texture_style;
         std::string texture_path;
         int width, height, channels;
-        std::vector<unsigned char> texture_data;
+        // Number of images in a texture array, 1 for every other type
+        int layers = 1;
+        pixel_buffer texture_data;
+        compressed_image compressed_data;
+        // Levels 1 and below of a mip chain that was generated on the CPU, uploaded instead of calling glGenerateMipmap
+        std::vector<std::vector<unsigned char>> mipmap_data;
+        // Whether texture_data, compressed_data, and mipmap_data are freed once they have been uploaded
+        residency cpu_residency = residency::release;
+        // Whether the texture has immutable storage (glTexStorage2D/3D), which is only written with glTexSubImage2D/3D
+        bool immutable = false;
+        // Whether the levels below level 0 came from mipmap_data, so there is nothing for generate_mipmap to do
+        bool precomputed_mipmaps = false;
+        // Whether generate has given the texture storage
+        bool uploaded = false;
+    };
+
+    // How a texture is sampled, see texture::texture_wrap and texture::texture_filter
+    // -------------------------------------------------------------------------------
+    struct sampler_settings {
+        unsigned int wrap_s     = GL_REPEAT;
+        unsigned int wrap_t     = GL_REPEAT;
+        unsigned int min_filter = GL_LINEAR_MIPMAP_LINEAR;
+        unsigned int mag_filter = GL_LINEAR;
+    };
+
+    // Set how a texture is sampled, generating mipmaps first if the minifying filter uses them
+    // ----------------------------------------------------------------------------------------
+    inline void apply_sampler(texture& target, const sampler_settings& sampler) {
+        if (sampler.min_filter != GL_NEAREST && sampler.min_filter != GL_LINEAR) {
+            target.generate_mipmap();
+        }
+        target.texture_wrap(sampler.wrap_s, sampler.wrap_t);
+        target.texture_filter(sampler.min_filter, sampler.mag_filter);
+    }
+
+    // Uploads textures through a ring of pixel unpack buffer memory, a few rows at a time
+    // Each update copies at most budget bytes, so streaming big textures in is spread over several frames instead
+    // of stalling one of them. Every copy is fenced, so ring memory is only reused once the GPU has finished copying
+    // out of it
+    // ------------------------------------------------------------------------------------------------------------
+    struct texture_uploader {
+        // Create the staging ring
+        // --------------------------------------------------------------------------------------------
+        // capacity: Size of the ring in bytes, big enough for a few updates worth of rows
+        // budget: The most bytes to copy in one update
+        // --------------------------------------------------------------------------------------------
+        texture_uploader(const size_t& capacity = 8 << 20, const size_t& budget = 2 << 20)
+            : staging(GL_PIXEL_UNPACK_BUFFER, capacity), capacity(capacity), budget(std::min(budget, capacity)) {}
+
+        // Queue a texture that has its pixels (see texture::load_data) for upload
+        // The texture isn't kept alive by the queue, if it is released first it is skipped
+        // -------------------------------------------------------------------------------
+        void upload(const std::shared_ptr<texture>& target, const sampler_settings& sampler = sampler_settings()) {
+            jobs.push_back(job{target, sampler, 0});
+        }
+
+        // Copy the next budget bytes of queued rows, call this once per frame
+        // Returns the number of textures that became ready
+        // -------------------------------------------------------------------
+        size_t update() {
+            return copy(budget);
+        }
+
+        // Copy everything that is queued
+        // Returns the number of textures that became ready
+        // ------------------------------------------------
+        size_t finish() {
+            return copy(std::numeric_limits<size_t>::max());
+        }
+
+        // Number of textures that are waiting for rows to be copied
+        // ---------------------------------------------------------
+        size_t pending() const {
+            return jobs.size();
+        }
+
+    private:
+        struct job {
+            std::weak_ptr<texture> target;
+            sampler_settings sampler;
+            int next_row;
+        };
+
+        size_t copy(const size_t& limit) {
+            size_t finished = 0;
+            size_t copied   = 0;
+            while (!jobs.empty() && copied < limit) {
+                job& next                      = jobs.front();
+                std::shared_ptr<texture> target = next.target.lock();
+                if (!target) {
+                    jobs.pop_front();
+                    continue;
+                }
+
+                const size_t row = target->row_size();
+                if (target->compressed() || row == 0 || row > capacity) {
+                    // Compressed images, rows that don't fit in the ring, and empty images go straight from client
+                    // memory
+                    target->generate(0);
+                }
+                else {
+                    if (next.next_row == 0) {
+                        target->allocate();
+                    }
+                    // Always copy at least one row so that every update makes progress
+                    const size_t room = std::min(limit - copied, capacity) / row;
+                    const int rows    = static_cast<int>(
+                        std::min<size_t>(std::max<size_t>(room, 1), target->rows() - next.next_row));
+                    target->generate_rows(staging, next.next_row, rows);
+                    // Fence every copy so that a long finish can wrap around the ring safely
+                    staging.fence();
+                    copied += rows * row;
+                    next.next_row += rows;
+                    if (next.next_row < target->rows()) {
+                        continue;
+                    }
+                }
+
+                apply_sampler(*target, next.sampler);
+                jobs.pop_front();
+                ++finished;
+            }
+            return finished;
+        }
+
+        std::deque<job> jobs;
+        stream_buffer staging;
+        size_t capacity;
+        size_t budget;
+    };
+
+    // A registry of image textures shared by everything that loads them, so each image is only decoded and uploaded
+    // once. Textures are keyed by their normalised path, style, and sampler settings, and are reference counted: the
+    // cache only holds weak references, so a texture is deleted as soon as the last mesh that uses it goes away
+    // ---------------------------------------------------------------------------------------------------------------
+    struct texture_cache {
+        struct statistics {
+            size_t hits   = 0;
+            size_t misses = 0;
+        };
+
+        // Get the texture for an image file, loading it if nobody is using it yet
+        // ------------------------------------------------------------------------
+        // path: Path to the image file
+        // texture_style: How the texture is used by materials
+        // sampler: Wrapping and filtering, textures with different settings are
+        //          separate entries. Mipmaps are generated if the minifying
+        //          filter uses them
+        // policy: Whether the texture keeps its pixels after uploading them. An
+        //         entry that is loaded again with keep keeps them from then on,
+        //         or is loaded again if it has already freed them
+        // ------------------------------------------------------------------------
+        std::shared_ptr<texture> load(const std::string& path,
+                                      const TextureStyle& texture_style,
+                                      const sampler_settings& sampler = sampler_settings(),
+                                      const residency& policy         = residency::release) {
+            const std::string image = normalise_path(path);
+            const key id            = make_key(image, texture_style, sampler);
+            if (std::shared_ptr<texture> cached = find(id, policy)) {
+                // Don't hand out a texture that is still being decoded
+                if (!cached->ready()) {
+                    finish();
+                }
+                return cached;
+            }
+            ++stats.misses;
+
+            auto loaded = std::make_shared<texture>(TextureType::TEXTURE_2D, texture_style);
+            loaded->set_residency(policy);
+            loaded->load_data(decode(image, texture_style, decoding));
+            upload(*loaded, sampler);
+            entries[id] = loaded;
+            return loaded;
+        }
+
+        // Same as load, but the image is decoded on a worker thread and the texture is returned straight away
+        // The texture has no storage (and samples as black) until update or finish uploads it on this thread, use
+        // texture::ready to check. Loading a batch of textures like this decodes them in parallel, and update
+        // streams them to the GPU a few rows at a time through a pixel unpack buffer
+        // -------------------------------------------------------------------------------------------------------
+        std::shared_ptr<texture> load_async(const std::string& path,
+                                            const TextureStyle& texture_style,
+                                            const sampler_settings& sampler = sampler_settings(),
+                                            const residency& policy         = residency::release) {
+            const std::string image = normalise_path(path);
+            const key id            = make_key(image, texture_style, sampler);
+            if (std::shared_ptr<texture> cached = find(id, policy)) {
+                return cached;
+            }
+            ++stats.misses;
+
+            auto loaded = std::make_shared<texture>(TextureType::TEXTURE_2D, texture_style);
+            loaded->set_residency(policy);
+            pending.push_back(pending_upload{loaded, sampler, decode_async(image, texture_style)});
+            entries[id] = loaded;
+            return loaded;
+        }
+
+        // Decode an image on a worker thread with the same settings as load_async (see use_compression and
+        // use_mipmaps), without creating a texture for it. For images that are copied into another texture, such as
+        // the layers of a texture array (see texture::load_layers), so they aren't uploaded twice. Nothing is cached
+        // ------------------------------------------------------------------------------------------------------------
+        std::future<image_data> decode_async(const std::string& path, const TextureStyle& texture_style) {
+            // The workers are only started the first time that they are needed
+            if (!workers) {
+                workers.reset(new thread_pool());
+            }
+            const std::string image        = normalise_path(path);
+            const decode_settings settings = decoding;
+            return workers->submit(
+                [image, texture_style, settings]() { return decode(image, texture_style, settings); });
+        }
+
+        // Queue the textures from load_async whose images have finished decoding for upload, and copy the next
+        // part of the upload queue through the pixel unpack ring (see texture_uploader). Call this once per frame
+        // Returns the number of textures that became ready
+        // -------------------------------------------------------------------------------------------------------
+        size_t update() {
+            for (auto job = pending.begin(); job != pending.end();) {
+                if (job->decoded.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                    ++job;
+                    continue;
+                }
+                pending_upload ready_job = std::move(*job);
+                job                      = pending.erase(job);
+                complete(ready_job);
+            }
+            return uploader ? uploader->update() : 0;
+        }
+
+        // Wait for every image from load_async to be decoded and upload them all
+        // ----------------------------------------------------------------------
+        void finish() {
+            while (!pending.empty()) {
+                pending_upload job = std::move(pending.front());
+                pending.erase(pending.begin());
+                complete(job);
+            }
+            if (uploader) {
+                uploader->finish();
+            }
+        }
+
+        // Compress images to BC1 or BC3 as they are loaded (see decode_and_compress_image), which uses a quarter to
+        // an eighth of the memory and bandwidth of the decoded pixels. Only affects textures that are loaded later.
+        // Does nothing if the driver can't sample S3TC textures
+        // ----------------------------------------------------------------------------------------------------------
+        // cache_directory: Existing directory to keep the compressed images in, or empty to compress on every run
+        // ----------------------------------------------------------------------------------------------------------
+        void use_compression(const std::string& cache_directory) {
+            decoding.compress          = get_extensions().EXT_texture_compression_s3tc;
+            decoding.compression_cache = cache_directory;
+        }
+
+        // Generate the mip chains of images on the CPU as they are loaded (see decode_with_mipmaps), filtering diffuse
+        // maps in linear light, and upload them with level 0 instead of generating them with glGenerateMipmap. Only
+        // affects textures that are loaded later, and images that are compressed (see use_compression) keep the mip
+        // chain from the compressor
+        // ------------------------------------------------------------------------------------------------------------
+        // cache_directory: Existing directory to keep the mip chains in, or empty to generate them on every run
+        // ------------------------------------------------------------------------------------------------------------
+        void use_mipmaps(const std::string& cache_directory) {
+            decoding.mipmaps      = true;
+            decoding.mipmap_cache = cache_directory;
+            glGetIntegerv(GL_MAX_TEXTURE_SIZE, &decoding.max_size);
+            check_gl_error("Failed to get the maximum texture size");
+        }
+
+        // Forget the entries for textures that have been deleted
+        // Returns the number of entries that were removed
+        // ------------------------------------------------------
+        size_t prune() {
+            size_t removed = 0;
+            for (auto entry = entries.begin(); entry != entries.end();) {
+                if (entry->second.expired()) {
+                    entry = entries.erase(entry);
+                    ++removed;
+                }
+                else {
+                    ++entry;
+                }
+            }
+            return removed;
+        }
+
+        // Number of entries in the cache, including expired ones that haven't been pruned yet
+        // -----------------------------------------------------------------------------------
+        size_t size() const {
+            return entries.size();
+        }
+
+        // Get the number of loads that found a live texture and the number that had to load the image
+        // -------------------------------------------------------------------------------------------
+        const statistics& get_statistics() const {
+            return stats;
+        }
+
+        // Turn a path into the form that is used as its key, so that different spellings of the same file share one
+        // texture. Separators become '/', and "." and "dir/.." components are removed
+        // Example: normalise_path("models\\nanosuit/./textures/../arm.png") == "models/nanosuit/arm.png"
+        // ---------------------------------------------------------------------------------------------------------
+        static std::string normalise_path(const std::string& path) {
+            std::string separated = path;
+            std::replace(separated.begin(), separated.end(), '\\', '/');
+            const bool absolute = !separated.empty() && separated.front() == '/';
+
+            std::vector<std::string> components;
+            std::stringstream stream(separated);
+            std::string component;
+            while (std::getline(stream, component, '/')) {
+                if (component.empty() || component == ".") {
+                    continue;
+                }
+                if (component == ".." && !components.empty() && components.back() != "..") {
+                    components.pop_back();
+                    continue;
+                }
+                // ".." can't go above the root of an absolute path
+                if (component == ".." && absolute) {
+                    continue;
+                }
+                components.push_back(component);
+            }
+
+            std::string normalised = absolute ? "/" : "";
+            for (size_t i = 0; i < components.size(); ++i) {
+                normalised += (i > 0 ? "/" : "") + components[i];
+            }
+            return normalised.empty() ? "." : normalised;
+        }
+
+    private:
+        // Path, style, wrap s, wrap t, min filter, and mag filter
+        // Residency isn't part of the key, so one image is only loaded once whether its pixels are kept or not
+        using key = std::tuple<std::string, unsigned int, unsigned int, unsigned int, unsigned int, unsigned int>;
+
+        // A texture from load_async that is waiting for its image
+        struct pending_upload {
+            std::weak_ptr<texture> target;
+            sampler_settings sampler;
+            std::future<image_data> decoded;
+        };
+
+        // How images are decoded, see use_compression and use_mipmaps
+        struct decode_settings {
+            bool compress = false;
+            std::string compression_cache;
+            bool mipmaps = false;
+            std::string mipmap_cache;
+            // GL_MAX_TEXTURE_SIZE, read on the thread with the context since decoding happens on worker threads
+            int max_size = 0;
+        };
+
+        static image_data decode(const std::string& image,
+                                 const TextureStyle& texture_style,
+                                 const decode_settings& settings) {
+            if (settings.compress) {
+                return decode_and_compress_image(image, settings.compression_cache);
+            }
+            if (settings.mipmaps) {
+                // Diffuse maps are colours, every other map holds data that is filtered as is
+                const bool srgb = texture_style == TextureStyle::TEXTURE_DIFFUSE;
+                return decode_with_mipmaps(image, srgb, settings.mipmap_cache, settings.max_size);
+            }
+            return decode_image(image);
+        }
+
+        static key make_key(const std::string& image,
+                            const TextureStyle& texture_style,
+                            const sampler_settings& sampler) {
+            return key(image, texture_style, sampler.wrap_s, sampler.wrap_t, sampler.min_filter, sampler.mag_filter);
+        }
+
+        // Find a texture that is still alive, and upgrade it to keep its pixels if the caller needs them
+        // A texture that has already freed its pixels can't get them back, so it is a miss and the image is loaded
+        // again into a new entry (the old texture lives on for the meshes that already use it)
+        std::shared_ptr<texture> find(const key& id, const residency& policy) {
+            auto entry = entries.find(id);
+            if (entry != entries.end()) {
+                if (std::shared_ptr<texture> cached = entry->second.lock()) {
+                    if (policy == residency::keep) {
+                        if (cached->ready() && !cached->resident()) {
+                            return nullptr;
+                        }
+                        cached->set_residency(residency::keep);
+                    }
+                    ++stats.hits;
+                    return cached;
+                }
+            }
+            return nullptr;
+        }
+
+        // Copy a decoded image to the GPU and set up sampling
+        static void upload(texture& target, const sampler_settings& sampler) {
+            target.generate(0);
+            apply_sampler(target, sampler);
+        }
+
+        // Queue the image of a load_async texture for upload, rethrows the exception if decoding it failed
+        // Textures that were released while their image was being decoded are skipped
+        void complete(pending_upload& job) {
+            image_data image = job.decoded.get();
+            if (std::shared_ptr<texture> target = job.target.lock()) {
+                target->load_data(std::move(image));
+                // The uploader is only created the first time that it is needed
+                if (!uploader) {
+                    uploader.reset(new texture_uploader());
+                }
+                uploader->upload(target, job.sampler);
+            }
+        }
+
+        std::map<key, std::weak_ptr<texture>> entries;
+        std::vector<pending_upload> pending;
+        std::unique_ptr<thread_pool> workers;
+        std::unique_ptr<texture_uploader> uploader;
+        decode_settings decoding;
+        statistics stats;
     };
+
+    // Get the texture cache for the current context
+    // These examples only ever create a single context, so there is only one cache
+    // ----------------------------------------------------------------------------
+    inline texture_cache& get_texture_cache() {
+        static texture_cache instance;
+        return instance;
+    }
 }  // namespace gl
 }  // namespace utility
 
@@ -0,0 +1,95 @@
+#ifndef UTILITY_THREAD_POOL_HPP
+#define UTILITY_THREAD_POOL_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace utility {
+    // A fixed set of worker threads that run jobs in the order they were submitted
+    // Jobs must not make OpenGL calls, the workers don't have a context current. Do the CPU work (decoding,
+    // compressing) on the pool and hand the results back to the render thread through the returned future
+    // -----------------------------------------------------------------------------------------------------
+    struct thread_pool {
+        // Start the worker threads
+        // --------------------------------------------------------------
+        // threads: Number of workers, defaults to one per hardware thread
+        // --------------------------------------------------------------
+        explicit thread_pool(const size_t& threads = std::max(1u, std::thread::hardware_concurrency())) {
+            for (size_t i = 0; i < threads; ++i) {
+                workers.emplace_back([this]() { run(); });
+            }
+        }
+        thread_pool(const thread_pool& pool) = delete;
+        thread_pool& operator=(const thread_pool& pool) = delete;
+        // Finish the jobs that are already queued and stop the workers
+        // ------------------------------------------------------------
+        ~thread_pool() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            ready.notify_all();
+            for (std::thread& worker : workers) {
+                worker.join();
+            }
+        }
+
+        // Queue a job, the future holds its result (or the exception that it threw) once a worker has run it
+        // --------------------------------------------------------------------------------------------------
+        template <typename F>
+        std::future<typename std::result_of<F()>::type> submit(F&& job) {
+            using result = typename std::result_of<F()>::type;
+            // std::function has to be copyable, so the move-only task is shared with the queue entry
+            auto task                  = std::make_shared<std::packaged_task<result()>>(std::forward<F>(job));
+            std::future<result> future = task->get_future();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                jobs.emplace_back([task]() { (*task)(); });
+            }
+            ready.notify_one();
+            return future;
+        }
+
+        // Number of worker threads
+        // ------------------------
+        size_t size() const {
+            return workers.size();
+        }
+
+    private:
+        void run() {
+            while (true) {
+                std::function<void()> job;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    ready.wait(lock, [this]() { return stopping || !jobs.empty(); });
+                    if (jobs.empty()) {
+                        return;
+                    }
+                    job = std::move(jobs.front());
+                    jobs.pop_front();
+                }
+                job();
+            }
+        }
+
+        std::vector<std::thread> workers;
+        std::deque<std::function<void()>> jobs;
+        std::mutex mutex;
+        std::condition_variable ready;
+        bool stopping = false;
+    };
+}  // namespace utility
+
+
+#endif  // UTILITY_THREAD_POOL_HPP